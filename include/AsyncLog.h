@@ -0,0 +1,115 @@
+/*
+Asynchronous ring buffer logger
+
+Serial.printf() at 115200 baud blocks the caller until the text is sent,
+which skews the timing of the scheduler and of the eModbus callbacks.
+With AsyncLog the caller only copies the format string pointer and the
+arguments into a lock free ring (multi producer, single consumer); a low
+priority task formats the entries and writes them to the console.
+If the ring is full the entry is dropped and counted.
+
+Restrictions:
+  - the format string must be a string literal (only the pointer is stored)
+  - %s arguments must point to static strings (e.g. names of the device table)
+  - up to LOG_MAX_ARGS arguments: integers, floating point values and pointers
+
+customized by Armin Pressler 2022
+*/
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <type_traits>
+
+#ifndef LOG_QUEUE_SIZE
+#define LOG_QUEUE_SIZE 256 // entries, must be a power of 2
+#endif
+#ifndef LOG_MAX_ARGS
+#define LOG_MAX_ARGS 8
+#endif
+
+union LogArg
+{
+  int64_t i;
+  uint64_t u;
+  double d;
+  const void *p;
+};
+
+struct LogEntry
+{
+  std::atomic<uint32_t> sequence; // cell state of the ring
+  const char *format;
+  uint8_t numArgs;
+  LogArg args[LOG_MAX_ARGS];
+};
+
+class AsyncLog
+{
+public:
+  typedef void (*Sink)(const char *text, size_t length);
+
+  AsyncLog();
+
+  template <typename... Args>
+  bool write(const char *format, Args... args)
+  {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    LogEntry *entry = reserve();
+    if (entry == 0)
+    {
+      return false;
+    }
+    entry->format = format;
+    entry->numArgs = sizeof...(Args);
+    store(entry->args, args...);
+    publish(entry);
+    return true;
+  }
+
+  // consumer: formats and writes all waiting entries, returns the number of entries
+  uint32_t drain(Sink sink);
+
+  uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+  uint32_t written() const { return _written; }
+
+  // formats one entry, returns the length (text is always terminated)
+  static size_t format(const LogEntry &entry, char *text, size_t size);
+
+protected:
+  LogEntry *reserve();
+  void publish(LogEntry *entry);
+
+  static void store(LogArg *) {}
+  template <typename T, typename... Rest>
+  static void store(LogArg *arg, T value, Rest... rest)
+  {
+    set(*arg, value);
+    store(arg + 1, rest...);
+  }
+  template <typename T>
+  static typename std::enable_if<std::is_floating_point<T>::value>::type set(LogArg &arg, T value) { arg.d = value; }
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type set(LogArg &arg, T value) { arg.i = value; }
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type set(LogArg &arg, T value) { arg.u = value; }
+  template <typename T>
+  static typename std::enable_if<std::is_enum<T>::value>::type set(LogArg &arg, T value) { arg.i = (int64_t)value; }
+  template <typename T>
+  static void set(LogArg &arg, T *value) { arg.p = value; }
+
+  LogEntry _ring[LOG_QUEUE_SIZE];
+  std::atomic<uint32_t> _head; // next entry to reserve (producers)
+  uint32_t _tail;              // next entry to drain (consumer)
+  std::atomic<uint32_t> _dropped;
+  uint32_t _written;
+};
+
+extern AsyncLog Log;
+
+// drop-in for Serial.printf() / LOG_x in time critical code
+#define ALOG(...) Log.write(__VA_ARGS__)
+
+#endif
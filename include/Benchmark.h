@@ -0,0 +1,56 @@
+/*
+Benchmarks of the polling, decode and dispatch hot paths
+
+Every benchmark runs a fixed number of operations and hands one result row
+to the output function, e.g. as CSV:
+
+  benchmark,param,iterations,total_us,ns_per_op
+  decode,125,2000,1520,760
+
+  decode        decodeRegisters(), param = registers per response
+  dispatch      nextToken() + validate() + tag walk, param = number of requests
+  schedule      one PollScheduler::next() decision, param = number of devices
+                (dispatch and schedule: 1 .. 512, limited to POLL_MAX_DEVICES)
+  sim_cycle     schedule + simulated transfer + validate + decode of one request,
+                param = baud rate (CPU time, 1e9 / ns_per_op = cycles per second)
+  sim_wire      the same requests on the simulated wire with a saturated bus,
+                ns_per_op = bus time per request (wire, latency, guard times, faults)
+
+No dependency to the Arduino framework, the clock is given by the caller,
+so the same numbers can be taken on the device (GET /bench) and on a PC
+(test/test_benchmark, writes benchmark.csv).
+The benchmarks use static buffers, only one may run at a time.
+
+customized by Armin Pressler 2022
+*/
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdint.h>
+
+typedef uint32_t (*BenchClock)(); // [us]
+typedef void (*BenchOutput)(void *context, const char *name, uint32_t param, uint32_t iterations, uint32_t totalMicros,
+                            uint32_t nanosPerOp);
+
+class Benchmark
+{
+public:
+  Benchmark(BenchClock clock, BenchOutput output, void *context);
+
+  void runAll(uint32_t baudrate);
+
+  void decode(uint16_t numValues, uint32_t iterations);
+  void dispatch(uint16_t numRequests, uint32_t iterations);
+  void schedule(uint16_t numDevices, uint32_t iterations);
+  void simulatedBus(uint32_t baudrate, uint32_t requests);
+
+protected:
+  void report(const char *name, uint32_t param, uint32_t iterations, uint32_t start);
+
+  BenchClock _clock;
+  BenchOutput _output;
+  void *_context;
+  volatile uint32_t _sink; // keeps the compiler from removing the measured code
+};
+
+#endif
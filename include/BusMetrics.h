@@ -0,0 +1,68 @@
+/*
+Per device metrics of the Modbus client
+
+Fixed bucket latency histograms and error counters for every read request,
+plus queue depth and poll interval statistics. Everything is allocated
+statically, updating a counter is a few instructions, so it can be called
+from the eModbus callbacks. Output is done by the /metrics web handler.
+
+Every counter has one writer: the counters of a request and the error and
+queue counters of a bus are only updated by the task and callbacks of its
+bus, so the two bus tasks never increment the same counter.
+
+customized by Armin Pressler 2022
+*/
+#ifndef BUS_METRICS_H
+#define BUS_METRICS_H
+
+#include <stdint.h>
+#include "ModbusDevice.h"
+#include "PollScheduler.h"
+
+// upper bounds of the latency buckets [ms], the last bucket is +Inf
+#define LATENCY_BUCKETS 9
+static const uint32_t LATENCY_BOUNDS[LATENCY_BUCKETS - 1] = {10, 25, 50, 100, 250, 500, 1000, 2500};
+
+struct DeviceMetrics
+{
+  uint32_t requests;
+  uint32_t responses;
+  uint32_t timeouts;
+  uint32_t crcErrors;
+  uint32_t exceptions;  // Modbus exception responses of the server (codes 0x01..0x0B)
+  uint32_t otherErrors; // all other eModbus errors
+  uint32_t latencyBuckets[LATENCY_BUCKETS];
+  uint32_t latencySum; // [ms]
+  uint32_t requestTime;
+  uint32_t lastPoll;     // millis() of the last request
+  uint32_t pollInterval; // [ms] time between the last two requests
+  uint32_t maxPollInterval;
+};
+
+class BusMetrics
+{
+public:
+  BusMetrics();
+
+  void requestSent(uint16_t index, uint32_t now);
+  void responseReceived(uint16_t index, uint32_t now);
+  void error(uint8_t bus, int16_t index, uint8_t code); // index may be -1 for errors without request
+  void queueDepth(uint8_t bus, uint32_t depth);
+  void loopTime(uint32_t ms);
+
+  const DeviceMetrics &device(uint16_t index) const { return _device[index]; }
+  uint32_t errorCount(uint8_t bus, uint8_t code) const { return bus < MODBUS_MAX_BUSES ? _errors[bus][code] : 0; }
+  uint32_t errorCount(uint8_t code) const; // all buses
+  uint32_t queueDepth(uint8_t bus) const { return bus < MODBUS_MAX_BUSES ? _queueDepth[bus] : 0; }
+  uint32_t maxQueueDepth(uint8_t bus) const { return bus < MODBUS_MAX_BUSES ? _maxQueueDepth[bus] : 0; }
+  uint32_t maxLoopTime() const { return _maxLoopTime; }
+
+protected:
+  DeviceMetrics _device[POLL_MAX_DEVICES];
+  uint32_t _errors[MODBUS_MAX_BUSES][256]; // all errors by bus and eModbus error code
+  uint32_t _queueDepth[MODBUS_MAX_BUSES];
+  uint32_t _maxQueueDepth[MODBUS_MAX_BUSES];
+  uint32_t _maxLoopTime;
+};
+
+#endif
@@ -0,0 +1,47 @@
+/*
+Modbus TCP gateway answered from the register snapshots
+
+SCADA clients read the RTU servers through the Modbus TCP server on the W5500,
+the unit ID is the RTU server ID. The requests are answered from the latest
+snapshots only, so any number of TCP polls adds no frame to the RS485 bus.
+
+A request may span several device table rows of the same server and function
+code, every requested register must be covered by one of them:
+  - registers not in the device table      -> ILLEGAL_DATA_ADDRESS (0x02)
+  - no data yet or older than GATEWAY_STALE_PERIODS poll periods
+                                           -> GATEWAY_TARGET_NO_RESP (0x0B)
+respond() handles a whole request frame, it is the gateway worker of the
+Modbus TCP server and has no Arduino dependency, so it runs on a PC too.
+
+customized by Armin Pressler 2022
+*/
+#ifndef CACHE_GATEWAY_H
+#define CACHE_GATEWAY_H
+
+#include <stdint.h>
+#include "ModbusDevice.h"
+#include "RegisterSnapshot.h"
+
+#ifndef GATEWAY_STALE_PERIODS
+#define GATEWAY_STALE_PERIODS 3 // cached values older than x poll periods are not served
+#endif
+#define GATEWAY_MAX_RESPONSE (3 + 2 * MODBUS_MAX_READ_REGISTERS) // server ID, FC, byte count, values
+
+class CacheGateway
+{
+public:
+  CacheGateway(const ModbusDevice *tags, const RegisterSnapshot *snapshots, uint16_t numTags);
+
+  // fills values with count registers, returns 0 or the Modbus exception code
+  uint8_t read(uint8_t serverID, uint8_t functionCode, uint16_t address, uint16_t count, uint16_t *values, uint32_t now) const;
+  // answers a request frame (server ID, FC, address, count) with the response frame (server ID, FC, byte count,
+  // values or server ID, FC | 0x80, exception code), response needs GATEWAY_MAX_RESPONSE bytes, returns its length
+  uint16_t respond(const uint8_t *request, uint16_t length, uint8_t *response, uint32_t now) const;
+
+protected:
+  const ModbusDevice *_tags;
+  const RegisterSnapshot *_snapshots;
+  uint16_t _numTags;
+};
+
+#endif
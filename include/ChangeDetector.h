@@ -0,0 +1,60 @@
+/*
+Report by exception: change detection with deadbands
+
+One ChangeDetector per device table row compares every new snapshot with the
+last reported value of each register. A register has changed if the difference
+is larger than its deadband (0 = every change). Changed registers get
+
+  - the next value of the global change sequence (for any number of consumers:
+    "give me everything changed since my cursor", one cursor per device)
+  - a bit in the dirty bitmap (for one consumer, e.g. the display: takeDirty())
+
+The first snapshot marks all registers as changed.
+update() is called by the writer of the snapshots only (eModbus task).
+
+customized by Armin Pressler 2022
+*/
+#ifndef CHANGE_DETECTOR_H
+#define CHANGE_DETECTOR_H
+
+#include <stdint.h>
+#include <atomic>
+#include "ModbusDevice.h"
+
+#define DIRTY_WORDS ((MODBUS_MAX_READ_REGISTERS + 31) / 32)
+
+class ChangeDetector
+{
+public:
+  ChangeDetector();
+
+  void setDeadband(uint16_t deadband); // for all registers
+  void setDeadband(uint16_t offset, uint16_t deadband);
+
+  // compares the new values, returns the number of changed registers
+  uint16_t update(const uint16_t *values, uint16_t numValues);
+
+  // change sequence of the last published change of this device
+  uint32_t lastChange() const { return _lastChange.load(std::memory_order_acquire); }
+
+  // offsets of the registers changed after the cursor of the consumer, returns the number of offsets.
+  // The cursor (start with 0) is moved to the last published change, offsets must have room
+  // for MODBUS_MAX_READ_REGISTERS, otherwise the cursor is only moved if all changes fit in.
+  uint16_t changedSince(uint32_t &cursor, uint16_t *offsets, uint16_t maxOffsets) const;
+
+  // dirty bitmap since the last call, for a single consumer
+  void takeDirty(uint32_t bitmap[DIRTY_WORDS]);
+  static bool isDirty(const uint32_t bitmap[DIRTY_WORDS], uint16_t offset) { return bitmap[offset / 32] & (1UL << (offset % 32)); }
+
+protected:
+  static std::atomic<uint32_t> _globalSequence;
+
+  bool _initialized;
+  uint16_t _reported[MODBUS_MAX_READ_REGISTERS]; // reference values for the deadband
+  uint16_t _deadband[MODBUS_MAX_READ_REGISTERS];
+  std::atomic<uint32_t> _changed[MODBUS_MAX_READ_REGISTERS]; // change sequence of each register
+  std::atomic<uint32_t> _dirty[DIRTY_WORDS];
+  std::atomic<uint32_t> _lastChange;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*
+Bus health circuit breaker for the eModBus client
+
+A dead server costs a full timeout on every poll and may disturb the whole
+bus. After BREAKER_THRESHOLD consecutive timeouts the device is quarantined:
+
+  CLOSED  --N timeouts-->  OPEN  --backoff over-->  PROBING
+     ^                      ^                          |
+     |                      +------ probe failed ------+ (backoff doubled)
+     +------------------ probe answered ---------------+
+
+In OPEN state the device is not polled, PROBING sends a single register read
+with a short timeout. The backoff starts with BREAKER_BACKOFF_MIN and doubles
+up to BREAKER_BACKOFF_MAX.
+No Arduino dependency, the time is always given by the caller.
+
+customized by Armin Pressler 2022
+*/
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <stdint.h>
+#include "PollScheduler.h"
+
+#ifndef BREAKER_THRESHOLD
+#define BREAKER_THRESHOLD 3 // consecutive timeouts until a device is quarantined
+#endif
+#ifndef BREAKER_BACKOFF_MIN
+#define BREAKER_BACKOFF_MIN 5000 // [ms] first probe after quarantine
+#endif
+#ifndef BREAKER_BACKOFF_MAX
+#define BREAKER_BACKOFF_MAX 300000 // [ms] longest time between two probes
+#endif
+
+enum BREAKER_STATE
+{
+  BREAKER_CLOSED,  // normal polling
+  BREAKER_OPEN,    // quarantined, waiting for the next probe
+  BREAKER_PROBING  // probe request sent
+};
+
+struct BreakerState
+{
+  uint8_t state;              // BREAKER_STATE
+  uint16_t consecutiveErrors; // timeouts in a row
+  uint32_t backoff;           // [ms] current probe interval
+  uint32_t nextProbe;         // millis() of the next probe
+  uint32_t quarantines;       // how often the device was quarantined
+  uint32_t probes;            // probe requests sent
+};
+
+class CircuitBreaker
+{
+public:
+  CircuitBreaker();
+
+  // a good response (normal poll or probe) closes the breaker
+  void success(uint16_t index);
+  // a timeout, returns true if the device is (still) quarantined afterwards
+  bool timeout(uint16_t index, uint32_t now);
+  // the probe request was sent
+  void probeSent(uint16_t index);
+
+  bool isClosed(uint16_t index) const { return index >= POLL_MAX_DEVICES || _state[index].state == BREAKER_CLOSED; }
+  const BreakerState &state(uint16_t index) const { return _state[index]; }
+
+  static const char *stateName(uint8_t state);
+
+protected:
+  BreakerState _state[POLL_MAX_DEVICES];
+};
+
+#endif
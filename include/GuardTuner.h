@@ -0,0 +1,92 @@
+/*
+Adaptive guard time learning for slow RTU servers
+
+Some servers (e.g. the XY-MD02) need a long 'resting' time before and after
+a request, others work fine with 1 ms. Instead of hand tuning the guard times
+the tuner measures the response latency and the timeout rate of every device:
+
+  - after GUARD_DECREASE_AFTER error free responses the guard times are
+    decreased by 1/8 (at least 1 ms, down to GUARD_MIN), but never below
+    the last known bad value + margin
+  - on a timeout (or CRC error) the guardBefore of the failing device and the
+    guardAfter of the request before it on the same bus are doubled (at least
+    GUARD_START), a slow device like the XY-MD02 disturbs the *next* request.
+    The failing values are remembered as lower limits of these guard times.
+  - the lower limits are relaxed slowly after a long error free period, so
+    the tuner can follow devices which got better (e.g. better power supply)
+
+Both guard times are tuned on their own, a device without a guard time in
+the table gets one as soon as it is needed.
+The guard times of the device table are the start values.
+No Arduino dependency, the time is always given by the caller.
+
+customized by Armin Pressler 2022
+*/
+#ifndef GUARD_TUNER_H
+#define GUARD_TUNER_H
+
+#include <stdint.h>
+#include "ModbusDevice.h"
+#include "PollScheduler.h"
+
+#ifndef GUARD_MIN
+#define GUARD_MIN 1 // [ms] smallest guard time the tuner will use
+#endif
+#ifndef GUARD_MAX
+#define GUARD_MAX 2000 // [ms] largest guard time the tuner will use
+#endif
+#ifndef GUARD_START
+#define GUARD_START 10 // [ms] first guard time after an error if there was none
+#endif
+#ifndef GUARD_DECREASE_AFTER
+#define GUARD_DECREASE_AFTER 5 // error free responses before the guard time is decreased
+#endif
+#ifndef GUARD_RELAX_AFTER
+#define GUARD_RELAX_AFTER 200 // error free responses before the lower limit is relaxed
+#endif
+
+struct GuardState
+{
+  uint32_t guardBefore; // active guard times
+  uint32_t guardAfter;
+  uint32_t floorBefore; // last guard times which caused an error (0 = none yet)
+  uint32_t floorAfter;
+  uint32_t requestTime; // millis() when the request was sent
+  uint32_t latency;     // averaged response latency [ms]
+  uint32_t maxLatency;  // largest response latency [ms]
+  uint32_t responses;   // number of good responses
+  uint32_t timeouts;    // number of timeouts/CRC errors
+  uint16_t goodInRow;   // error free responses since last change
+  uint16_t relaxCount;  // error free responses since last floor relaxation
+};
+
+class GuardTuner
+{
+public:
+  explicit GuardTuner(PollScheduler &scheduler);
+
+  void begin();
+
+  // call when the request of device <index> was sent, with an index >= numDevices()
+  // for other requests on the bus (e.g. writes)
+  void requestSent(uint16_t index, uint32_t now);
+  // call from the onData handler
+  void responseReceived(uint16_t index, uint32_t now);
+  // call from the onError handler with TIMEOUT or CRC_ERROR, charges the device
+  // and the request sent before it
+  void busError(uint16_t index);
+
+  const GuardState &state(uint16_t index) const { return _state[index]; }
+
+protected:
+  static void grow(uint32_t &guard, uint32_t &floor);
+  static void shrink(uint32_t &guard, uint32_t floor);
+  void apply(uint16_t index);
+
+  PollScheduler &_scheduler;
+  GuardState _state[POLL_MAX_DEVICES];
+  uint16_t _current;  // last request sent on the bus
+  uint16_t _previous; // the request before it
+};
+
+#endif
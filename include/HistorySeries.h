@@ -0,0 +1,71 @@
+/*
+Compressed in-RAM history of one register
+
+The samples are stored in a ring of fixed size blocks. Every block starts
+with the absolute time and value of its first sample, all following samples
+are stored as differences:
+
+  block: | used (1) | samples (1) | time (4) | value (2) | dt varint | dv zigzag varint | ...
+
+dt is the time since the previous sample [ms], dv the difference of the value
+(zigzag coded, so small negative differences are small numbers too).
+A slowly changing register polled every 5 s needs about 3 bytes per sample
+instead of 6. If the ring is full, the oldest block is dropped.
+A query decodes the blocks one after the other and hands every sample in the
+time range to a visitor function, nothing is copied to RAM.
+
+The memory is given by the caller (e.g. from PSRAM). Not thread safe,
+append() and query() must be called from the same task.
+
+customized by Armin Pressler 2022
+*/
+#ifndef HISTORY_SERIES_H
+#define HISTORY_SERIES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef HISTORY_BLOCK_SIZE
+#define HISTORY_BLOCK_SIZE 128 // bytes per block, max 255
+#endif
+
+// return false to stop the query
+typedef bool (*HistoryVisitor)(void *context, uint32_t time, uint16_t value);
+
+class HistorySeries
+{
+public:
+  HistorySeries();
+
+  // size is rounded down to full blocks, at least 2 blocks are needed
+  bool begin(uint8_t *buffer, size_t size);
+
+  void append(uint32_t time, uint16_t value);
+
+  // visits all samples with from <= time <= to (millis(), wrap around safe),
+  // returns the number of visited samples
+  uint32_t query(uint32_t from, uint32_t to, HistoryVisitor visitor, void *context) const;
+
+  uint32_t samples() const { return _samples; } // samples in the ring
+  size_t bytesUsed() const;
+  size_t capacity() const { return _numBlocks * HISTORY_BLOCK_SIZE; }
+  uint32_t oldest() const; // time of the oldest sample
+
+protected:
+  static const uint8_t HEADER_SIZE = 8;
+
+  uint8_t *block(uint16_t index) const { return _buffer + (size_t)index * HISTORY_BLOCK_SIZE; }
+  void startBlock(uint32_t time, uint16_t value);
+  static uint8_t putVarint(uint8_t *p, uint32_t v);
+  static uint8_t getVarint(const uint8_t *p, const uint8_t *end, uint32_t &v);
+
+  uint8_t *_buffer;
+  uint16_t _numBlocks;
+  uint16_t _first;  // oldest block
+  uint16_t _count;  // blocks in use
+  uint32_t _samples;
+  uint32_t _lastTime; // last sample, base of the next difference
+  uint16_t _lastValue;
+};
+
+#endif
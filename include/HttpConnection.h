@@ -0,0 +1,70 @@
+/*
+One keep-alive HTTP connection of the web server task
+
+aWOT handles one request per Application::process() call and leaves the
+socket open. The connection is handed to aWOT wrapped in this class, which
+forwards everything to the EthernetClient and watches the response headers:
+the socket is kept open for the next request only if the end of the
+response is known to the browser (Content-Length or chunked) and neither
+side asked for "Connection: close". A streamed response without length
+ends with closing the socket, as before.
+A response with "Content-Type: text/event-stream" turns the connection into
+a Server-Sent Events stream: it stays open without idle timeout and the
+owner writes the events to it until the browser goes away.
+
+customized by Armin Pressler 2022
+*/
+#ifndef HTTP_CONNECTION_H
+#define HTTP_CONNECTION_H
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <aWOT.h>
+
+class HttpConnection : public Client
+{
+public:
+  HttpConnection();
+
+  void attach(const EthernetClient &client, uint32_t now);
+  bool active() { return _active; }
+  bool eventStream() { return _active && _eventStream; }
+
+  // handles one request if data is waiting, closes the socket if it can't be kept
+  // requestConnection: value of the "Connection" header of the request
+  // returns true if a request was processed
+  bool serve(Application &app, const char *requestConnection, uint32_t now);
+  // closes the socket after the idle timeout (not for event streams) or if the peer has closed it
+  void checkIdle(uint32_t now, uint32_t timeout);
+
+  // Client
+  int connect(IPAddress ip, uint16_t port) override { return 0; }
+  int connect(const char *host, uint16_t port) override { return 0; }
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t *buf, size_t size) override;
+  int available() override { return _client.available(); }
+  int availableForWrite() override { return _client.availableForWrite(); }
+  int read() override { return _client.read(); }
+  int read(uint8_t *buf, size_t size) override { return _client.read(buf, size); }
+  int peek() override { return _client.peek(); }
+  void flush() override { _client.flush(); }
+  void stop() override;
+  uint8_t connected() override { return _client.connected(); }
+  operator bool() override { return _active; }
+
+protected:
+  void parseHeader(char c);
+
+  EthernetClient _client;
+  bool _active;
+  uint32_t _lastUse;
+  // response header parser
+  bool _inHeader;
+  bool _lengthKnown;
+  bool _closeSent;
+  bool _eventStream;
+  uint8_t _lineLength;
+  char _line[40]; // only the start of a header line is needed
+};
+
+#endif
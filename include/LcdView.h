@@ -0,0 +1,75 @@
+/*
+Retained mode text view for the LCD
+
+The screen is described by a layout of text fields (position and width in
+characters). The application prints into the fields whenever it likes,
+this only changes RAM. render() compares every field with a shadow copy of
+what is on the screen and draws only the fields whose text changed, so an
+unchanged screen costs no SPI transfer at all.
+A shorter text is padded with blanks to the length of the old one, the
+draw function has to paint the background (e.g. setTextColor(fg, bg)).
+With a frame time > 0 render() draws at most once per frame time.
+
+Not thread safe, print() and render() must be called from the same task.
+
+customized by Armin Pressler 2022
+*/
+#ifndef LCD_VIEW_H
+#define LCD_VIEW_H
+
+#include <stdint.h>
+
+#ifndef LCD_MAX_FIELDS
+#define LCD_MAX_FIELDS 16
+#endif
+#ifndef LCD_FIELD_CHARS
+#define LCD_FIELD_CHARS 26 // 320 px / 12 px per character at text size 2
+#endif
+
+// draws the text at pixel position x, y
+typedef void (*LcdDraw)(uint16_t x, uint16_t y, const char *text);
+
+struct LcdStats
+{
+  uint32_t frames;      // render() calls that checked the fields
+  uint32_t fieldsDrawn; // fields sent to the display
+  uint32_t charsDrawn;  // characters sent to the display (incl. padding), a measure of the SPI time
+};
+
+class LcdView
+{
+public:
+  static const int16_t NO_FIELD = -1;
+
+  LcdView(uint32_t frameTime = 0);
+
+  // returns the field number, NO_FIELD if the layout is full
+  int16_t addField(uint16_t x, uint16_t y, uint8_t width);
+  void print(int16_t field, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+  // draws the changed fields, false if the frame time is not over yet
+  bool render(uint32_t now, LcdDraw draw);
+  // draw all fields with the next render() (e.g. after the screen was cleared)
+  void invalidate();
+
+  const LcdStats &stats() const { return _stats; }
+
+protected:
+  struct Field
+  {
+    uint16_t x;
+    uint16_t y;
+    uint8_t width;
+    char text[LCD_FIELD_CHARS + 1];   // what the application printed
+    char shadow[LCD_FIELD_CHARS + 1]; // what is on the screen
+  };
+
+  Field _fields[LCD_MAX_FIELDS];
+  uint16_t _numFields;
+  uint32_t _frameTime;
+  uint32_t _lastFrame;
+  bool _started;
+  LcdStats _stats;
+};
+
+#endif
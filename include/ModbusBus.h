@@ -0,0 +1,71 @@
+/*
+One RS485 bus: UART, RTU client and the part of the request table on it
+
+Every bus is polled by its own task, so a slow server with long guard times
+(e.g. the XY-MD02) on one bus doesn't take bus time from the servers on the
+other bus. The RegisterPlanner puts the requests of a bus into one block of
+the request table, the bus has its own scheduler, guard tuner and request
+lanes for this block. Their indices are local (0 .. numRequests() - 1),
+everything shared (dispatcher, metrics, circuit breaker, snapshots) uses the
+index of the whole table: request = first() + local index.
+
+customized by Armin Pressler 2022
+*/
+#ifndef MODBUS_BUS_H
+#define MODBUS_BUS_H
+
+#include <Arduino.h>
+#include "ModbusDevice.h"
+#include "PollScheduler.h"
+#include "GuardTuner.h"
+#include "RequestLanes.h"
+#include "TraceRecorder.h"
+#ifdef SIMULATED_BUS
+#include "SimulatedClient.h"
+typedef SimulatedClient BusClient;
+#else
+#include "ModbusClientRTU.h"
+typedef ModbusClientRTU BusClient;
+#endif
+
+class ModbusBus
+{
+public:
+  // requests: the whole request table, sorted by bus (RegisterPlanner)
+  ModbusBus(uint8_t number, BusClient &client, HardwareSerial &serial, int8_t rxPin, int8_t txPin,
+            const ModbusDevice *requests, uint16_t numRequests);
+
+  // starts the UART and the RTU client
+  void begin(uint32_t baudrate, uint32_t timeout, MBOnData onData, MBOnError onError, uint32_t now);
+
+  uint8_t number() const { return _number; }
+  uint16_t first() const { return _first; }
+  uint16_t numRequests() const { return _numRequests; }
+  bool owns(uint16_t request) const { return request >= _first && request < _first + _numRequests; }
+  // request (whole table) of the first read request of this server, PollScheduler::NO_DEVICE if not on this bus
+  int16_t findServer(uint8_t serverID) const;
+
+  BusClient &client;
+  PollScheduler scheduler; // local indices
+  GuardTuner tuner;        // local indices
+  RequestLanes lanes;      // alarm reads with local indices
+  volatile bool probeActive; // the bus is reserved for a probe with the short timeout
+  volatile bool busFree;     // no request on the bus: cleared when one is sent, set when its callback is done
+  TaskHandle_t task;         // polling task, woken by the responses and new lane requests
+  uint32_t lastSlot;         // [ms] time of the last request, for the output
+  TraceRecorder trace;       // capture of the traffic (GET /trace)
+  volatile bool traceStart;  // POST /trace: the bus task starts the capture between two requests
+
+protected:
+  static uint16_t firstOf(uint8_t number, const ModbusDevice *requests, uint16_t numRequests);
+  static uint16_t countOf(uint8_t number, const ModbusDevice *requests, uint16_t numRequests);
+
+  uint8_t _number;
+  HardwareSerial &_serial;
+  int8_t _rxPin;
+  int8_t _txPin;
+  uint16_t _first;
+  uint16_t _numRequests;
+};
+
+#endif
@@ -0,0 +1,53 @@
+/*
+Device descriptor table for the eModBus client
+
+Every RTU server on the bus is described by one entry of this table.
+Adding or removing a device is done by editing the table in main.cpp only,
+the poll scheduler, the response handler and the output are generic.
+
+customized by Armin Pressler 2022
+*/
+#ifndef MODBUS_DEVICE_H
+#define MODBUS_DEVICE_H
+
+#include <stdint.h>
+
+// maximum number of registers of one FC03/FC04 read request
+#define MODBUS_MAX_READ_REGISTERS 125
+
+#ifndef MODBUS_MAX_BUSES
+#define MODBUS_MAX_BUSES 2 // RS485 buses (UARTs), see ModbusBus
+#endif
+
+enum VALUE_FORMAT // how the values of a device are printed
+{
+  FORMAT_DECIMAL,        // raw register value
+  FORMAT_TENTHS,         // register value / 10.0 (e.g. XY-MD02 temperature and humidity)
+  FORMAT_UINT32,         // two registers, unsigned 32 bit
+  FORMAT_INT32,          // two registers, signed 32 bit
+  FORMAT_FLOAT32,        // two registers, IEEE 754 float
+  FORMAT_WORDSWAP = 0x80 // add to the 32 bit formats if the server sends the low word first
+};
+
+struct ModbusDevice
+{
+  const char *name;       // human readable name, only for output
+  uint8_t serverID;       // RTU server ID
+  uint8_t functionCode;   // READ_HOLD_REGISTER or READ_INPUT_REGISTER
+  uint16_t startRegister; // first register address
+  uint16_t numValues;     // number of registers to read (max MODBUS_MAX_READ_REGISTERS)
+  uint32_t guardBefore;   // [ms] bus silence needed *before* the request of this device
+  uint32_t guardAfter;    // [ms] bus silence needed *after* the request of this device
+  uint32_t pollPeriod;    // [ms] time between two requests of this device
+  uint32_t deadline;      // [ms] latest request time after the due time, 0 = poll period
+  uint8_t format;         // VALUE_FORMAT for the output
+  uint8_t bus;            // RS485 bus of the server (0 .. MODBUS_MAX_BUSES - 1), may be omitted for bus 0
+};
+
+// relative deadline of a device, the poll period if not set
+inline uint32_t deadlineOf(const ModbusDevice &dev)
+{
+  return dev.deadline != 0 ? dev.deadline : dev.pollPeriod;
+}
+
+#endif
@@ -0,0 +1,93 @@
+/*
+Table driven poll scheduler for the eModBus client
+
+The scheduler replaces the hard coded state machine. It walks the device table
+and computes the next free bus slot from the poll period of each device and the
+guard times (bus silence) before and after each request.
+Every device has its own poll period and deadline (due time + deadline), the due
+device with the earliest deadline is sent first (earliest deadline first).
+While it waits for its guard time, other devices may fill the gap as long as
+it still meets its deadline afterwards - so a device with a long guard time
+isn't starved by fast devices. A request sent after its deadline is counted
+as missed deadline.
+The scheduler has no dependency to the Arduino framework, the time is always
+given by the caller (millis()), so it can be used with any clock.
+
+      guardAfter(n-1)   guardBefore(n)
+  ---+---------------+----------------+---------------------
+     |               |                |
+  request n-1     bus free      request n (if due)
+
+customized by Armin Pressler 2022
+*/
+#ifndef POLL_SCHEDULER_H
+#define POLL_SCHEDULER_H
+
+#include <stdint.h>
+#include "ModbusDevice.h"
+
+#ifndef POLL_MAX_DEVICES
+// device table rows of *all* buses: the per device arrays of the dispatcher, metrics and
+// circuit breaker are indexed by the table row, 64 = 30+ requests on each of the two buses
+#define POLL_MAX_DEVICES 64 // can be changed with -DPOLL_MAX_DEVICES=xx
+#endif
+
+class PollScheduler
+{
+public:
+  static const int16_t NO_DEVICE = -1;
+
+  PollScheduler(const ModbusDevice *devices, uint16_t numDevices);
+
+  // all devices are due immediately, the guard times stagger the requests
+  void begin(uint32_t now);
+
+  // returns the index of the device which has to be requested now,
+  // or NO_DEVICE and the time until the next slot in waitTime
+  // (nothing changes before, so the caller may sleep that long)
+  int16_t next(uint32_t now, uint32_t &waitTime);
+
+  // must be called after the request of the device was sent to the bus
+  void issued(uint16_t index, uint32_t now);
+
+  // the bus is used by a request outside of the schedule (e.g. a control write)
+  void occupy(uint32_t now, uint32_t guardAfter);
+  // may a request to device <index> (or NO_DEVICE) be sent now?
+  bool busFree(int16_t index, uint32_t now) const { return busFreeIn(index, now) == 0; }
+  // [ms] until a request to device <index> (or NO_DEVICE) may be sent, 0 = now
+  uint32_t busFreeIn(int16_t index, uint32_t now) const;
+  // index of the first device with this server ID or NO_DEVICE
+  int16_t findServer(uint8_t serverID) const;
+
+  // the device is not polled before <time> (e.g. quarantined by the CircuitBreaker)
+  void deferUntil(uint16_t index, uint32_t time);
+
+  // guard times start with the values of the device table and can be
+  // changed at runtime (e.g. by the GuardTuner)
+  void setGuardTimes(uint16_t index, uint32_t before, uint32_t after);
+  uint32_t guardBefore(uint16_t index) const { return _guardBefore[index]; }
+  uint32_t guardAfter(uint16_t index) const { return _guardAfter[index]; }
+
+  uint16_t numDevices() const { return _numDevices; }
+  const ModbusDevice &device(uint16_t index) const { return _devices[index]; }
+  uint32_t dueAt(uint16_t index) const { return _dueAt[index]; }
+  uint32_t missedDeadlines(uint16_t index) const { return _missed[index]; }
+  uint32_t lateness(uint16_t index) const { return _lateness[index]; } // [ms] of the last request
+  uint32_t busFreeAt() const { return _busFreeAt; }
+
+protected:
+  // wrap around safe comparison of millis() values
+  static bool before(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+  static uint32_t later(uint32_t a, uint32_t b) { return before(a, b) ? b : a; }
+
+  const ModbusDevice *_devices;
+  uint16_t _numDevices;
+  uint32_t _dueAt[POLL_MAX_DEVICES];       // next time each device has to be polled
+  uint32_t _missed[POLL_MAX_DEVICES];      // requests sent after the deadline
+  uint32_t _lateness[POLL_MAX_DEVICES];    // delay of the last request after its due time
+  uint32_t _guardBefore[POLL_MAX_DEVICES]; // active guard times of each device
+  uint32_t _guardAfter[POLL_MAX_DEVICES];
+  uint32_t _busFreeAt;               // end of the guard time of the last request
+};
+
+#endif
@@ -0,0 +1,50 @@
+/*
+Bulk decoding of Modbus register payloads
+
+Modbus transfers registers big endian (high byte first). Instead of reading
+every word with ModbusMessage::get() the payload is checked once and then
+swapped into the destination buffer in one pass, two registers per 32 bit word.
+
+Registers holding 32 bit values are combined with the typed extractors,
+the word order of the server is selected with WORD_ORDER:
+  WORD_ORDER_HIGH_FIRST   register n = high word (ABCD, Modbus "standard")
+  WORD_ORDER_LOW_FIRST    register n = low word  (CDAB, many PLCs and energy meters)
+
+customized by Armin Pressler 2022
+*/
+#ifndef REGISTER_DECODE_H
+#define REGISTER_DECODE_H
+
+#include <stdint.h>
+#include <string.h>
+
+enum WORD_ORDER
+{
+  WORD_ORDER_HIGH_FIRST,
+  WORD_ORDER_LOW_FIRST
+};
+
+// decodes numValues registers from the big endian payload into values,
+// returns false (and leaves values untouched) if byteCount is too small
+bool decodeRegisters(const uint8_t *payload, uint16_t byteCount, uint16_t *values, uint16_t numValues);
+
+inline uint32_t registersToUint32(const uint16_t *regs, WORD_ORDER order = WORD_ORDER_HIGH_FIRST)
+{
+  return order == WORD_ORDER_HIGH_FIRST ? ((uint32_t)regs[0] << 16) | regs[1]
+                                        : ((uint32_t)regs[1] << 16) | regs[0];
+}
+
+inline int32_t registersToInt32(const uint16_t *regs, WORD_ORDER order = WORD_ORDER_HIGH_FIRST)
+{
+  return (int32_t)registersToUint32(regs, order);
+}
+
+inline float registersToFloat(const uint16_t *regs, WORD_ORDER order = WORD_ORDER_HIGH_FIRST)
+{
+  uint32_t raw = registersToUint32(regs, order);
+  float value;
+  memcpy(&value, &raw, sizeof(value)); // IEEE 754 single precision
+  return value;
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+Register range coalescing for the eModBus client
+
+The device table may contain several register ranges of the same server
+(e.g. 0x0000..0x0003 and 0x0008..0x000F). Every request costs the RTU
+turnaround plus the guard times of the device, so the planner merges all
+ranges of the same server ID and function code into the fewest read requests:
+
+  - ranges are merged if the gap between them is <= maxGap registers
+  - a merged request never exceeds MODBUS_MAX_READ_REGISTERS (125)
+
+The result is a table of read requests for the PollScheduler and a mapping
+of every table entry (tag) to its request and register offset, which is used
+to scatter the response into the per tag buffers.
+Guard times of a merged request are the largest, poll period and deadline
+the shortest of all merged ranges.
+Only ranges on the same bus are merged, the requests are sorted by bus, so
+every bus (ModbusBus) polls one block of the request table. Rows with a bus
+>= MODBUS_MAX_BUSES are not polled, their mapping is NO_REQUEST.
+
+customized by Armin Pressler 2022
+*/
+#ifndef REGISTER_PLANNER_H
+#define REGISTER_PLANNER_H
+
+#include <stdint.h>
+#include "ModbusDevice.h"
+#include "PollScheduler.h"
+
+struct TagMapping
+{
+  uint16_t request; // index of the read request containing this tag
+  uint16_t offset;  // register offset of the tag inside the response
+};
+
+class RegisterPlanner
+{
+public:
+  static const uint16_t NO_REQUEST = 0xFFFF; // mapping of a row which is not polled
+
+  explicit RegisterPlanner(uint16_t maxGap = 0, uint16_t maxRegisters = MODBUS_MAX_READ_REGISTERS);
+
+  // builds the read requests for numTags table entries, requests and mapping
+  // must have room for numTags entries. Returns the number of requests.
+  uint16_t plan(const ModbusDevice *tags, uint16_t numTags, ModbusDevice *requests, TagMapping *mapping) const;
+
+protected:
+  uint16_t _maxGap;
+  uint16_t _maxRegisters;
+};
+
+#endif
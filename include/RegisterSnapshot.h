@@ -0,0 +1,59 @@
+/*
+Lock free register snapshot (seqlock with two buffers)
+
+handleData() runs on the eModbus background task, the values are read from
+loop() and the web handlers. The writer must never wait for a reader and a
+reader must never see a torn block, so every device has two buffers and a
+sequence counter:
+
+  sequence even:  2m     buffer m&1 is the latest complete snapshot
+  sequence odd:   2m+1   writer fills buffer (m+1)&1, buffer m&1 is still valid
+
+A reader copies buffer (sequence/2)&1 and checks the sequence afterwards.
+The copy is only overwritten if the writer started two more snapshots in the
+meantime, so with poll periods of some 100 ms a retry practically never happens.
+Single writer, any number of readers.
+
+customized by Armin Pressler 2022
+*/
+#ifndef REGISTER_SNAPSHOT_H
+#define REGISTER_SNAPSHOT_H
+
+#include <stdint.h>
+#include <atomic>
+#include "ModbusDevice.h"
+
+struct SnapshotData
+{
+  uint32_t sequence;  // number of completed snapshots, 0 = no data yet
+  uint32_t timestamp; // millis() when the values were received
+  uint16_t numValues;
+  uint16_t values[MODBUS_MAX_READ_REGISTERS];
+};
+
+class RegisterSnapshot
+{
+public:
+  RegisterSnapshot();
+
+  // writer: get the free buffer, fill it and publish it with commit()
+  uint16_t *beginWrite();
+  void commit(uint32_t timestamp, uint16_t numValues);
+
+  // reader: returns false if no consistent copy could be made within maxRetries
+  // or if there is no data yet
+  bool read(SnapshotData &out, uint8_t maxRetries = 4) const;
+  // reader: copies only count registers starting with first, timestamp may be 0
+  bool read(uint16_t first, uint16_t count, uint16_t *values, uint32_t *timestamp, uint8_t maxRetries = 4) const;
+
+  // number of completed snapshots, can be used to detect new data without a copy
+  uint32_t sequence() const { return _sequence.load(std::memory_order_acquire) / 2; }
+
+protected:
+  std::atomic<uint32_t> _sequence;
+  uint32_t _timestamp[2];
+  uint16_t _numValues[2];
+  uint16_t _values[2][MODBUS_MAX_READ_REGISTERS];
+};
+
+#endif
@@ -0,0 +1,81 @@
+/*
+Token based response dispatch for the eModBus client
+
+The token of every request carries
+
+  bit  0..11   index of the read request
+  bit 12..13   priority class (REQUEST_PRIORITY) of the request
+  bit 14       write flag (control write of the RequestLanes, no read request)
+  bit 15       probe flag (single register read of the CircuitBreaker)
+  bit 16..31   generation counter
+
+so a response is dispatched with one array access instead of searching the server ID. The generation detects stale
+responses (an older request of the same device answered after a newer one was
+sent), the function code and the byte count are checked against the request.
+The tags (device table rows) of each request are kept in one list, so the
+response is scattered without walking the whole device table.
+The dispatch counters are kept per bus, so the response callbacks of the two
+bus tasks never increment the same counter.
+
+customized by Armin Pressler 2022
+*/
+#ifndef REQUEST_DISPATCHER_H
+#define REQUEST_DISPATCHER_H
+
+#include <stdint.h>
+#include "ModbusDevice.h"
+#include "PollScheduler.h"
+#include "RegisterPlanner.h"
+
+struct DispatchStats
+{
+  uint32_t dispatched;       // valid responses
+  uint32_t unknownToken;     // request index out of range
+  uint32_t stale;            // response to an outdated request
+  uint32_t serverMismatch;   // server ID doesn't match the request
+  uint32_t functionMismatch; // function code doesn't match the request
+  uint32_t lengthMismatch;   // byte count doesn't match the number of registers
+};
+
+class RequestDispatcher
+{
+public:
+  static const int16_t NO_REQUEST = -1;
+
+  RequestDispatcher(const ModbusDevice *requests, uint16_t numRequests, const TagMapping *mapping, uint16_t numTags);
+
+  static const uint32_t INDEX_MASK = 0x0FFF;
+  static const uint8_t PRIORITY_SHIFT = 12;
+  static const uint32_t WRITE_FLAG = 0x4000;
+  static const uint32_t PROBE_FLAG = 0x8000;
+
+  // token for the next request of <request>, outdates all older tokens of this request
+  uint32_t nextToken(uint16_t request, bool probe, uint8_t priority);
+  static bool isProbe(uint32_t token) { return (token & PROBE_FLAG) != 0; }
+  static bool isWrite(uint32_t token) { return (token & WRITE_FLAG) != 0; }
+  static uint8_t priority(uint32_t token) { return (token >> PRIORITY_SHIFT) & 0x03; }
+
+  // request index of a token or NO_REQUEST, no checks of the response
+  int16_t request(uint32_t token) const;
+
+  // checks a response of <bus> (size without CRC) against the request of the token,
+  // returns the request index or NO_REQUEST if the response has to be dropped
+  int16_t validate(uint8_t bus, uint32_t token, uint8_t serverID, uint8_t functionCode, uint8_t byteCount, uint16_t size);
+
+  // device table rows served by a request
+  uint16_t numTags(uint16_t request) const { return _firstTag[request + 1] - _firstTag[request]; }
+  const uint16_t *tags(uint16_t request) const { return &_tags[_firstTag[request]]; }
+
+  const DispatchStats &stats(uint8_t bus) const { return _stats[bus < MODBUS_MAX_BUSES ? bus : MODBUS_MAX_BUSES - 1]; }
+  DispatchStats stats() const; // all buses
+
+protected:
+  const ModbusDevice *_requests;
+  uint16_t _numRequests;
+  uint16_t _generation[POLL_MAX_DEVICES];
+  uint16_t _firstTag[POLL_MAX_DEVICES + 1]; // index into _tags for each request
+  uint16_t _tags[POLL_MAX_DEVICES];
+  DispatchStats _stats[MODBUS_MAX_BUSES];
+};
+
+#endif
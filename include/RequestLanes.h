@@ -0,0 +1,102 @@
+/*
+Priority request lanes for the eModBus client
+
+All requests share one RS485 bus and the eModbus queue is FIFO, so a setpoint
+write would wait behind several bulk reads and their guard times. Therefore
+only one request is handed to eModbus at a time and at every free bus slot the
+highest ready class is served:
+
+  PRIORITY_CONTROL   register writes of the operators
+  PRIORITY_ALARM     urgent read of a device table request (out of schedule)
+  PRIORITY_BULK      the regular polling of the PollScheduler
+
+Control and alarm requests wait in a small ring per class (single producer,
+single consumer). Wait time (submitted/due -> sent) and response latency
+(sent -> answered) are recorded for every class.
+No Arduino dependency, the time is always given by the caller.
+
+customized by Armin Pressler 2022
+*/
+#ifndef REQUEST_LANES_H
+#define REQUEST_LANES_H
+
+#include <stdint.h>
+#include <atomic>
+
+#ifndef LANE_QUEUE_SIZE
+#define LANE_QUEUE_SIZE 8 // waiting requests per class, must be a power of 2
+#endif
+#ifndef LANE_MAX_VALUES
+#define LANE_MAX_VALUES 16 // registers of one control write
+#endif
+
+enum REQUEST_PRIORITY
+{
+  PRIORITY_CONTROL,
+  PRIORITY_ALARM,
+  PRIORITY_BULK,
+  PRIORITY_CLASSES
+};
+
+struct LaneRequest
+{
+  uint8_t serverID;
+  uint16_t request; // PRIORITY_ALARM: index of the read request
+  uint16_t address; // PRIORITY_CONTROL: first register to write
+  uint16_t count;   // PRIORITY_CONTROL: number of registers to write
+  uint16_t values[LANE_MAX_VALUES];
+  uint32_t submitted;
+};
+
+struct LaneStats
+{
+  uint32_t requests;   // sent to the bus
+  uint32_t completed;  // answered
+  uint32_t failed;     // error response, timeout or dropped unsent
+  uint32_t rejected;   // lane full or invalid request
+  uint32_t waitSum;    // [ms] submitted -> sent
+  uint32_t waitMax;    // [ms]
+  uint32_t latencySum; // [ms] sent -> answered
+  uint32_t latencyMax; // [ms]
+};
+
+class RequestLanes
+{
+public:
+  RequestLanes();
+
+  // producer side
+  bool submitWrite(uint8_t serverID, uint16_t address, const uint16_t *values, uint16_t count, uint32_t now);
+  bool submitRead(uint8_t serverID, uint16_t request, uint32_t now);
+
+  // consumer side: the waiting request of the highest class or 0,
+  // priority is set to the class of the returned request
+  const LaneRequest *peek(uint8_t &priority) const;
+  void pop(uint8_t priority);
+  // removes the waiting request without sending it, counted as failed
+  void drop(uint8_t priority);
+
+  // bookkeeping of the one request on the bus (any class)
+  void sent(uint8_t priority, uint32_t waitTime, uint32_t now);
+  void completed(uint8_t priority, bool ok, uint32_t now);
+
+  const LaneStats &stats(uint8_t priority) const { return _stats[priority]; }
+  static const char *className(uint8_t priority);
+
+protected:
+  LaneRequest *reserve(uint8_t priority, uint32_t now);
+  void record(uint32_t &sum, uint32_t &max, uint32_t value);
+
+  // ring of one class: head is written by the consumer, tail by the producer
+  struct Lane
+  {
+    LaneRequest entry[LANE_QUEUE_SIZE];
+    std::atomic<uint8_t> head;
+    std::atomic<uint8_t> tail;
+  };
+  Lane _lane[PRIORITY_BULK]; // the bulk class has no ring, it is the PollScheduler
+  LaneStats _stats[PRIORITY_CLASSES];
+  uint32_t _sentAt[PRIORITY_CLASSES];
+};
+
+#endif
@@ -0,0 +1,93 @@
+/*
+Simulated RS485 bus with several RTU servers
+
+Replaces the real servers for tests of the scheduler, the guard times and the
+error handling without hardware. One request at a time is transferred, the
+time of a transfer is modelled like on the wire:
+
+  request frame + 3.5 char gap + server latency + response frame + 3.5 char gap
+
+(10 bit per character with 8N1). Faults are injected per server:
+  - timeoutRate / crcRate: random timeouts and CRC errors [1/1000]
+  - disturbTime: the server disturbs the bus for this time after its answer
+    (like the XY-MD02), every request to another server in this time
+    gets a CRC error - "one bad server disturbs the whole bus"
+Unknown server IDs time out. Every server has SIM_REGISTERS registers, reads
+see the last written values and a slow random walk of the values.
+TraceReplay replaces the model by the traffic of a recorded trace.
+
+No dependency to the Arduino framework, the time is given by the caller.
+
+customized by Armin Pressler 2022
+*/
+#ifndef SIMULATED_BUS_H
+#define SIMULATED_BUS_H
+
+#include <stdint.h>
+#include "ModbusDevice.h"
+
+#ifndef SIM_MAX_SERVERS
+#define SIM_MAX_SERVERS 16
+#endif
+#ifndef SIM_REGISTERS
+#define SIM_REGISTERS 128 // register addresses are taken modulo this size
+#endif
+
+struct SimServer
+{
+  uint8_t serverID;
+  uint32_t latency;     // [ms] from the end of the request to the start of the response
+  uint16_t timeoutRate; // [1/1000] requests without answer
+  uint16_t crcRate;     // [1/1000] answers with a CRC error
+  uint32_t disturbTime; // [ms] the bus is disturbed after the answer of this server
+};
+
+enum SIM_RESULT
+{
+  SIM_OK,
+  SIM_TIMEOUT,
+  SIM_CRC_ERROR,
+};
+
+struct SimStats
+{
+  uint32_t requests;
+  uint32_t timeouts;
+  uint32_t crcErrors;
+  uint32_t disturbed; // CRC errors caused by another server
+  uint32_t busTime;   // [ms] sum of all transfers incl. timeouts
+};
+
+class SimulatedBus
+{
+public:
+  SimulatedBus(uint32_t baudrate, const SimServer *servers, uint16_t numServers, uint32_t seed = 1);
+  virtual ~SimulatedBus() {}
+
+  // transfers one request, the response frame (without CRC) is written to response.
+  // FC03/FC04: p1 = address, p2 = count; FC06: p1 = address, p2 = value;
+  // FC16: p1 = address, p2 = count, values
+  // returns the transfer time [ms] (the timeout for SIM_TIMEOUT)
+  virtual uint32_t transfer(uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2, const uint16_t *values,
+                    uint32_t now, uint32_t timeout, uint8_t *response, uint16_t &length, SIM_RESULT &result);
+
+  // [us] wire time of a frame of <bytes> characters incl. the 3.5 character gap
+  uint32_t frameTime(uint16_t bytes) const;
+
+  const SimStats &stats() const { return _stats; }
+
+protected:
+  int16_t findServer(uint8_t serverID) const;
+  uint32_t random();
+
+  uint32_t _baudrate;
+  const SimServer *_servers;
+  uint16_t _numServers;
+  uint32_t _seed;
+  uint16_t _registers[SIM_MAX_SERVERS][SIM_REGISTERS];
+  uint8_t _disturber;       // server ID which disturbs the bus
+  uint32_t _disturbedUntil; // [ms]
+  SimStats _stats;
+};
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ModbusClientRTU replacement on top of the SimulatedBus
+
+Has the part of the ModbusClientRTU interface used by the sketch, so the whole
+firmware (scheduler, guard tuner, circuit breaker, snapshots, web server)
+runs without RS485 hardware: build with -DSIMULATED_BUS (env m5stack-simulated).
+Like eModbus, the requests are queued and a background task calls the
+onData/onError handlers, after the simulated transfer time.
+
+customized by Armin Pressler 2022
+*/
+#ifndef SIMULATED_CLIENT_H
+#define SIMULATED_CLIENT_H
+
+#include <Arduino.h>
+#include "ModbusMessage.h"
+#include "SimulatedBus.h"
+
+#ifndef SIM_QUEUE_SIZE
+#define SIM_QUEUE_SIZE 8
+#endif
+#ifndef SIM_MAX_WRITE
+#define SIM_MAX_WRITE 16 // registers of one FC16 request
+#endif
+
+class SimulatedClient
+{
+public:
+  SimulatedClient(SimulatedBus &bus);
+
+  void begin(int coreID = -1);
+  void setTimeout(uint32_t timeout) { _timeout = timeout; }
+  bool onDataHandler(MBOnData handler);
+  bool onErrorHandler(MBOnError handler);
+  uint32_t pendingRequests();
+
+  Error addRequest(uint32_t token, uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2);
+  Error addRequest(uint32_t token, uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2, uint8_t count, uint16_t *values);
+
+protected:
+  struct SimRequest
+  {
+    uint32_t token;
+    uint32_t timeout;
+    uint8_t serverID;
+    uint8_t functionCode;
+    uint16_t p1;
+    uint16_t p2;
+    uint16_t values[SIM_MAX_WRITE];
+  };
+
+  static void task(void *parameter);
+  void transfer(const SimRequest &request);
+
+  SimulatedBus &_bus;
+  QueueHandle_t _queue;
+  volatile bool _busy; // a request was taken from the queue and isn't answered yet
+  uint32_t _timeout;
+  MBOnData _onData;
+  MBOnError _onError;
+};
+
+#endif
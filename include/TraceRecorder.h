@@ -0,0 +1,119 @@
+/*
+Binary trace of the Modbus traffic of one bus
+
+Capture mode for timing problems in the field (like the XY-MD02, see the
+header comment of main.cpp): every request, response and error is stored
+with a microsecond timestamp in a compact binary trace, downloaded with
+GET /trace?bus=0 and replayed later with the TraceReplay bus.
+
+Trace layout (little endian, numbers marked * as LEB128 varint):
+  header:   "MBTR", version, bus, baudrate (4 bytes)
+  record:   type, delta time [us]* since the previous record, then
+    REQUEST:  serverID, function code, p1*, p2*, FC16: the values (2 bytes each)
+    RESPONSE: length*, response frame without CRC (server ID, FC, data)
+    ERROR:    eModbus error code
+A regular poll of a few registers takes ~10 bytes, the response 5 + 2 per register.
+
+One writer per bus: the request is written by the bus task before it is
+handed to the client, the response or error by the client callback after
+it. A bus has only one request on the wire, so the writes never overlap.
+The captured part (length()) can be read by another task at any time.
+When the buffer is full the capture stops.
+
+customized by Armin Pressler 2022
+*/
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 10
+
+enum TRACE_TYPE
+{
+  TRACE_REQUEST = 1,
+  TRACE_RESPONSE = 2,
+  TRACE_ERROR = 3,
+};
+
+struct TraceRecord
+{
+  uint8_t type;          // TRACE_TYPE
+  uint32_t time;         // [us] since the start of the capture
+  uint8_t serverID;      // REQUEST
+  uint8_t functionCode;  // REQUEST
+  uint16_t p1;           // REQUEST: address
+  uint16_t p2;           // REQUEST: count or value (FC06)
+  uint8_t error;         // ERROR: eModbus error code
+  const uint8_t *data;   // REQUEST FC16: values (big endian), RESPONSE: frame
+  uint16_t length;       // bytes of data
+};
+
+class TraceRecorder
+{
+public:
+  TraceRecorder();
+
+  // buffer for the trace, no capture without it
+  bool begin(uint8_t *buffer, size_t size);
+  // starts a new capture, the old trace is overwritten
+  bool start(uint8_t bus, uint32_t baudrate, uint32_t micros);
+  void stop() { _active = false; }
+  bool active() const { return _active; }
+
+  void request(uint32_t micros, uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2,
+               const uint16_t *values = 0);
+  void response(uint32_t micros, const uint8_t *frame, uint16_t length);
+  void error(uint32_t micros, uint8_t error);
+
+  const uint8_t *data() const { return _buffer; }
+  size_t length() const { return _length; } // complete records only
+  size_t size() const { return _size; }
+  uint32_t records() const { return _records; }
+  uint32_t dropped() const { return _dropped; } // records not stored because the buffer was full
+
+protected:
+  bool open(uint8_t type, uint32_t micros, size_t maxBytes);
+  void commit();
+  void put(uint8_t value) { _buffer[_write++] = value; }
+  void putVarint(uint32_t value);
+
+  uint8_t *_buffer;
+  size_t _size;
+  size_t _write;           // end of the record being written
+  volatile size_t _length; // end of the last complete record
+  volatile bool _active;
+  uint32_t _lastTime;
+  uint32_t _records;
+  uint32_t _dropped;
+};
+
+class TraceReader
+{
+public:
+  TraceReader(const uint8_t *data, size_t length);
+
+  bool valid() const { return _valid; } // header found
+  uint8_t bus() const { return _bus; }
+  uint32_t baudrate() const { return _baudrate; }
+
+  // next record, false at the end of the trace or for a damaged record
+  // (a copy of the reader keeps its position)
+  bool next(TraceRecord &record);
+  void rewind();
+
+protected:
+  bool getVarint(uint32_t &value);
+
+  const uint8_t *_data;
+  size_t _length;
+  size_t _read;
+  uint32_t _time;
+  bool _valid;
+  uint8_t _bus;
+  uint32_t _baudrate;
+};
+
+#endif
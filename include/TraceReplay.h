@@ -0,0 +1,44 @@
+/*
+Replay of a recorded trace (TraceRecorder) as simulated bus
+
+Answers every request with the response or error recorded for the same
+request (server ID, function code, address, count) and its recorded
+turnaround, so the scheduler, the guard tuner and handleData() see the
+traffic of the field again - with the SimulatedClient on the device
+(env m5stack-replay) or on the host with the stub client and the fake
+clock (test/test_replay), which replays faster than real time by itself.
+
+The requests are searched from the position of the last match on, the
+trace is replayed in a loop. Requests not found in the trace time out.
+
+customized by Armin Pressler 2022
+*/
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+#include "SimulatedBus.h"
+#include "TraceRecorder.h"
+
+class TraceReplay : public SimulatedBus
+{
+public:
+  explicit TraceReplay(uint32_t baudrate);
+
+  // the trace has to stay in memory, false if it is not a valid trace
+  bool begin(const uint8_t *trace, size_t length);
+
+  uint32_t transfer(uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2, const uint16_t *values,
+                    uint32_t now, uint32_t timeout, uint8_t *response, uint16_t &length, SIM_RESULT &result) override;
+
+  uint32_t replayed() const { return _replayed; } // requests answered from the trace
+  uint32_t missing() const { return _missing; }   // requests not found in the trace
+
+protected:
+  bool find(uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2, TraceRecord &request, TraceRecord &outcome);
+
+  TraceReader _reader; // position behind the last replayed request
+  uint32_t _replayed;
+  uint32_t _missing;
+};
+
+#endif
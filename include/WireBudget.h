@@ -0,0 +1,100 @@
+/*
+Wire-time budget of the RS485 buses
+
+Computes the theoretical RTU wire time of every read request and its
+response at the configured baudrate (10 bit per character, 3.5 character
+gap per frame, fixed 1750 us above 19200 baud) and compares it with the
+measured turnaround (request sent .. response or error) and the guard
+times of the device. Accumulated per report cycle:
+
+  busy     = measured turnarounds, the bus is reserved for the request
+  wire     = part of busy time the frames are really on the wire
+  overhead = busy - wire: server reaction time, eModbus and UART latency
+  guard    = bus silence reserved by the guard times of the device: guardBefore
+             and the part of guardAfter beyond the turnaround (guardAfter
+             counts from the request, see PollScheduler)
+  idle     = cycle - busy - guard: left for more devices or registers
+
+Control writes are not in the request table, they are only counted in the
+statistics of their bus (writeSent() / writeCompleted()).
+
+Three banks: the bus tasks write the running cycle, the report in loop()
+and /metrics read the finished one. endCycle() clears the third bank and
+makes it the running one, so the bank a reader is using is never cleared
+under it and no lock is needed. A transfer completing during the switch
+may still be counted in the finished cycle.
+
+customized by Armin Pressler 2022
+*/
+#ifndef WIRE_BUDGET_H
+#define WIRE_BUDGET_H
+
+#include <stdint.h>
+#include "ModbusDevice.h"
+#include "PollScheduler.h"
+
+struct BudgetStats // one request or one bus, accumulated over a report cycle
+{
+  uint32_t transfers;
+  uint32_t wireTime;   // [us] theoretical frame time of requests and responses
+  uint32_t busyTime;   // [us] measured turnaround
+  uint32_t guardTime;  // [us] guard times before and after the requests
+};
+
+class WireBudget
+{
+public:
+  WireBudget(const ModbusDevice *requests, uint16_t numRequests, uint32_t baudrate);
+
+  // [us] time of a RTU frame with <bytes> characters (incl. CRC) and the following 3.5 character gap
+  static uint32_t frameTime(uint32_t baudrate, uint16_t bytes);
+  // characters of request and response (incl. CRC) of a FC03/04/06/16 transfer with <count> registers
+  static uint16_t requestBytes(uint8_t functionCode, uint16_t count);
+  static uint16_t responseBytes(uint8_t functionCode, uint16_t count);
+  // [us] request and response of read request <request>
+  uint32_t wireTime(uint16_t request) const { return request < _numRequests ? _wireTime[request] : 0; }
+
+  void requestSent(uint16_t request, uint32_t micros);
+  // response or error, the bus was reserved until now; guard times [ms] of the device
+  void completed(uint16_t request, uint32_t micros, uint32_t guardBefore, uint32_t guardAfter);
+  // control write (FC06/16 with <count> registers) on <bus>, guard times [ms] of the server
+  void writeSent(uint8_t bus, uint8_t functionCode, uint16_t count, uint32_t guardBefore, uint32_t guardAfter,
+                 uint32_t micros);
+  void writeCompleted(uint8_t bus, uint32_t micros);
+  // finishes the running cycle, returns its length [ms]
+  uint32_t endCycle(uint32_t now);
+
+  // finished cycle
+  uint32_t cycleTime() const { return _cycleTime[finished()]; } // [ms]
+  const BudgetStats &request(uint16_t request) const { return _requestStats[finished()][request]; }
+  const BudgetStats &bus(uint8_t bus) const { return _busStats[finished()][bus]; }
+  uint32_t idleTime(uint8_t bus) const; // [ms]
+  uint16_t utilization(uint8_t bus) const; // [1/1000] busy + guard of the cycle time
+  uint32_t spareRegisters(uint8_t bus) const; // registers per second the idle time could still transfer
+
+protected:
+  static const uint8_t BANKS = 3; // running, finished, cleared for the next cycle
+
+  uint8_t finished() const { return (_bank + BANKS - 1) % BANKS; }
+  void add(BudgetStats &stats, uint32_t wireTime, uint32_t busy, uint32_t guardBefore, uint32_t guardAfter);
+
+  const ModbusDevice *_requests;
+  uint16_t _numRequests;
+  uint32_t _baudrate;
+  uint32_t _wireTime[POLL_MAX_DEVICES]; // [us] precomputed per request
+  uint32_t _sentAt[POLL_MAX_DEVICES];   // micros() of the running request
+  struct WriteTransfer                  // running control write of a bus
+  {
+    uint32_t sentAt;      // micros()
+    uint32_t wireTime;    // [us]
+    uint32_t guardBefore; // [ms]
+    uint32_t guardAfter;  // [ms]
+  } _writes[MODBUS_MAX_BUSES];
+  BudgetStats _requestStats[BANKS][POLL_MAX_DEVICES];
+  BudgetStats _busStats[BANKS][MODBUS_MAX_BUSES];
+  uint32_t _cycleTime[BANKS]; // [ms]
+  volatile uint8_t _bank;     // bank of the running cycle
+  uint32_t _cycleStart;
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*
+Asynchronous ring buffer logger
+
+The ring is a bounded queue after D. Vyukov: every entry has a sequence
+number telling whether it is free for the producer of round n or filled
+for the consumer of round n, so producers never wait for each other.
+
+customized by Armin Pressler 2022
+*/
+#include <stdio.h>
+#include <string.h>
+#include "AsyncLog.h"
+
+AsyncLog Log;
+
+AsyncLog::AsyncLog()
+    : _head(0),
+      _tail(0),
+      _dropped(0),
+      _written(0)
+{
+  for (uint32_t i = 0; i < LOG_QUEUE_SIZE; ++i)
+  {
+    _ring[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+LogEntry *AsyncLog::reserve()
+{
+  uint32_t pos = _head.load(std::memory_order_relaxed);
+  while (true)
+  {
+    LogEntry *entry = &_ring[pos & (LOG_QUEUE_SIZE - 1)];
+    int32_t diff = (int32_t)(entry->sequence.load(std::memory_order_acquire) - pos);
+    if (diff == 0)
+    {
+      // entry is free, try to claim it
+      if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        return entry;
+      }
+    }
+    else if (diff < 0)
+    {
+      _dropped.fetch_add(1, std::memory_order_relaxed); // ring full
+      return 0;
+    }
+    else
+    {
+      pos = _head.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void AsyncLog::publish(LogEntry *entry)
+{
+  uint32_t pos = entry->sequence.load(std::memory_order_relaxed);
+  entry->sequence.store(pos + 1, std::memory_order_release);
+}
+
+uint32_t AsyncLog::drain(Sink sink)
+{
+  char text[160];
+  uint32_t count = 0;
+  while (true)
+  {
+    LogEntry &entry = _ring[_tail & (LOG_QUEUE_SIZE - 1)];
+    if (entry.sequence.load(std::memory_order_acquire) != _tail + 1)
+    {
+      return count; // empty
+    }
+    size_t len = format(entry, text, sizeof(text));
+    // free the entry for the round after the next
+    entry.sequence.store(_tail + LOG_QUEUE_SIZE, std::memory_order_release);
+    _tail++;
+    sink(text, len);
+    _written++;
+    count++;
+  }
+}
+
+size_t AsyncLog::format(const LogEntry &entry, char *text, size_t size)
+{
+  // walk through the format, every conversion is printed with its own snprintf()
+  // and the argument in the type the conversion expects
+  size_t len = 0;
+  uint8_t arg = 0;
+  const char *f = entry.format;
+  text[0] = 0;
+
+  while (*f && len + 1 < size)
+  {
+    if (*f != '%')
+    {
+      text[len++] = *f++;
+      continue;
+    }
+    if (f[1] == '%')
+    {
+      text[len++] = '%';
+      f += 2;
+      continue;
+    }
+    // conversion: %[flags][width][.precision][length]type
+    char spec[16];
+    uint8_t n = 0;
+    bool isLong = false;
+    spec[n++] = *f++;
+    while (*f && strchr("-+ #0123456789.hlLzjt", *f) && n < sizeof(spec) - 2)
+    {
+      isLong |= (*f == 'l');
+      spec[n++] = *f++;
+    }
+    char type = *f ? *f++ : 0;
+    spec[n++] = type;
+    spec[n] = 0;
+
+    LogArg value;
+    value.u = 0;
+    if (arg < entry.numArgs)
+    {
+      value = entry.args[arg++];
+    }
+    int w;
+    switch (type)
+    {
+    case 'd':
+    case 'i':
+      w = isLong ? snprintf(text + len, size - len, spec, (long)value.i) : snprintf(text + len, size - len, spec, (int)value.i);
+      break;
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+    case 'c':
+      w = isLong ? snprintf(text + len, size - len, spec, (unsigned long)value.u) : snprintf(text + len, size - len, spec, (unsigned)value.u);
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+      w = snprintf(text + len, size - len, spec, value.d);
+      break;
+    case 's':
+      w = snprintf(text + len, size - len, spec, value.p ? (const char *)value.p : "(null)");
+      break;
+    case 'p':
+      w = snprintf(text + len, size - len, spec, value.p);
+      break;
+    default:
+      w = 0;
+      break;
+    }
+    if (w > 0)
+    {
+      len += (size_t)w < size - len ? (size_t)w : size - len - 1;
+    }
+  }
+  text[len] = 0;
+  return len;
+}
@@ -0,0 +1,154 @@
+/*
+Benchmarks of the polling, decode and dispatch hot paths
+
+customized by Armin Pressler 2022
+*/
+#include "Benchmark.h"
+#include "ModbusDevice.h"
+#include "PollScheduler.h"
+#include "RequestDispatcher.h"
+#include "RegisterDecode.h"
+#include "SimulatedBus.h"
+
+// synthetic device table: one request per server, fast devices with short guard times
+static void makeDevices(ModbusDevice *devices, TagMapping *mapping, uint16_t count, uint16_t numValues)
+{
+  for (uint16_t i = 0; i < count; ++i)
+  {
+    devices[i] = {"bench", (uint8_t)(1 + i % 247), 0x03, 0, numValues, 5, 5, 1000 + 10 * (uint32_t)i, 0, FORMAT_DECIMAL, 0};
+    mapping[i] = {i, 0};
+  }
+}
+
+Benchmark::Benchmark(BenchClock clock, BenchOutput output, void *context)
+    : _clock(clock),
+      _output(output),
+      _context(context),
+      _sink(0)
+{
+}
+
+void Benchmark::runAll(uint32_t baudrate)
+{
+  static const uint16_t REGISTERS[] = {1, 2, 10, 32, 64, MODBUS_MAX_READ_REGISTERS};
+  for (uint16_t r : REGISTERS)
+    decode(r, 2000);
+  // up to the size of the request table (64 on the device, hundreds in the native build)
+  static const uint16_t DEVICES[] = {1, 8, 32, 64, 128, 256, 512};
+  for (uint16_t n : DEVICES)
+    if (n <= POLL_MAX_DEVICES)
+      dispatch(n, 5000);
+  for (uint16_t n : DEVICES)
+    if (n <= POLL_MAX_DEVICES)
+      schedule(n, 5000);
+  simulatedBus(baudrate, 2000);
+}
+
+void Benchmark::report(const char *name, uint32_t param, uint32_t iterations, uint32_t start)
+{
+  uint32_t total = _clock() - start;
+  _output(_context, name, param, iterations, total, (uint32_t)((uint64_t)total * 1000 / iterations));
+}
+
+void Benchmark::decode(uint16_t numValues, uint32_t iterations)
+{
+  static uint8_t payload[2 * MODBUS_MAX_READ_REGISTERS];
+  static uint16_t values[MODBUS_MAX_READ_REGISTERS];
+  for (uint16_t i = 0; i < sizeof(payload); ++i)
+    payload[i] = i * 7;
+
+  uint32_t start = _clock();
+  for (uint32_t n = 0; n < iterations; ++n)
+  {
+    decodeRegisters(payload, 2 * numValues, values, numValues);
+    _sink += values[n % numValues];
+  }
+  report("decode", numValues, iterations, start);
+}
+
+void Benchmark::dispatch(uint16_t numRequests, uint32_t iterations)
+{
+  static ModbusDevice devices[POLL_MAX_DEVICES];
+  static TagMapping mapping[POLL_MAX_DEVICES];
+  makeDevices(devices, mapping, numRequests, 10);
+  RequestDispatcher dispatcher(devices, numRequests, mapping, numRequests);
+
+  uint32_t start = _clock();
+  for (uint32_t n = 0; n < iterations; ++n)
+  {
+    uint16_t r = n % numRequests;
+    uint32_t token = dispatcher.nextToken(r, false, 2);
+    int16_t index = dispatcher.validate(0, token, devices[r].serverID, 0x03, 20, 23);
+    const uint16_t *tags = dispatcher.tags(index);
+    for (uint16_t t = 0; t < dispatcher.numTags(index); ++t)
+      _sink += tags[t];
+  }
+  report("dispatch", numRequests, iterations, start);
+}
+
+void Benchmark::schedule(uint16_t numDevices, uint32_t iterations)
+{
+  static ModbusDevice devices[POLL_MAX_DEVICES];
+  static TagMapping mapping[POLL_MAX_DEVICES];
+  makeDevices(devices, mapping, numDevices, 10);
+  PollScheduler scheduler(devices, numDevices);
+  scheduler.begin(0);
+
+  uint32_t now = 0;
+  uint32_t start = _clock();
+  for (uint32_t n = 0; n < iterations; ++n)
+  {
+    uint32_t waitTime;
+    int16_t index = scheduler.next(now, waitTime);
+    if (index != PollScheduler::NO_DEVICE)
+      scheduler.issued(index, now);
+    now += 2; // virtual time, every decision sees a new state
+    _sink += waitTime;
+  }
+  report("schedule", numDevices, iterations, start);
+}
+
+void Benchmark::simulatedBus(uint32_t baudrate, uint32_t requests)
+{
+  static const SimServer SERVERS[] = {{1, 20, 5, 5, 0}, {2, 10, 5, 5, 0}, {3, 10, 5, 5, 0}, {4, 40, 5, 5, 0}};
+  static const uint16_t NUM = sizeof(SERVERS) / sizeof(SERVERS[0]);
+  static ModbusDevice devices[NUM];
+  static TagMapping mapping[NUM];
+  makeDevices(devices, mapping, NUM, 20);
+  for (uint16_t i = 0; i < NUM; ++i)
+    devices[i].pollPeriod = 1; // always due: the bus is the limit
+  SimulatedBus *bus = new SimulatedBus(baudrate, SERVERS, NUM); // too large for the stack of a task
+  PollScheduler scheduler(devices, NUM);
+  RequestDispatcher dispatcher(devices, NUM, mapping, NUM);
+  static uint8_t frame[3 + 2 * MODBUS_MAX_READ_REGISTERS];
+  static uint16_t values[MODBUS_MAX_READ_REGISTERS];
+
+  uint32_t now = 0;
+  scheduler.begin(now);
+  uint32_t start = _clock();
+  for (uint32_t n = 0; n < requests;)
+  {
+    uint32_t waitTime;
+    int16_t index = scheduler.next(now, waitTime);
+    if (index == PollScheduler::NO_DEVICE)
+    {
+      now += waitTime > 0 ? waitTime : 1;
+      continue;
+    }
+    const ModbusDevice &dev = devices[index];
+    uint32_t token = dispatcher.nextToken(index, false, 2);
+    scheduler.issued(index, now);
+    uint16_t length;
+    SIM_RESULT result;
+    now += bus->transfer(dev.serverID, dev.functionCode, dev.startRegister, dev.numValues, 0, now, 2000, frame, length, result);
+    if (result == SIM_OK && dispatcher.validate(0, token, frame[0], frame[1], frame[2], length) >= 0)
+    {
+      decodeRegisters(frame + 3, frame[2], values, dev.numValues);
+      _sink += values[0];
+    }
+    ++n;
+  }
+  report("sim_cycle", baudrate, requests, start);
+  delete bus;
+  _output(_context, "sim_wire", baudrate, requests, now * 1000, (uint32_t)((uint64_t)now * 1000000 / requests));
+}
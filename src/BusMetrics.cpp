@@ -0,0 +1,111 @@
+/*
+Per device metrics of the Modbus client
+
+customized by Armin Pressler 2022
+*/
+#include <string.h>
+#include "BusMetrics.h"
+
+// eModbus error codes used for the classification
+#define ERROR_TIMEOUT 0xE0
+#define ERROR_CRC 0xE2
+#define ERROR_LAST_EXCEPTION 0x0B
+
+BusMetrics::BusMetrics()
+    : _maxLoopTime(0)
+{
+  memset(_device, 0, sizeof(_device));
+  memset(_errors, 0, sizeof(_errors));
+  memset(_queueDepth, 0, sizeof(_queueDepth));
+  memset(_maxQueueDepth, 0, sizeof(_maxQueueDepth));
+}
+
+void BusMetrics::requestSent(uint16_t index, uint32_t now)
+{
+  if (index >= POLL_MAX_DEVICES)
+  {
+    return;
+  }
+  DeviceMetrics &m = _device[index];
+  m.requests++;
+  m.requestTime = now;
+  if (m.lastPoll != 0)
+  {
+    m.pollInterval = now - m.lastPoll;
+    if (m.pollInterval > m.maxPollInterval)
+    {
+      m.maxPollInterval = m.pollInterval;
+    }
+  }
+  m.lastPoll = now;
+}
+
+void BusMetrics::responseReceived(uint16_t index, uint32_t now)
+{
+  if (index >= POLL_MAX_DEVICES)
+  {
+    return;
+  }
+  DeviceMetrics &m = _device[index];
+  uint32_t latency = now - m.requestTime;
+  uint8_t bucket = 0;
+  while (bucket < LATENCY_BUCKETS - 1 && latency > LATENCY_BOUNDS[bucket])
+  {
+    bucket++;
+  }
+  m.latencyBuckets[bucket]++;
+  m.latencySum += latency;
+  m.responses++;
+}
+
+void BusMetrics::error(uint8_t bus, int16_t index, uint8_t code)
+{
+  if (bus < MODBUS_MAX_BUSES)
+  {
+    _errors[bus][code]++;
+  }
+  if (index < 0 || index >= POLL_MAX_DEVICES)
+  {
+    return;
+  }
+  DeviceMetrics &m = _device[index];
+  if (code == ERROR_TIMEOUT)
+    m.timeouts++;
+  else if (code == ERROR_CRC)
+    m.crcErrors++;
+  else if (code > 0 && code <= ERROR_LAST_EXCEPTION)
+    m.exceptions++;
+  else
+    m.otherErrors++;
+}
+
+uint32_t BusMetrics::errorCount(uint8_t code) const
+{
+  uint32_t count = 0;
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    count += _errors[b][code];
+  }
+  return count;
+}
+
+void BusMetrics::queueDepth(uint8_t bus, uint32_t depth)
+{
+  if (bus >= MODBUS_MAX_BUSES)
+  {
+    return;
+  }
+  _queueDepth[bus] = depth;
+  if (depth > _maxQueueDepth[bus])
+  {
+    _maxQueueDepth[bus] = depth;
+  }
+}
+
+void BusMetrics::loopTime(uint32_t ms)
+{
+  if (ms > _maxLoopTime)
+  {
+    _maxLoopTime = ms;
+  }
+}
@@ -0,0 +1,87 @@
+/*
+Modbus TCP gateway answered from the register snapshots
+
+customized by Armin Pressler 2022
+*/
+#include "CacheGateway.h"
+
+#define EXCEPTION_ILLEGAL_FUNCTION 0x01
+#define EXCEPTION_ILLEGAL_DATA_ADDRESS 0x02
+#define EXCEPTION_ILLEGAL_DATA_VALUE 0x03
+#define EXCEPTION_GATEWAY_TARGET_NO_RESP 0x0B
+
+CacheGateway::CacheGateway(const ModbusDevice *tags, const RegisterSnapshot *snapshots, uint16_t numTags)
+    : _tags(tags),
+      _snapshots(snapshots),
+      _numTags(numTags)
+{
+}
+
+uint8_t CacheGateway::read(uint8_t serverID, uint8_t functionCode, uint16_t address, uint16_t count, uint16_t *values, uint32_t now) const
+{
+  uint32_t next = address; // first register not copied yet
+  uint32_t end = (uint32_t)address + count;
+
+  // the rows may be in any order, so search the row containing the next register until all are copied
+  while (next < end)
+  {
+    int16_t found = -1;
+    for (uint16_t t = 0; t < _numTags; ++t)
+    {
+      const ModbusDevice &tag = _tags[t];
+      if (tag.serverID == serverID && tag.functionCode == functionCode &&
+          next >= tag.startRegister && next < (uint32_t)tag.startRegister + tag.numValues)
+      {
+        found = t;
+        break;
+      }
+    }
+    if (found < 0)
+    {
+      return EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+
+    const ModbusDevice &tag = _tags[found];
+    uint32_t tagEnd = (uint32_t)tag.startRegister + tag.numValues;
+    uint16_t n = (end < tagEnd ? end : tagEnd) - next;
+    uint32_t timestamp;
+    if (!_snapshots[found].read(next - tag.startRegister, n, values + (next - address), &timestamp) ||
+        now - timestamp > GATEWAY_STALE_PERIODS * tag.pollPeriod)
+    {
+      return EXCEPTION_GATEWAY_TARGET_NO_RESP;
+    }
+    next += n;
+  }
+  return 0;
+}
+
+uint16_t CacheGateway::respond(const uint8_t *request, uint16_t length, uint8_t *response, uint32_t now) const
+{
+  uint8_t serverID = length > 0 ? request[0] : 0;
+  uint8_t functionCode = length > 1 ? request[1] : 0;
+  uint8_t err = EXCEPTION_ILLEGAL_FUNCTION;
+  uint16_t words = 0;
+  uint16_t values[MODBUS_MAX_READ_REGISTERS];
+  if (length == 6 && (functionCode == 0x03 || functionCode == 0x04))
+  {
+    uint16_t address = request[2] << 8 | request[3];
+    words = request[4] << 8 | request[5];
+    err = words == 0 || words > MODBUS_MAX_READ_REGISTERS ? EXCEPTION_ILLEGAL_DATA_VALUE
+                                                          : read(serverID, functionCode, address, words, values, now);
+  }
+  response[0] = serverID;
+  if (err != 0)
+  {
+    response[1] = functionCode | 0x80;
+    response[2] = err;
+    return 3;
+  }
+  response[1] = functionCode;
+  response[2] = words * 2;
+  for (uint16_t i = 0; i < words; ++i)
+  {
+    response[3 + 2 * i] = values[i] >> 8;
+    response[4 + 2 * i] = values[i] & 0xFF;
+  }
+  return 3 + 2 * words;
+}
@@ -0,0 +1,118 @@
+/*
+Report by exception: change detection with deadbands
+
+customized by Armin Pressler 2022
+*/
+#include <string.h>
+#include "ChangeDetector.h"
+
+std::atomic<uint32_t> ChangeDetector::_globalSequence(0);
+
+ChangeDetector::ChangeDetector()
+    : _initialized(false),
+      _lastChange(0)
+{
+  memset(_reported, 0, sizeof(_reported));
+  memset(_deadband, 0, sizeof(_deadband));
+  for (uint16_t i = 0; i < MODBUS_MAX_READ_REGISTERS; ++i)
+  {
+    _changed[i].store(0, std::memory_order_relaxed);
+  }
+  for (uint8_t w = 0; w < DIRTY_WORDS; ++w)
+  {
+    _dirty[w].store(0, std::memory_order_relaxed);
+  }
+}
+
+void ChangeDetector::setDeadband(uint16_t deadband)
+{
+  for (uint16_t i = 0; i < MODBUS_MAX_READ_REGISTERS; ++i)
+  {
+    _deadband[i] = deadband;
+  }
+}
+
+void ChangeDetector::setDeadband(uint16_t offset, uint16_t deadband)
+{
+  if (offset < MODBUS_MAX_READ_REGISTERS)
+  {
+    _deadband[offset] = deadband;
+  }
+}
+
+uint16_t ChangeDetector::update(const uint16_t *values, uint16_t numValues)
+{
+  if (numValues > MODBUS_MAX_READ_REGISTERS)
+  {
+    numValues = MODBUS_MAX_READ_REGISTERS;
+  }
+  uint16_t changes = 0;
+  uint32_t seq = 0;
+  uint32_t dirty[DIRTY_WORDS] = {0};
+
+  for (uint16_t i = 0; i < numValues; ++i)
+  {
+    int32_t diff = (int32_t)values[i] - _reported[i];
+    if (_initialized && (diff < 0 ? -diff : diff) <= _deadband[i])
+    {
+      continue;
+    }
+    if (seq == 0)
+    {
+      // one sequence number for all changes of this update
+      seq = _globalSequence.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    _reported[i] = values[i];
+    _changed[i].store(seq, std::memory_order_relaxed);
+    dirty[i / 32] |= 1UL << (i % 32);
+    changes++;
+  }
+  _initialized = true;
+
+  if (changes > 0)
+  {
+    for (uint8_t w = 0; w < DIRTY_WORDS; ++w)
+    {
+      if (dirty[w])
+      {
+        _dirty[w].fetch_or(dirty[w], std::memory_order_relaxed);
+      }
+    }
+    _lastChange.store(seq, std::memory_order_release);
+  }
+  return changes;
+}
+
+uint16_t ChangeDetector::changedSince(uint32_t &cursor, uint16_t *offsets, uint16_t maxOffsets) const
+{
+  // registers with a sequence after 'last' belong to an update in progress,
+  // they are reported with the next call
+  uint32_t last = lastChange();
+  if ((int32_t)(last - cursor) <= 0)
+  {
+    return 0; // nothing new in this device, no need to scan the registers
+  }
+  uint16_t n = 0;
+  for (uint16_t i = 0; i < MODBUS_MAX_READ_REGISTERS; ++i)
+  {
+    uint32_t seq = _changed[i].load(std::memory_order_relaxed);
+    if ((int32_t)(seq - cursor) > 0 && (int32_t)(seq - last) <= 0)
+    {
+      if (n == maxOffsets)
+      {
+        return n; // too many changes, keep the cursor
+      }
+      offsets[n++] = i;
+    }
+  }
+  cursor = last;
+  return n;
+}
+
+void ChangeDetector::takeDirty(uint32_t bitmap[DIRTY_WORDS])
+{
+  for (uint8_t w = 0; w < DIRTY_WORDS; ++w)
+  {
+    bitmap[w] = _dirty[w].exchange(0, std::memory_order_acquire);
+  }
+}
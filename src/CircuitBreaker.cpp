@@ -0,0 +1,82 @@
+/*
+Bus health circuit breaker for the eModBus client
+
+customized by Armin Pressler 2022
+*/
+#include <string.h>
+#include "CircuitBreaker.h"
+
+CircuitBreaker::CircuitBreaker()
+{
+  memset(_state, 0, sizeof(_state));
+}
+
+void CircuitBreaker::success(uint16_t index)
+{
+  if (index >= POLL_MAX_DEVICES)
+  {
+    return;
+  }
+  BreakerState &st = _state[index];
+  st.state = BREAKER_CLOSED;
+  st.consecutiveErrors = 0;
+  st.backoff = 0;
+}
+
+bool CircuitBreaker::timeout(uint16_t index, uint32_t now)
+{
+  if (index >= POLL_MAX_DEVICES)
+  {
+    return false;
+  }
+  BreakerState &st = _state[index];
+  if (st.consecutiveErrors < 0xFFFF)
+  {
+    st.consecutiveErrors++;
+  }
+
+  switch (st.state)
+  {
+  case BREAKER_CLOSED:
+    if (st.consecutiveErrors < BREAKER_THRESHOLD)
+    {
+      return false;
+    }
+    st.backoff = BREAKER_BACKOFF_MIN;
+    st.quarantines++;
+    break;
+  case BREAKER_PROBING:
+    st.backoff = st.backoff * 2 > BREAKER_BACKOFF_MAX ? BREAKER_BACKOFF_MAX : st.backoff * 2;
+    break;
+  default: // BREAKER_OPEN: late timeout of a request sent before the quarantine
+    return true;
+  }
+  st.state = BREAKER_OPEN;
+  st.nextProbe = now + st.backoff;
+  return true;
+}
+
+void CircuitBreaker::probeSent(uint16_t index)
+{
+  if (index >= POLL_MAX_DEVICES)
+  {
+    return;
+  }
+  _state[index].state = BREAKER_PROBING;
+  _state[index].probes++;
+}
+
+const char *CircuitBreaker::stateName(uint8_t state)
+{
+  switch (state)
+  {
+  case BREAKER_CLOSED:
+    return "ok";
+  case BREAKER_OPEN:
+    return "quarantined";
+  case BREAKER_PROBING:
+    return "probing";
+  default:
+    return "?";
+  }
+}
@@ -0,0 +1,146 @@
+/*
+Adaptive guard time learning for slow RTU servers
+
+customized by Armin Pressler 2022
+*/
+#include "GuardTuner.h"
+
+GuardTuner::GuardTuner(PollScheduler &scheduler)
+    : _scheduler(scheduler)
+{
+  begin();
+}
+
+void GuardTuner::begin()
+{
+  for (uint16_t i = 0; i < POLL_MAX_DEVICES; ++i)
+  {
+    GuardState &st = _state[i];
+    st.guardBefore = i < _scheduler.numDevices() ? _scheduler.device(i).guardBefore : 0;
+    st.guardAfter = i < _scheduler.numDevices() ? _scheduler.device(i).guardAfter : 0;
+    st.floorBefore = 0;
+    st.floorAfter = 0;
+    st.requestTime = 0;
+    st.latency = 0;
+    st.maxLatency = 0;
+    st.responses = 0;
+    st.timeouts = 0;
+    st.goodInRow = 0;
+    st.relaxCount = 0;
+  }
+  _current = POLL_MAX_DEVICES;
+  _previous = POLL_MAX_DEVICES;
+}
+
+void GuardTuner::requestSent(uint16_t index, uint32_t now)
+{
+  _previous = _current;
+  _current = index;
+  if (index >= _scheduler.numDevices())
+  {
+    return;
+  }
+  _state[index].requestTime = now;
+}
+
+void GuardTuner::responseReceived(uint16_t index, uint32_t now)
+{
+  if (index >= _scheduler.numDevices())
+  {
+    return;
+  }
+  GuardState &st = _state[index];
+
+  uint32_t latency = now - st.requestTime;
+  // moving average with 1/8 weight of the new value, first value is taken directly
+  st.latency = st.responses == 0 ? latency : st.latency - st.latency / 8 + latency / 8;
+  if (latency > st.maxLatency)
+  {
+    st.maxLatency = latency;
+  }
+  st.responses++;
+
+  // relax the lower limits slowly, the device may have become better
+  if ((st.floorBefore > 0 || st.floorAfter > 0) && ++st.relaxCount >= GUARD_RELAX_AFTER)
+  {
+    st.relaxCount = 0;
+    st.floorBefore -= st.floorBefore > 0 ? st.floorBefore / 8 + 1 : 0;
+    st.floorAfter -= st.floorAfter > 0 ? st.floorAfter / 8 + 1 : 0;
+  }
+
+  if (++st.goodInRow < GUARD_DECREASE_AFTER)
+  {
+    return;
+  }
+  st.goodInRow = 0;
+  shrink(st.guardBefore, st.floorBefore);
+  shrink(st.guardAfter, st.floorAfter);
+  apply(index);
+}
+
+void GuardTuner::busError(uint16_t index)
+{
+  if (index >= _scheduler.numDevices())
+  {
+    return;
+  }
+  GuardState &st = _state[index];
+
+  st.timeouts++;
+  st.goodInRow = 0;
+  st.relaxCount = 0;
+  grow(st.guardBefore, st.floorBefore);
+  apply(index);
+
+  // the request before may have disturbed the bus (like the XY-MD02 after its answer),
+  // unknown for the first request and after requests outside the table
+  uint16_t previous = index == _current ? _previous : POLL_MAX_DEVICES;
+  if (previous < _scheduler.numDevices())
+  {
+    GuardState &prev = _state[previous];
+    prev.goodInRow = 0;
+    prev.relaxCount = 0;
+    grow(prev.guardAfter, prev.floorAfter);
+    apply(previous);
+  }
+}
+
+// doubles a guard time which caused an error and remembers it as lower limit
+void GuardTuner::grow(uint32_t &guard, uint32_t &floor)
+{
+  if (guard > floor)
+  {
+    floor = guard;
+  }
+  guard = guard < GUARD_START / 2 ? GUARD_START : guard * 2;
+  if (guard > GUARD_MAX)
+  {
+    guard = GUARD_MAX;
+  }
+}
+
+// decreases a guard time by 1/8 (at least 1 ms), keeps a margin of 1/4 above the last value which caused an error
+void GuardTuner::shrink(uint32_t &guard, uint32_t floor)
+{
+  uint32_t step = guard / 8 > 0 ? guard / 8 : 1; // below 8 ms 1/8 would be 0
+  uint32_t next = guard > step ? guard - step : 0;
+  uint32_t limit = floor + floor / 4;
+  if (next < limit)
+  {
+    next = limit;
+  }
+  if (next < GUARD_MIN)
+  {
+    next = GUARD_MIN;
+  }
+  if (next < guard)
+  {
+    guard = next;
+  }
+}
+
+void GuardTuner::apply(uint16_t index)
+{
+  const GuardState &st = _state[index];
+  _scheduler.setGuardTimes(index, st.guardBefore, st.guardAfter);
+}
@@ -0,0 +1,194 @@
+/*
+Compressed in-RAM history of one register
+
+customized by Armin Pressler 2022
+*/
+#include <string.h>
+#include "HistorySeries.h"
+
+// header fields of a block
+#define BLOCK_USED 0
+#define BLOCK_SAMPLES 1
+#define BLOCK_TIME 2
+#define BLOCK_VALUE 6
+
+HistorySeries::HistorySeries()
+    : _buffer(0),
+      _numBlocks(0),
+      _first(0),
+      _count(0),
+      _samples(0),
+      _lastTime(0),
+      _lastValue(0)
+{
+}
+
+bool HistorySeries::begin(uint8_t *buffer, size_t size)
+{
+  size_t blocks = size / HISTORY_BLOCK_SIZE;
+  if (buffer == 0 || blocks < 2)
+  {
+    _buffer = 0;
+    _numBlocks = 0;
+    return false;
+  }
+  _buffer = buffer;
+  _numBlocks = blocks > 0xFFFF ? 0xFFFF : blocks;
+  _first = 0;
+  _count = 0;
+  _samples = 0;
+  return true;
+}
+
+uint8_t HistorySeries::putVarint(uint8_t *p, uint32_t v)
+{
+  uint8_t n = 0;
+  while (v >= 0x80)
+  {
+    p[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+uint8_t HistorySeries::getVarint(const uint8_t *p, const uint8_t *end, uint32_t &v)
+{
+  v = 0;
+  uint8_t n = 0;
+  while (p + n < end && n < 5)
+  {
+    uint8_t b = p[n];
+    v |= (uint32_t)(b & 0x7F) << (7 * n);
+    n++;
+    if ((b & 0x80) == 0)
+    {
+      return n;
+    }
+  }
+  return 0; // truncated
+}
+
+void HistorySeries::startBlock(uint32_t time, uint16_t value)
+{
+  if (_count == _numBlocks)
+  {
+    // ring full: drop the oldest block
+    _samples -= block(_first)[BLOCK_SAMPLES];
+    _first = (_first + 1) % _numBlocks;
+    _count--;
+  }
+  uint8_t *b = block((_first + _count) % _numBlocks);
+  _count++;
+  b[BLOCK_USED] = HEADER_SIZE;
+  b[BLOCK_SAMPLES] = 1;
+  memcpy(b + BLOCK_TIME, &time, sizeof(time));
+  memcpy(b + BLOCK_VALUE, &value, sizeof(value));
+}
+
+void HistorySeries::append(uint32_t time, uint16_t value)
+{
+  if (_buffer == 0)
+  {
+    return;
+  }
+  _samples++;
+  if (_count > 0)
+  {
+    uint8_t *b = block((_first + _count - 1) % _numBlocks);
+    uint8_t tmp[10];
+    int32_t dv = (int32_t)value - _lastValue;
+    uint8_t n = putVarint(tmp, time - _lastTime);
+    n += putVarint(tmp + n, ((uint32_t)dv << 1) ^ (uint32_t)(dv >> 31)); // zigzag
+    if (b[BLOCK_USED] + n <= HISTORY_BLOCK_SIZE && b[BLOCK_SAMPLES] < 0xFF)
+    {
+      memcpy(b + b[BLOCK_USED], tmp, n);
+      b[BLOCK_USED] += n;
+      b[BLOCK_SAMPLES]++;
+      _lastTime = time;
+      _lastValue = value;
+      return;
+    }
+  }
+  startBlock(time, value);
+  _lastTime = time;
+  _lastValue = value;
+}
+
+uint32_t HistorySeries::query(uint32_t from, uint32_t to, HistoryVisitor visitor, void *context) const
+{
+  uint32_t visited = 0;
+  for (uint16_t i = 0; i < _count; ++i)
+  {
+    // skip blocks which end before 'from': the next block starts before 'from' too
+    if (i + 1 < _count)
+    {
+      uint32_t nextStart;
+      memcpy(&nextStart, block((_first + i + 1) % _numBlocks) + BLOCK_TIME, sizeof(nextStart));
+      if ((int32_t)(nextStart - from) < 0)
+      {
+        continue;
+      }
+    }
+
+    const uint8_t *b = block((_first + i) % _numBlocks);
+    const uint8_t *end = b + b[BLOCK_USED];
+    const uint8_t *p = b + HEADER_SIZE;
+    uint32_t time;
+    uint16_t value;
+    memcpy(&time, b + BLOCK_TIME, sizeof(time));
+    memcpy(&value, b + BLOCK_VALUE, sizeof(value));
+
+    while (true)
+    {
+      if ((int32_t)(time - to) > 0)
+      {
+        return visited; // samples are in time order
+      }
+      if ((int32_t)(time - from) >= 0)
+      {
+        visited++;
+        if (!visitor(context, time, value))
+        {
+          return visited;
+        }
+      }
+      uint32_t dt, zz;
+      uint8_t n = getVarint(p, end, dt);
+      if (n == 0)
+      {
+        break; // end of block
+      }
+      p += n;
+      n = getVarint(p, end, zz);
+      if (n == 0)
+      {
+        break;
+      }
+      p += n;
+      time += dt;
+      value += (int32_t)((zz >> 1) ^ (0 - (zz & 1)));
+    }
+  }
+  return visited;
+}
+
+size_t HistorySeries::bytesUsed() const
+{
+  size_t used = 0;
+  for (uint16_t i = 0; i < _count; ++i)
+  {
+    used += block((_first + i) % _numBlocks)[BLOCK_USED];
+  }
+  return used;
+}
+
+uint32_t HistorySeries::oldest() const
+{
+  uint32_t time = 0;
+  if (_count > 0)
+  {
+    memcpy(&time, block(_first) + BLOCK_TIME, sizeof(time));
+  }
+  return time;
+}
@@ -0,0 +1,117 @@
+/*
+One keep-alive HTTP connection of the web server task
+
+customized by Armin Pressler 2022
+*/
+#include <strings.h>
+#include "HttpConnection.h"
+
+HttpConnection::HttpConnection()
+    : _active(false),
+      _lastUse(0),
+      _inHeader(false),
+      _lengthKnown(false),
+      _closeSent(false),
+      _eventStream(false),
+      _lineLength(0)
+{
+}
+
+void HttpConnection::attach(const EthernetClient &client, uint32_t now)
+{
+  _client = client;
+  _active = true;
+  _eventStream = false;
+  _lastUse = now;
+}
+
+bool HttpConnection::serve(Application &app, const char *requestConnection, uint32_t now)
+{
+  if (!_active || _eventStream || _client.available() == 0)
+  {
+    return false;
+  }
+  _inHeader = true;
+  _lengthKnown = false;
+  _closeSent = false;
+  _lineLength = 0;
+  app.process(this);
+  _lastUse = now;
+
+  bool keepAlive = _eventStream || (_lengthKnown && !_closeSent && strcasecmp(requestConnection, "close") != 0);
+  if (!keepAlive)
+  {
+    stop();
+  }
+  return true;
+}
+
+void HttpConnection::checkIdle(uint32_t now, uint32_t timeout)
+{
+  if (_active && ((!_eventStream && now - _lastUse > timeout) || (!_client.connected() && _client.available() == 0)))
+  {
+    stop();
+  }
+}
+
+size_t HttpConnection::write(uint8_t b)
+{
+  if (_inHeader)
+  {
+    parseHeader(b);
+  }
+  return _client.write(b);
+}
+
+size_t HttpConnection::write(const uint8_t *buf, size_t size)
+{
+  for (size_t i = 0; i < size && _inHeader; ++i)
+  {
+    parseHeader(buf[i]);
+  }
+  return _client.write(buf, size);
+}
+
+void HttpConnection::stop()
+{
+  if (_active)
+  {
+    _client.stop();
+    _active = false;
+  }
+}
+
+void HttpConnection::parseHeader(char c)
+{
+  if (c == '\r')
+  {
+    return;
+  }
+  if (c != '\n')
+  {
+    if (_lineLength < sizeof(_line) - 1)
+    {
+      _line[_lineLength++] = c;
+    }
+    return;
+  }
+  _line[_lineLength] = 0;
+  if (_lineLength == 0)
+  {
+    _inHeader = false; // empty line: end of the header, the body follows
+  }
+  else if (strncasecmp(_line, "Content-Length:", 15) == 0 ||
+           strncasecmp(_line, "Transfer-Encoding: chunked", 26) == 0)
+  {
+    _lengthKnown = true;
+  }
+  else if (strncasecmp(_line, "Connection: close", 17) == 0)
+  {
+    _closeSent = true;
+  }
+  else if (strncasecmp(_line, "Content-Type: text/event-stream", 31) == 0)
+  {
+    _eventStream = true;
+  }
+  _lineLength = 0;
+}
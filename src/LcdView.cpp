@@ -0,0 +1,96 @@
+/*
+Retained mode text view for the LCD
+
+customized by Armin Pressler 2022
+*/
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "LcdView.h"
+
+LcdView::LcdView(uint32_t frameTime)
+    : _numFields(0),
+      _frameTime(frameTime),
+      _lastFrame(0),
+      _started(false),
+      _stats()
+{
+}
+
+int16_t LcdView::addField(uint16_t x, uint16_t y, uint8_t width)
+{
+  if (_numFields >= LCD_MAX_FIELDS)
+  {
+    return NO_FIELD;
+  }
+  Field &f = _fields[_numFields];
+  f.x = x;
+  f.y = y;
+  f.width = width < LCD_FIELD_CHARS ? width : LCD_FIELD_CHARS;
+  f.text[0] = 0;
+  f.shadow[0] = 0;
+  return _numFields++;
+}
+
+void LcdView::print(int16_t field, const char *format, ...)
+{
+  if (field < 0 || field >= _numFields)
+  {
+    return;
+  }
+  Field &f = _fields[field];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(f.text, f.width + 1, format, args); // longer texts are cut at the field width
+  va_end(args);
+}
+
+bool LcdView::render(uint32_t now, LcdDraw draw)
+{
+  if (_started && now - _lastFrame < _frameTime)
+  {
+    return false;
+  }
+  _started = true;
+  _lastFrame = now;
+  _stats.frames++;
+
+  for (uint16_t i = 0; i < _numFields; ++i)
+  {
+    Field &f = _fields[i];
+    if (strcmp(f.text, f.shadow) == 0)
+    {
+      continue;
+    }
+    // blank the rest of the old text
+    size_t len = strlen(f.text);
+    size_t oldLen = strlen(f.shadow);
+    char line[LCD_FIELD_CHARS + 1];
+    memcpy(line, f.text, len);
+    while (len < oldLen)
+    {
+      line[len++] = ' ';
+    }
+    line[len] = 0;
+    draw(f.x, f.y, line);
+    strcpy(f.shadow, f.text);
+    _stats.fieldsDrawn++;
+    _stats.charsDrawn += len;
+  }
+  return true;
+}
+
+void LcdView::invalidate()
+{
+  // a blank shadow of the full field width: the field is drawn and its whole area cleared
+  for (uint16_t i = 0; i < _numFields; ++i)
+  {
+    Field &f = _fields[i];
+    memset(f.shadow, ' ', f.width);
+    f.shadow[f.width] = 0;
+    if (strcmp(f.text, f.shadow) == 0)
+    {
+      f.shadow[0] = 0;
+    }
+  }
+}
@@ -0,0 +1,63 @@
+/*
+One RS485 bus: UART, RTU client and the part of the request table on it
+
+customized by Armin Pressler 2022
+*/
+#include "ModbusBus.h"
+
+ModbusBus::ModbusBus(uint8_t number, BusClient &client, HardwareSerial &serial, int8_t rxPin, int8_t txPin,
+                     const ModbusDevice *requests, uint16_t numRequests)
+    : client(client),
+      scheduler(requests + firstOf(number, requests, numRequests), countOf(number, requests, numRequests)),
+      tuner(scheduler),
+      probeActive(false),
+      busFree(true),
+      task(NULL),
+      lastSlot(0),
+      traceStart(false),
+      _number(number),
+      _serial(serial),
+      _rxPin(rxPin),
+      _txPin(txPin),
+      _first(firstOf(number, requests, numRequests)),
+      _numRequests(countOf(number, requests, numRequests))
+{
+}
+
+void ModbusBus::begin(uint32_t baudrate, uint32_t timeout, MBOnData onData, MBOnError onError, uint32_t now)
+{
+  _serial.begin(baudrate, SERIAL_8N1, _rxPin, _txPin);
+  client.onDataHandler(onData);
+  client.onErrorHandler(onError);
+  client.setTimeout(timeout);
+  client.begin();
+  scheduler.begin(now);
+  lastSlot = now;
+}
+
+int16_t ModbusBus::findServer(uint8_t serverID) const
+{
+  int16_t index = scheduler.findServer(serverID);
+  return index != PollScheduler::NO_DEVICE ? _first + index : PollScheduler::NO_DEVICE;
+}
+
+uint16_t ModbusBus::firstOf(uint8_t number, const ModbusDevice *requests, uint16_t numRequests)
+{
+  uint16_t first = 0;
+  while (first < numRequests && requests[first].bus < number)
+  {
+    first++;
+  }
+  return first;
+}
+
+uint16_t ModbusBus::countOf(uint8_t number, const ModbusDevice *requests, uint16_t numRequests)
+{
+  uint16_t first = firstOf(number, requests, numRequests);
+  uint16_t count = 0;
+  while (first + count < numRequests && requests[first + count].bus == number)
+  {
+    count++;
+  }
+  return count;
+}
@@ -0,0 +1,173 @@
+/*
+Table driven poll scheduler for the eModBus client
+
+customized by Armin Pressler 2022
+*/
+#include "PollScheduler.h"
+
+PollScheduler::PollScheduler(const ModbusDevice *devices, uint16_t numDevices)
+    : _devices(devices),
+      _numDevices(numDevices > POLL_MAX_DEVICES ? POLL_MAX_DEVICES : numDevices),
+      _busFreeAt(0)
+{
+  for (uint16_t i = 0; i < POLL_MAX_DEVICES; ++i)
+  {
+    _dueAt[i] = 0;
+    _missed[i] = 0;
+    _lateness[i] = 0;
+    _guardBefore[i] = i < _numDevices ? _devices[i].guardBefore : 0;
+    _guardAfter[i] = i < _numDevices ? _devices[i].guardAfter : 0;
+  }
+}
+
+void PollScheduler::begin(uint32_t now)
+{
+  for (uint16_t i = 0; i < _numDevices; ++i)
+  {
+    _dueAt[i] = now;
+  }
+  _busFreeAt = now;
+}
+
+int16_t PollScheduler::next(uint32_t now, uint32_t &waitTime)
+{
+  // the slot of a device is the later one of its due time and the
+  // bus free time plus its own guard time.
+
+  // 1. head: the due device with the earliest deadline (equal deadlines: table order)
+  int16_t head = NO_DEVICE;
+  uint32_t headDeadline = 0;
+  uint32_t earliestSlot = 0;
+  for (uint16_t i = 0; i < _numDevices; ++i)
+  {
+    uint32_t slot = later(_dueAt[i], _busFreeAt + _guardBefore[i]);
+    if (i == 0 || before(slot, earliestSlot))
+    {
+      earliestSlot = slot;
+    }
+    if (before(now, _dueAt[i]))
+    {
+      continue;
+    }
+    uint32_t deadline = _dueAt[i] + deadlineOf(_devices[i]);
+    if (head == NO_DEVICE || before(deadline, headDeadline))
+    {
+      head = i;
+      headDeadline = deadline;
+    }
+  }
+  if (head == NO_DEVICE)
+  {
+    waitTime = before(now, earliestSlot) ? earliestSlot - now : 0;
+    return NO_DEVICE;
+  }
+  if (!before(now, _busFreeAt + _guardBefore[head]))
+  {
+    waitTime = 0;
+    return head;
+  }
+
+  // 2. the head waits for its guard time: another device which may use the bus
+  //    now fills the gap, as long as the head still meets its deadline afterwards
+  int16_t fill = NO_DEVICE;
+  uint32_t fillDeadline = 0;
+  for (uint16_t i = 0; i < _numDevices; ++i)
+  {
+    if (before(now, _dueAt[i]) || before(now, _busFreeAt + _guardBefore[i]))
+    {
+      continue;
+    }
+    if (before(headDeadline, now + _guardAfter[i] + _guardBefore[head]))
+    {
+      continue; // would push the head behind its deadline
+    }
+    uint32_t deadline = _dueAt[i] + deadlineOf(_devices[i]);
+    if (fill == NO_DEVICE || before(deadline, fillDeadline))
+    {
+      fill = i;
+      fillDeadline = deadline;
+    }
+  }
+  if (fill != NO_DEVICE)
+  {
+    waitTime = 0;
+    return fill;
+  }
+  // wake up at the slot of the head, or earlier if another device gets ready before
+  uint32_t wake = _busFreeAt + _guardBefore[head];
+  for (uint16_t i = 0; i < _numDevices; ++i)
+  {
+    uint32_t slot = later(_dueAt[i], _busFreeAt + _guardBefore[i]);
+    if (before(now, slot) && before(slot, wake))
+    {
+      wake = slot;
+    }
+  }
+  waitTime = wake - now;
+  return NO_DEVICE;
+}
+
+void PollScheduler::issued(uint16_t index, uint32_t now)
+{
+  if (index >= _numDevices)
+  {
+    return;
+  }
+  const ModbusDevice &dev = _devices[index];
+
+  _lateness[index] = before(_dueAt[index], now) ? now - _dueAt[index] : 0;
+  if (_lateness[index] > deadlineOf(dev))
+  {
+    _missed[index]++;
+  }
+
+  // keep the phase of the device, but don't try to catch up missed periods
+  _dueAt[index] += dev.pollPeriod;
+  if (before(_dueAt[index], now))
+  {
+    _dueAt[index] = now + dev.pollPeriod;
+  }
+  _busFreeAt = now + _guardAfter[index];
+}
+
+void PollScheduler::occupy(uint32_t now, uint32_t guardAfter)
+{
+  _busFreeAt = later(_busFreeAt, now + guardAfter);
+}
+
+uint32_t PollScheduler::busFreeIn(int16_t index, uint32_t now) const
+{
+  uint32_t guard = (index >= 0 && index < _numDevices) ? _guardBefore[index] : 0;
+  return before(now, _busFreeAt + guard) ? _busFreeAt + guard - now : 0;
+}
+
+int16_t PollScheduler::findServer(uint8_t serverID) const
+{
+  for (uint16_t i = 0; i < _numDevices; ++i)
+  {
+    if (_devices[i].serverID == serverID)
+    {
+      return i;
+    }
+  }
+  return NO_DEVICE;
+}
+
+void PollScheduler::deferUntil(uint16_t index, uint32_t time)
+{
+  if (index >= _numDevices)
+  {
+    return;
+  }
+  _dueAt[index] = time;
+}
+
+void PollScheduler::setGuardTimes(uint16_t index, uint32_t before, uint32_t after)
+{
+  if (index >= _numDevices)
+  {
+    return;
+  }
+  _guardBefore[index] = before;
+  _guardAfter[index] = after;
+}
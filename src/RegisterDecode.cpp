@@ -0,0 +1,33 @@
+/*
+Bulk decoding of Modbus register payloads
+
+customized by Armin Pressler 2022
+*/
+#include "RegisterDecode.h"
+
+bool decodeRegisters(const uint8_t *payload, uint16_t byteCount, uint16_t *values, uint16_t numValues)
+{
+  if (payload == 0 || values == 0 || byteCount < (uint32_t)numValues * 2)
+  {
+    return false;
+  }
+
+  // two registers at once: swap the bytes inside both 16 bit halves.
+  // memcpy() keeps the unaligned loads/stores legal, the compiler turns it into plain word access
+  uint16_t i = 0;
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ // ESP32 and x86 hosts
+  for (; i + 1 < numValues; i += 2)
+  {
+    uint32_t word;
+    memcpy(&word, payload + i * 2, sizeof(word));
+    word = ((word & 0x00FF00FFu) << 8) | ((word >> 8) & 0x00FF00FFu);
+    memcpy(values + i, &word, sizeof(word));
+  }
+#endif
+  // odd number of registers (or big endian host)
+  for (; i < numValues; ++i)
+  {
+    values[i] = ((uint16_t)payload[i * 2] << 8) | payload[i * 2 + 1];
+  }
+  return true;
+}
@@ -0,0 +1,96 @@
+/*
+Register range coalescing for the eModBus client
+
+customized by Armin Pressler 2022
+*/
+#include "RegisterPlanner.h"
+
+RegisterPlanner::RegisterPlanner(uint16_t maxGap, uint16_t maxRegisters)
+    : _maxGap(maxGap),
+      _maxRegisters(maxRegisters > MODBUS_MAX_READ_REGISTERS ? MODBUS_MAX_READ_REGISTERS : maxRegisters)
+{
+}
+
+uint16_t RegisterPlanner::plan(const ModbusDevice *tags, uint16_t numTags, ModbusDevice *requests, TagMapping *mapping) const
+{
+  if (numTags > POLL_MAX_DEVICES)
+  {
+    numTags = POLL_MAX_DEVICES;
+  }
+  bool done[POLL_MAX_DEVICES] = {false};
+  uint16_t group[POLL_MAX_DEVICES];
+  uint16_t numRequests = 0;
+  for (uint16_t t = 0; t < numTags; ++t)
+  {
+    mapping[t] = {NO_REQUEST, 0}; // stays for rows on a bus that doesn't exist
+  }
+
+  // the requests of a bus are in one block (ModbusBus), the groups
+  // (server ID + function code) of a bus keep the order of the table
+  for (uint8_t bus = 0; bus < MODBUS_MAX_BUSES; ++bus)
+  {
+    for (uint16_t first = 0; first < numTags; ++first)
+    {
+      if (done[first] || tags[first].bus != bus)
+      {
+        continue;
+      }
+
+      // collect all tags of this group sorted by start register (insertion sort, the table is small)
+      uint16_t n = 0;
+      for (uint16_t t = first; t < numTags; ++t)
+      {
+        if (done[t] || tags[t].bus != bus || tags[t].serverID != tags[first].serverID ||
+            tags[t].functionCode != tags[first].functionCode)
+        {
+          continue;
+        }
+        done[t] = true;
+        uint16_t pos = n++;
+        while (pos > 0 && tags[group[pos - 1]].startRegister > tags[t].startRegister)
+        {
+          group[pos] = group[pos - 1];
+          pos--;
+        }
+        group[pos] = t;
+      }
+
+      // sweep over the sorted ranges and merge as long as gap and frame size allow it
+      ModbusDevice *req = 0;
+      uint32_t reqEnd = 0; // one behind the last register of the active request
+      for (uint16_t g = 0; g < n; ++g)
+      {
+        const ModbusDevice &tag = tags[group[g]];
+        uint32_t tagEnd = (uint32_t)tag.startRegister + tag.numValues;
+        uint32_t newEnd = tagEnd > reqEnd ? tagEnd : reqEnd;
+
+        bool merge = req != 0 &&
+                     tag.startRegister <= reqEnd + _maxGap &&
+                     newEnd - req->startRegister <= _maxRegisters;
+        if (merge)
+        {
+          req->numValues = newEnd - req->startRegister;
+          if (tag.guardBefore > req->guardBefore)
+            req->guardBefore = tag.guardBefore;
+          if (tag.guardAfter > req->guardAfter)
+            req->guardAfter = tag.guardAfter;
+          if (tag.pollPeriod < req->pollPeriod)
+            req->pollPeriod = tag.pollPeriod;
+          if (deadlineOf(tag) < deadlineOf(*req))
+            req->deadline = deadlineOf(tag);
+        }
+        else
+        {
+          req = &requests[numRequests++];
+          *req = tag;
+          req->deadline = deadlineOf(tag);
+          newEnd = tagEnd;
+        }
+        reqEnd = newEnd;
+        mapping[group[g]].request = numRequests - 1;
+        mapping[group[g]].offset = tag.startRegister - req->startRegister;
+      }
+    }
+  }
+  return numRequests;
+}
@@ -0,0 +1,101 @@
+/*
+Lock free register snapshot (seqlock with two buffers)
+
+customized by Armin Pressler 2022
+*/
+#include <string.h>
+#include "RegisterSnapshot.h"
+
+RegisterSnapshot::RegisterSnapshot()
+    : _sequence(0)
+{
+  memset(_timestamp, 0, sizeof(_timestamp));
+  memset(_numValues, 0, sizeof(_numValues));
+  memset(_values, 0, sizeof(_values));
+}
+
+uint16_t *RegisterSnapshot::beginWrite()
+{
+  // odd sequence: the buffer behind the latest snapshot is being written
+  uint32_t seq = _sequence.load(std::memory_order_relaxed);
+  if ((seq & 1) == 0)
+  {
+    seq++;
+    _sequence.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+  return _values[((seq / 2) + 1) & 1];
+}
+
+void RegisterSnapshot::commit(uint32_t timestamp, uint16_t numValues)
+{
+  uint32_t seq = _sequence.load(std::memory_order_relaxed);
+  if ((seq & 1) == 0)
+  {
+    return; // commit() without beginWrite()
+  }
+  uint8_t buf = ((seq / 2) + 1) & 1;
+  _timestamp[buf] = timestamp;
+  _numValues[buf] = numValues > MODBUS_MAX_READ_REGISTERS ? MODBUS_MAX_READ_REGISTERS : numValues;
+  // publish: all writes to the buffer must be visible before the new sequence
+  _sequence.store(seq + 1, std::memory_order_release);
+}
+
+bool RegisterSnapshot::read(SnapshotData &out, uint8_t maxRetries) const
+{
+  for (uint8_t retry = 0; retry <= maxRetries; ++retry)
+  {
+    uint32_t before = _sequence.load(std::memory_order_acquire);
+    uint32_t complete = before / 2; // latest complete snapshot
+    if (complete == 0)
+    {
+      return false;
+    }
+    uint8_t buf = complete & 1;
+    out.timestamp = _timestamp[buf];
+    out.numValues = _numValues[buf];
+    memcpy(out.values, _values[buf], out.numValues * sizeof(uint16_t));
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint32_t after = _sequence.load(std::memory_order_relaxed);
+    // buffer 'buf' is written again by the second next snapshot (sequence 2 * complete + 3)
+    if (after - 2 * complete < 3)
+    {
+      out.sequence = complete;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool RegisterSnapshot::read(uint16_t first, uint16_t count, uint16_t *values, uint32_t *timestamp, uint8_t maxRetries) const
+{
+  for (uint8_t retry = 0; retry <= maxRetries; ++retry)
+  {
+    uint32_t before = _sequence.load(std::memory_order_acquire);
+    uint32_t complete = before / 2;
+    if (complete == 0)
+    {
+      return false;
+    }
+    uint8_t buf = complete & 1;
+    if ((uint32_t)first + count > _numValues[buf])
+    {
+      return false;
+    }
+    uint32_t ts = _timestamp[buf];
+    memcpy(values, &_values[buf][first], count * sizeof(uint16_t));
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint32_t after = _sequence.load(std::memory_order_relaxed);
+    if (after - 2 * complete < 3)
+    {
+      if (timestamp)
+      {
+        *timestamp = ts;
+      }
+      return true;
+    }
+  }
+  return false;
+}
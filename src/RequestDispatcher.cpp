@@ -0,0 +1,102 @@
+/*
+Token based response dispatch for the eModBus client
+
+customized by Armin Pressler 2022
+*/
+#include <string.h>
+#include "RequestDispatcher.h"
+
+RequestDispatcher::RequestDispatcher(const ModbusDevice *requests, uint16_t numRequests, const TagMapping *mapping, uint16_t numTags)
+    : _requests(requests),
+      _numRequests(numRequests > POLL_MAX_DEVICES ? POLL_MAX_DEVICES : numRequests)
+{
+  memset(_generation, 0, sizeof(_generation));
+  memset(_stats, 0, sizeof(_stats));
+  if (numTags > POLL_MAX_DEVICES)
+  {
+    numTags = POLL_MAX_DEVICES;
+  }
+
+  // counting sort of the tags by request
+  uint16_t pos = 0;
+  for (uint16_t r = 0; r < _numRequests; ++r)
+  {
+    _firstTag[r] = pos;
+    for (uint16_t t = 0; t < numTags; ++t)
+    {
+      if (mapping[t].request == r)
+      {
+        _tags[pos++] = t;
+      }
+    }
+  }
+  for (uint16_t r = _numRequests; r <= POLL_MAX_DEVICES; ++r)
+  {
+    _firstTag[r] = pos;
+  }
+}
+
+uint32_t RequestDispatcher::nextToken(uint16_t request, bool probe, uint8_t priority)
+{
+  uint16_t gen = request < _numRequests ? ++_generation[request] : 0;
+  return ((uint32_t)gen << 16) | (probe ? PROBE_FLAG : 0) | ((uint32_t)(priority & 0x03) << PRIORITY_SHIFT) | (request & INDEX_MASK);
+}
+
+int16_t RequestDispatcher::request(uint32_t token) const
+{
+  uint16_t index = token & INDEX_MASK;
+  return index < _numRequests && !isWrite(token) ? index : NO_REQUEST;
+}
+
+int16_t RequestDispatcher::validate(uint8_t bus, uint32_t token, uint8_t serverID, uint8_t functionCode, uint8_t byteCount, uint16_t size)
+{
+  DispatchStats &stats = _stats[bus < MODBUS_MAX_BUSES ? bus : MODBUS_MAX_BUSES - 1];
+  int16_t index = request(token);
+  if (index == NO_REQUEST)
+  {
+    stats.unknownToken++;
+    return NO_REQUEST;
+  }
+  const ModbusDevice &req = _requests[index];
+
+  if ((uint16_t)(token >> 16) != _generation[index])
+  {
+    stats.stale++;
+    return NO_REQUEST;
+  }
+  if (serverID != req.serverID)
+  {
+    stats.serverMismatch++;
+    return NO_REQUEST;
+  }
+  if (functionCode != req.functionCode)
+  {
+    stats.functionMismatch++;
+    return NO_REQUEST;
+  }
+  // server ID, function code and byte count, then 2 bytes per register
+  uint16_t numValues = isProbe(token) ? 1 : req.numValues;
+  if (byteCount != numValues * 2 || size != 3 + numValues * 2)
+  {
+    stats.lengthMismatch++;
+    return NO_REQUEST;
+  }
+  stats.dispatched++;
+  return index;
+}
+
+DispatchStats RequestDispatcher::stats() const
+{
+  DispatchStats sum;
+  memset(&sum, 0, sizeof(sum));
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    sum.dispatched += _stats[b].dispatched;
+    sum.unknownToken += _stats[b].unknownToken;
+    sum.stale += _stats[b].stale;
+    sum.serverMismatch += _stats[b].serverMismatch;
+    sum.functionMismatch += _stats[b].functionMismatch;
+    sum.lengthMismatch += _stats[b].lengthMismatch;
+  }
+  return sum;
+}
@@ -0,0 +1,156 @@
+/*
+Priority request lanes for the eModBus client
+
+customized by Armin Pressler 2022
+*/
+#include <string.h>
+#include "RequestLanes.h"
+
+RequestLanes::RequestLanes()
+{
+  for (uint8_t p = 0; p < PRIORITY_BULK; ++p)
+  {
+    _lane[p].head.store(0);
+    _lane[p].tail.store(0);
+  }
+  memset(_stats, 0, sizeof(_stats));
+  memset(_sentAt, 0, sizeof(_sentAt));
+}
+
+LaneRequest *RequestLanes::reserve(uint8_t priority, uint32_t now)
+{
+  Lane &lane = _lane[priority];
+  uint8_t tail = lane.tail.load(std::memory_order_relaxed);
+  if ((uint8_t)(tail - lane.head.load(std::memory_order_acquire)) >= LANE_QUEUE_SIZE)
+  {
+    _stats[priority].rejected++;
+    return 0;
+  }
+  LaneRequest *req = &lane.entry[tail % LANE_QUEUE_SIZE];
+  req->submitted = now;
+  return req;
+}
+
+bool RequestLanes::submitWrite(uint8_t serverID, uint16_t address, const uint16_t *values, uint16_t count, uint32_t now)
+{
+  if (count == 0 || count > LANE_MAX_VALUES)
+  {
+    _stats[PRIORITY_CONTROL].rejected++;
+    return false;
+  }
+  LaneRequest *req = reserve(PRIORITY_CONTROL, now);
+  if (req == 0)
+  {
+    return false;
+  }
+  req->serverID = serverID;
+  req->request = 0;
+  req->address = address;
+  req->count = count;
+  memcpy(req->values, values, count * sizeof(uint16_t));
+  // publish the entry
+  _lane[PRIORITY_CONTROL].tail.fetch_add(1, std::memory_order_release);
+  return true;
+}
+
+bool RequestLanes::submitRead(uint8_t serverID, uint16_t request, uint32_t now)
+{
+  LaneRequest *req = reserve(PRIORITY_ALARM, now);
+  if (req == 0)
+  {
+    return false;
+  }
+  req->serverID = serverID;
+  req->request = request;
+  req->address = 0;
+  req->count = 0;
+  _lane[PRIORITY_ALARM].tail.fetch_add(1, std::memory_order_release);
+  return true;
+}
+
+const LaneRequest *RequestLanes::peek(uint8_t &priority) const
+{
+  for (uint8_t p = 0; p < PRIORITY_BULK; ++p)
+  {
+    const Lane &lane = _lane[p];
+    uint8_t head = lane.head.load(std::memory_order_relaxed);
+    if (head != lane.tail.load(std::memory_order_acquire))
+    {
+      priority = p;
+      return &lane.entry[head % LANE_QUEUE_SIZE];
+    }
+  }
+  priority = PRIORITY_BULK;
+  return 0;
+}
+
+void RequestLanes::pop(uint8_t priority)
+{
+  if (priority >= PRIORITY_BULK)
+  {
+    return;
+  }
+  Lane &lane = _lane[priority];
+  if (lane.head.load(std::memory_order_relaxed) != lane.tail.load(std::memory_order_acquire))
+  {
+    lane.head.fetch_add(1, std::memory_order_release);
+  }
+}
+
+void RequestLanes::drop(uint8_t priority)
+{
+  if (priority >= PRIORITY_BULK)
+  {
+    return;
+  }
+  pop(priority);
+  _stats[priority].failed++;
+}
+
+void RequestLanes::sent(uint8_t priority, uint32_t waitTime, uint32_t now)
+{
+  if (priority >= PRIORITY_CLASSES)
+  {
+    return;
+  }
+  _stats[priority].requests++;
+  record(_stats[priority].waitSum, _stats[priority].waitMax, waitTime);
+  _sentAt[priority] = now;
+}
+
+void RequestLanes::completed(uint8_t priority, bool ok, uint32_t now)
+{
+  if (priority >= PRIORITY_CLASSES)
+  {
+    return;
+  }
+  if (ok)
+    _stats[priority].completed++;
+  else
+    _stats[priority].failed++;
+  record(_stats[priority].latencySum, _stats[priority].latencyMax, now - _sentAt[priority]);
+}
+
+void RequestLanes::record(uint32_t &sum, uint32_t &max, uint32_t value)
+{
+  sum += value;
+  if (value > max)
+  {
+    max = value;
+  }
+}
+
+const char *RequestLanes::className(uint8_t priority)
+{
+  switch (priority)
+  {
+  case PRIORITY_CONTROL:
+    return "control";
+  case PRIORITY_ALARM:
+    return "alarm";
+  case PRIORITY_BULK:
+    return "bulk";
+  default:
+    return "?";
+  }
+}
@@ -0,0 +1,133 @@
+/*
+Simulated RS485 bus with several RTU servers
+
+customized by Armin Pressler 2022
+*/
+#include "SimulatedBus.h"
+#include "WireBudget.h"
+
+SimulatedBus::SimulatedBus(uint32_t baudrate, const SimServer *servers, uint16_t numServers, uint32_t seed)
+    : _baudrate(baudrate),
+      _servers(servers),
+      _numServers(numServers < SIM_MAX_SERVERS ? numServers : SIM_MAX_SERVERS),
+      _seed(seed != 0 ? seed : 1),
+      _disturber(0),
+      _disturbedUntil(0),
+      _stats()
+{
+  for (uint16_t s = 0; s < SIM_MAX_SERVERS; ++s)
+  {
+    for (uint16_t r = 0; r < SIM_REGISTERS; ++r)
+    {
+      _registers[s][r] = 200 + r * 10; // something like a temperature of 20.0 degC and more
+    }
+  }
+}
+
+uint32_t SimulatedBus::frameTime(uint16_t bytes) const
+{
+  return WireBudget::frameTime(_baudrate, bytes);
+}
+
+uint32_t SimulatedBus::transfer(uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2, const uint16_t *values,
+                                uint32_t now, uint32_t timeout, uint8_t *response, uint16_t &length, SIM_RESULT &result)
+{
+  _stats.requests++;
+  int16_t s = findServer(serverID);
+  uint16_t requestBytes = WireBudget::requestBytes(functionCode, p2);
+
+  length = 0;
+  response[length++] = serverID;
+  bool isRead = functionCode == 0x03 || functionCode == 0x04;
+  uint16_t maxCount = functionCode == 0x10 ? 123 : MODBUS_MAX_READ_REGISTERS;
+  if ((isRead || functionCode == 0x10) && (p2 == 0 || p2 > maxCount))
+  {
+    response[length++] = functionCode | 0x80;
+    response[length++] = 0x03; // ILLEGAL_DATA_VALUE
+  }
+  else if (isRead)
+  {
+    response[length++] = functionCode;
+    response[length++] = 2 * p2;
+    for (uint16_t i = 0; i < p2 && s >= 0; ++i)
+    {
+      uint16_t &reg = _registers[s][(p1 + i) % SIM_REGISTERS];
+      uint32_t r = random();
+      if ((r & 7) == 0)
+      {
+        reg += (r & 8) ? 1 : -1; // slow random walk of the process values
+      }
+      response[length++] = reg >> 8;
+      response[length++] = reg & 0xFF;
+    }
+  }
+  else if (functionCode == 0x06 || functionCode == 0x10)
+  {
+    for (uint16_t i = 0; s >= 0 && i < (functionCode == 0x06 ? 1 : p2); ++i)
+    {
+      _registers[s][(p1 + i) % SIM_REGISTERS] = functionCode == 0x06 ? p2 : values[i];
+    }
+    response[length++] = functionCode;
+    response[length++] = p1 >> 8;
+    response[length++] = p1 & 0xFF;
+    response[length++] = p2 >> 8;
+    response[length++] = p2 & 0xFF;
+  }
+  else
+  {
+    response[length++] = functionCode | 0x80;
+    response[length++] = 0x01; // ILLEGAL_FUNCTION
+  }
+
+  uint32_t wireTime = (frameTime(requestBytes) + frameTime(length + 2) + 999) / 1000; // + 2 bytes CRC
+  if (s < 0 || random() % 1000 < _servers[s].timeoutRate)
+  {
+    result = SIM_TIMEOUT;
+    _stats.timeouts++;
+    _stats.busTime += timeout;
+    return timeout;
+  }
+  uint32_t time = wireTime + _servers[s].latency;
+  _stats.busTime += time;
+  result = SIM_OK;
+  if (_disturber != serverID && (int32_t)(now - _disturbedUntil) < 0)
+  {
+    result = SIM_CRC_ERROR;
+    _stats.disturbed++;
+  }
+  else if (random() % 1000 < _servers[s].crcRate)
+  {
+    result = SIM_CRC_ERROR;
+  }
+  if (result == SIM_CRC_ERROR)
+  {
+    _stats.crcErrors++;
+  }
+  if (_servers[s].disturbTime > 0)
+  {
+    _disturber = serverID;
+    _disturbedUntil = now + time + _servers[s].disturbTime;
+  }
+  return time;
+}
+
+int16_t SimulatedBus::findServer(uint8_t serverID) const
+{
+  for (uint16_t s = 0; s < _numServers; ++s)
+  {
+    if (_servers[s].serverID == serverID)
+    {
+      return s;
+    }
+  }
+  return -1;
+}
+
+uint32_t SimulatedBus::random()
+{
+  // xorshift32, the same seed gives the same faults
+  _seed ^= _seed << 13;
+  _seed ^= _seed >> 17;
+  _seed ^= _seed << 5;
+  return _seed;
+}
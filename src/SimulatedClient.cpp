@@ -0,0 +1,115 @@
+/*
+ModbusClientRTU replacement on top of the SimulatedBus
+
+customized by Armin Pressler 2022
+*/
+#include "SimulatedClient.h"
+
+SimulatedClient::SimulatedClient(SimulatedBus &bus)
+    : _bus(bus),
+      _queue(NULL),
+      _busy(false),
+      _timeout(2000),
+      _onData(NULL),
+      _onError(NULL)
+{
+}
+
+void SimulatedClient::begin(int coreID)
+{
+  _queue = xQueueCreate(SIM_QUEUE_SIZE, sizeof(SimRequest));
+  xTaskCreatePinnedToCore(&task, "SimBus", 4096, this, 5, NULL, coreID >= 0 ? coreID : tskNO_AFFINITY);
+}
+
+bool SimulatedClient::onDataHandler(MBOnData handler)
+{
+  _onData = handler;
+  return true;
+}
+
+bool SimulatedClient::onErrorHandler(MBOnError handler)
+{
+  _onError = handler;
+  return true;
+}
+
+uint32_t SimulatedClient::pendingRequests()
+{
+  return (_queue ? uxQueueMessagesWaiting(_queue) : 0) + (_busy ? 1 : 0);
+}
+
+Error SimulatedClient::addRequest(uint32_t token, uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2)
+{
+  return addRequest(token, serverID, functionCode, p1, p2, 0, NULL);
+}
+
+Error SimulatedClient::addRequest(uint32_t token, uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2,
+                                  uint8_t count, uint16_t *values)
+{
+  if (serverID == 0 || serverID > 247)
+  {
+    return INVALID_SERVER;
+  }
+  if (functionCode == WRITE_MULT_REGISTERS && (values == NULL || p2 > SIM_MAX_WRITE || count != p2 * 2))
+  {
+    return PARAMETER_LIMIT_ERROR;
+  }
+  SimRequest request;
+  request.token = token;
+  request.timeout = _timeout; // like eModbus: the timeout when the request was added
+  request.serverID = serverID;
+  request.functionCode = functionCode;
+  request.p1 = p1;
+  request.p2 = p2;
+  for (uint16_t i = 0; functionCode == WRITE_MULT_REGISTERS && i < p2; ++i)
+  {
+    request.values[i] = values[i];
+  }
+  if (_queue == NULL || xQueueSend(_queue, &request, 0) != pdTRUE)
+  {
+    return REQUEST_QUEUE_FULL;
+  }
+  return SUCCESS;
+}
+
+void SimulatedClient::task(void *parameter)
+{
+  SimulatedClient *client = (SimulatedClient *)parameter;
+  SimRequest request;
+  while (true)
+  {
+    if (xQueueReceive(client->_queue, &request, portMAX_DELAY) == pdTRUE)
+    {
+      client->_busy = true;
+      client->transfer(request);
+      client->_busy = false;
+    }
+  }
+}
+
+void SimulatedClient::transfer(const SimRequest &request)
+{
+  uint8_t frame[3 + 2 * MODBUS_MAX_READ_REGISTERS];
+  uint16_t length;
+  SIM_RESULT result;
+  uint32_t time = _bus.transfer(request.serverID, request.functionCode, request.p1, request.p2, request.values,
+                                millis(), request.timeout, frame, length, result);
+  vTaskDelay(pdMS_TO_TICKS(time)); // the bus is busy for this time
+
+  if (result == SIM_TIMEOUT || result == SIM_CRC_ERROR)
+  {
+    if (_onError)
+      _onError(result == SIM_TIMEOUT ? TIMEOUT : CRC_ERROR, request.token);
+    return;
+  }
+  if (frame[1] & 0x80)
+  {
+    if (_onError)
+      _onError((Error)frame[2], request.token); // exception response
+    return;
+  }
+  ModbusMessage response;
+  response.add(frame, length);
+  if (_onData)
+    _onData(response, request.token);
+}
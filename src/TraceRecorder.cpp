@@ -0,0 +1,250 @@
+/*
+Binary trace of the Modbus traffic of one bus
+
+customized by Armin Pressler 2022
+*/
+#include "TraceRecorder.h"
+
+static const uint8_t TRACE_MAGIC[4] = {'M', 'B', 'T', 'R'};
+static const size_t MAX_VARINT = 5;                 // bytes of a 32 bit varint
+static const size_t RECORD_OVERHEAD = 1 + MAX_VARINT; // type and delta time
+
+TraceRecorder::TraceRecorder()
+    : _buffer(0),
+      _size(0),
+      _write(0),
+      _length(0),
+      _active(false),
+      _lastTime(0),
+      _records(0),
+      _dropped(0)
+{
+}
+
+bool TraceRecorder::begin(uint8_t *buffer, size_t size)
+{
+  _active = false;
+  _buffer = buffer;
+  _size = buffer != 0 ? size : 0;
+  _write = 0;
+  _length = 0;
+  return _size >= TRACE_HEADER_SIZE;
+}
+
+bool TraceRecorder::start(uint8_t bus, uint32_t baudrate, uint32_t micros)
+{
+  _active = false;
+  if (_size < TRACE_HEADER_SIZE)
+  {
+    return false;
+  }
+  _length = 0;
+  _write = 0;
+  for (uint8_t i = 0; i < 4; ++i)
+  {
+    put(TRACE_MAGIC[i]);
+  }
+  put(TRACE_VERSION);
+  put(bus);
+  for (uint8_t i = 0; i < 4; ++i)
+  {
+    put(baudrate >> (8 * i));
+  }
+  _lastTime = micros;
+  _records = 0;
+  _dropped = 0;
+  _length = _write;
+  _active = true;
+  return true;
+}
+
+void TraceRecorder::request(uint32_t micros, uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2,
+                            const uint16_t *values)
+{
+  uint16_t numValues = functionCode == 0x10 ? p2 : 0; // the reader expects them for every FC16
+  if (!open(TRACE_REQUEST, micros, 2 + 2 * MAX_VARINT + 2 * numValues))
+  {
+    return;
+  }
+  put(serverID);
+  put(functionCode);
+  putVarint(p1);
+  putVarint(p2);
+  for (uint16_t i = 0; i < numValues; ++i)
+  {
+    uint16_t v = values != 0 ? values[i] : 0;
+    put(v >> 8);
+    put(v & 0xFF);
+  }
+  commit();
+}
+
+void TraceRecorder::response(uint32_t micros, const uint8_t *frame, uint16_t length)
+{
+  if (!open(TRACE_RESPONSE, micros, MAX_VARINT + length))
+  {
+    return;
+  }
+  putVarint(length);
+  for (uint16_t i = 0; i < length; ++i)
+  {
+    put(frame[i]);
+  }
+  commit();
+}
+
+void TraceRecorder::error(uint32_t micros, uint8_t error)
+{
+  if (!open(TRACE_ERROR, micros, 1))
+  {
+    return;
+  }
+  put(error);
+  commit();
+}
+
+// writes type and time of a new record if the buffer has room for it
+bool TraceRecorder::open(uint8_t type, uint32_t micros, size_t maxBytes)
+{
+  if (!_active)
+  {
+    return false;
+  }
+  if (_write + RECORD_OVERHEAD + maxBytes > _size)
+  {
+    _dropped++;
+    _active = false; // full: the trace ends with the last complete record
+    return false;
+  }
+  put(type);
+  putVarint(micros - _lastTime);
+  _lastTime = micros;
+  return true;
+}
+
+void TraceRecorder::commit()
+{
+  _records++;
+  _length = _write; // readers see the record only now
+}
+
+void TraceRecorder::putVarint(uint32_t value)
+{
+  while (value >= 0x80)
+  {
+    put((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  put(value);
+}
+
+TraceReader::TraceReader(const uint8_t *data, size_t length)
+    : _data(data),
+      _length(length),
+      _read(0),
+      _time(0),
+      _valid(false),
+      _bus(0),
+      _baudrate(0)
+{
+  if (data == 0 || length < TRACE_HEADER_SIZE || data[4] != TRACE_VERSION)
+  {
+    return;
+  }
+  for (uint8_t i = 0; i < 4; ++i)
+  {
+    if (data[i] != TRACE_MAGIC[i])
+    {
+      return;
+    }
+  }
+  _bus = data[5];
+  for (uint8_t i = 0; i < 4; ++i)
+  {
+    _baudrate |= (uint32_t)data[6 + i] << (8 * i);
+  }
+  _valid = true;
+  rewind();
+}
+
+void TraceReader::rewind()
+{
+  _read = _valid ? TRACE_HEADER_SIZE : _length;
+  _time = 0;
+}
+
+bool TraceReader::next(TraceRecord &record)
+{
+  uint32_t delta, value;
+  if (_read >= _length)
+  {
+    return false;
+  }
+  record.type = _data[_read++];
+  if (!getVarint(delta))
+  {
+    return false;
+  }
+  _time += delta;
+  record.time = _time;
+  record.data = 0;
+  record.length = 0;
+
+  switch (record.type)
+  {
+  case TRACE_REQUEST:
+    if (_read + 2 > _length)
+      return false;
+    record.serverID = _data[_read++];
+    record.functionCode = _data[_read++];
+    if (!getVarint(value))
+      return false;
+    record.p1 = value;
+    if (!getVarint(value))
+      return false;
+    record.p2 = value;
+    if (record.functionCode == 0x10)
+    {
+      record.data = _data + _read;
+      record.length = 2 * record.p2;
+    }
+    break;
+  case TRACE_RESPONSE:
+    if (!getVarint(value))
+      return false;
+    record.data = _data + _read;
+    record.length = value;
+    break;
+  case TRACE_ERROR:
+    if (_read + 1 > _length)
+      return false;
+    record.error = _data[_read++];
+    break;
+  default:
+    _read = _length; // damaged trace
+    return false;
+  }
+  if (_read + record.length > _length)
+  {
+    _read = _length;
+    return false;
+  }
+  _read += record.length;
+  return true;
+}
+
+bool TraceReader::getVarint(uint32_t &value)
+{
+  value = 0;
+  for (uint8_t shift = 0; shift < 35 && _read < _length; shift += 7)
+  {
+    uint8_t b = _data[_read++];
+    value |= (uint32_t)(b & 0x7F) << shift;
+    if ((b & 0x80) == 0)
+    {
+      return true;
+    }
+  }
+  _read = _length;
+  return false;
+}
@@ -0,0 +1,100 @@
+/*
+Replay of a recorded trace (TraceRecorder) as simulated bus
+
+customized by Armin Pressler 2022
+*/
+#include "TraceReplay.h"
+
+// eModbus error codes in the trace
+#define ERROR_TIMEOUT 0xE0
+#define ERROR_CRC 0xE2
+#define MAX_EXCEPTION 0x0B // Modbus exception codes of the server
+
+TraceReplay::TraceReplay(uint32_t baudrate)
+    : SimulatedBus(baudrate, 0, 0),
+      _reader(0, 0),
+      _replayed(0),
+      _missing(0)
+{
+}
+
+bool TraceReplay::begin(const uint8_t *trace, size_t length)
+{
+  _reader = TraceReader(trace, length);
+  return _reader.valid();
+}
+
+// the written values and the time don't matter, the recorded outcome is replayed
+uint32_t TraceReplay::transfer(uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2, const uint16_t *,
+                               uint32_t, uint32_t timeout, uint8_t *response, uint16_t &length, SIM_RESULT &result)
+{
+  _stats.requests++;
+  length = 0;
+  TraceRecord request, outcome;
+  if (!find(serverID, functionCode, p1, p2, request, outcome))
+  {
+    _missing++;
+    _stats.timeouts++;
+    _stats.busTime += timeout;
+    result = SIM_TIMEOUT;
+    return timeout;
+  }
+  _replayed++;
+  uint32_t time = (outcome.time - request.time + 500) / 1000; // recorded turnaround [ms]
+  _stats.busTime += time;
+  result = SIM_OK;
+
+  if (outcome.type == TRACE_RESPONSE)
+  {
+    for (uint16_t i = 0; i < outcome.length && i < 3 + 2 * MODBUS_MAX_READ_REGISTERS; ++i)
+    {
+      response[length++] = outcome.data[i];
+    }
+  }
+  else if (outcome.error > 0 && outcome.error <= MAX_EXCEPTION)
+  {
+    response[length++] = serverID;
+    response[length++] = functionCode | 0x80;
+    response[length++] = outcome.error;
+  }
+  else if (outcome.error == ERROR_CRC)
+  {
+    result = SIM_CRC_ERROR;
+    _stats.crcErrors++;
+  }
+  else
+  {
+    result = SIM_TIMEOUT; // timeouts and all other client errors
+    _stats.timeouts++;
+  }
+  return time;
+}
+
+// the next recorded request with this server, function and address and its response or error
+bool TraceReplay::find(uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2, TraceRecord &request, TraceRecord &outcome)
+{
+  for (uint8_t pass = 0; pass < 2; ++pass)
+  {
+    TraceReader reader = _reader;
+    if (pass == 1)
+    {
+      reader.rewind(); // not found behind the last match: the trace is replayed in a loop
+    }
+    while (reader.next(request))
+    {
+      bool match = request.type == TRACE_REQUEST && request.serverID == serverID && request.functionCode == functionCode &&
+                   request.p1 == p1 && (functionCode == 0x06 || request.p2 == p2); // FC06: p2 is the written value
+      if (!match)
+      {
+        continue;
+      }
+      TraceReader next = reader;
+      if (next.next(outcome) && outcome.type != TRACE_REQUEST)
+      {
+        _reader = next;
+        return true;
+      }
+    }
+  }
+  return false;
+}
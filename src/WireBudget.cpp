@@ -0,0 +1,142 @@
+/*
+Wire-time budget of the RS485 buses
+
+customized by Armin Pressler 2022
+*/
+#include "WireBudget.h"
+#include <string.h>
+
+WireBudget::WireBudget(const ModbusDevice *requests, uint16_t numRequests, uint32_t baudrate)
+    : _requests(requests),
+      _numRequests(numRequests < POLL_MAX_DEVICES ? numRequests : POLL_MAX_DEVICES),
+      _baudrate(baudrate),
+      _bank(0),
+      _cycleStart(0)
+{
+  memset(_sentAt, 0, sizeof(_sentAt));
+  memset(_writes, 0, sizeof(_writes));
+  memset(_requestStats, 0, sizeof(_requestStats));
+  memset(_busStats, 0, sizeof(_busStats));
+  memset(_cycleTime, 0, sizeof(_cycleTime));
+  for (uint16_t i = 0; i < _numRequests; ++i)
+  {
+    const ModbusDevice &req = _requests[i];
+    _wireTime[i] = frameTime(_baudrate, requestBytes(req.functionCode, req.numValues)) +
+                   frameTime(_baudrate, responseBytes(req.functionCode, req.numValues));
+  }
+}
+
+uint32_t WireBudget::frameTime(uint32_t baudrate, uint16_t bytes)
+{
+  // 10 bit per character (8N1), above 19200 baud the gap is fixed to 1750 us
+  uint32_t character = 10UL * 1000000UL / baudrate;
+  uint32_t gap = baudrate > 19200 ? 1750 : character * 7 / 2;
+  return bytes * character + gap;
+}
+
+uint16_t WireBudget::requestBytes(uint8_t functionCode, uint16_t count)
+{
+  // ID, FC, address, count/value, CRC - FC16 adds byte count and the values
+  return functionCode == 0x10 ? 9 + 2 * count : 8;
+}
+
+uint16_t WireBudget::responseBytes(uint8_t functionCode, uint16_t count)
+{
+  // FC03/04: ID, FC, byte count, values, CRC - FC06/16 echo address and count/value
+  return functionCode == 0x03 || functionCode == 0x04 ? 5 + 2 * count : 8;
+}
+
+void WireBudget::requestSent(uint16_t request, uint32_t micros)
+{
+  if (request < _numRequests)
+  {
+    _sentAt[request] = micros;
+  }
+}
+
+void WireBudget::completed(uint16_t request, uint32_t micros, uint32_t guardBefore, uint32_t guardAfter)
+{
+  if (request >= _numRequests || _requests[request].bus >= MODBUS_MAX_BUSES)
+  {
+    return;
+  }
+  uint8_t bank = _bank;
+  uint32_t busy = micros - _sentAt[request];
+  add(_requestStats[bank][request], _wireTime[request], busy, guardBefore, guardAfter);
+  add(_busStats[bank][_requests[request].bus], _wireTime[request], busy, guardBefore, guardAfter);
+}
+
+void WireBudget::writeSent(uint8_t bus, uint8_t functionCode, uint16_t count, uint32_t guardBefore, uint32_t guardAfter,
+                           uint32_t micros)
+{
+  if (bus >= MODBUS_MAX_BUSES)
+  {
+    return;
+  }
+  WriteTransfer &w = _writes[bus];
+  w.sentAt = micros;
+  w.wireTime = frameTime(_baudrate, requestBytes(functionCode, count)) + frameTime(_baudrate, responseBytes(functionCode, count));
+  w.guardBefore = guardBefore;
+  w.guardAfter = guardAfter;
+}
+
+void WireBudget::writeCompleted(uint8_t bus, uint32_t micros)
+{
+  if (bus >= MODBUS_MAX_BUSES)
+  {
+    return;
+  }
+  const WriteTransfer &w = _writes[bus];
+  add(_busStats[_bank][bus], w.wireTime, micros - w.sentAt, w.guardBefore, w.guardAfter);
+}
+
+void WireBudget::add(BudgetStats &stats, uint32_t wireTime, uint32_t busy, uint32_t guardBefore, uint32_t guardAfter)
+{
+  // guardAfter starts with the request, only the silence after the response is extra bus time
+  uint32_t after = guardAfter * 1000 > busy ? guardAfter * 1000 - busy : 0;
+  stats.transfers++;
+  stats.wireTime += wireTime;
+  stats.busyTime += busy;
+  stats.guardTime += guardBefore * 1000 + after;
+}
+
+uint32_t WireBudget::endCycle(uint32_t now)
+{
+  uint8_t next = (_bank + 1) % BANKS; // finished before the last cycle, nobody reads it any more
+  memset(_requestStats[next], 0, sizeof(_requestStats[next]));
+  memset(_busStats[next], 0, sizeof(_busStats[next]));
+  _cycleTime[_bank] = now - _cycleStart;
+  _cycleStart = now;
+  _bank = next;
+  return cycleTime();
+}
+
+uint32_t WireBudget::idleTime(uint8_t bus) const
+{
+  const BudgetStats &b = this->bus(bus);
+  uint32_t used = (b.busyTime + b.guardTime) / 1000;
+  return used < cycleTime() ? cycleTime() - used : 0;
+}
+
+uint16_t WireBudget::utilization(uint8_t bus) const
+{
+  uint32_t cycle = cycleTime();
+  if (cycle == 0)
+  {
+    return 0;
+  }
+  const BudgetStats &b = this->bus(bus);
+  uint64_t used = ((uint64_t)b.busyTime + b.guardTime) / cycle; // [us/ms] = 1/1000
+  return used < 1000 ? used : 1000;
+}
+
+uint32_t WireBudget::spareRegisters(uint8_t bus) const
+{
+  uint32_t cycle = cycleTime();
+  if (cycle == 0)
+  {
+    return 0;
+  }
+  uint32_t registerTime = 2 * 10UL * 1000000UL / _baudrate; // [us] 2 characters per register
+  return (uint64_t)idleTime(bus) * 1000 * 1000 / registerTime / cycle;
+}
@@ -98,102 +98,273 @@ Application app;
 //        https://community.platformio.org/t/project-build-fails-after-latest-updates/8731/2
 #undef max // chrono:225:6: error: macro "max" requires 2 arguments, but only 1 given
 #undef min // chrono:225:6: error: macro "min" requires 2 arguments, but only 1 given
+#include <atomic>
 
 // Include the header for the ModbusClient RTU style
 #include "ModbusClientRTU.h"
+// Modbus TCP server on the W5500, answered from the cached values
+#include "ModbusServerEthernet.h"
 
 #define LOG_TERM_NOCOLOR // coloring terminal output doesn't work with ArduinoIDE and PlatformIO
 #include "Logging.h"
 
-const uint32_t STATE_MACHINE_INTERVAL = 5000; // must be equal or larger than the sum of all delays!
+#include "ModbusDevice.h"
+#include "PollScheduler.h"
+#include "GuardTuner.h"
+#include "RegisterPlanner.h"
+#include "RegisterSnapshot.h"
+#include "RequestDispatcher.h"
+#include "RegisterDecode.h"
+#include "BusMetrics.h"
+#include "CacheGateway.h"
+#include "CircuitBreaker.h"
+#include "RequestLanes.h"
+#include "ChangeDetector.h"
+#include "HistorySeries.h"
+#include "AsyncLog.h"
+#include "LcdView.h"
+#include "HttpConnection.h"
+#include "Benchmark.h"
+#include "ModbusBus.h"
+#include "WireBudget.h"
+#ifdef REPLAY_BUS
+#include "TraceReplay.h"
+#include <SD.h>
+#endif
 
-const uint32_t DELAY_AFTER_STATE_1 = 50;   // Arduino Nano and 5V RS485 Shield
-const uint32_t DELAY_AFTER_STATE_2 = 1000; // M5Atom with RS485 Module
-const uint32_t DELAY_AFTER_STATE_3 = 1000; // XY-MD02 cheap chinese temperature sensor
-const uint32_t DELAY_AFTER_STATE_4 = 1000; // XY-MD02 cheap chinese temperature sensor
-const uint32_t DELAY_AFTER_STATE_5 = 50;   // M5Atom with RS485 Module
-const uint32_t DELAY_AFTER_STATE_6 = 50;   // M5Atom with RS485 Module
+#define BAUDRATE 9600
+
+const uint32_t REPORT_INTERVAL = 5000; // print all values every x ms
+const uint32_t MB_TIMEOUT = 2500;   // [ms] response timeout of the RTU requests
+const uint32_t PROBE_TIMEOUT = 300; // [ms] response timeout of the probe of a quarantined device
+const uint32_t WRITE_GUARD_AFTER = 50; // [ms] guard time after a write to a server not in the device table
+const uint16_t MODBUS_TCP_PORT = 502;
+const uint8_t MODBUS_TCP_CLIENTS = 4;          // concurrent Modbus TCP clients (the W5500 has 8 sockets)
+const uint32_t MODBUS_TCP_IDLE_TIMEOUT = 20000; // [ms] idle TCP connections are closed
+const uint8_t HTTP_CLIENTS = 2;           // keep-alive connections of the web server (W5500: 8 sockets in total)
+const uint32_t HTTP_IDLE_TIMEOUT = 5000;  // [ms] idle keep-alive connections are closed
+const uint32_t HTTP_POLL_INTERVAL = 10;   // [ms] the web server task sleeps this time if no request is waiting
+const uint32_t LOOP_MAX_SLEEP = 100;      // [ms] longest sleep of loop() without an event (display, history)
+const uint32_t BUS_MAX_SLEEP = 100;       // [ms] longest sleep of a bus task without an event
+const uint32_t EVENT_HEARTBEAT = 15000;   // [ms] comment line to idle /events streams, detects closed browsers
+const uint32_t LOG_DRAIN_INTERVAL = 20; // [ms] the log task sleeps this time if the ring is empty
+const size_t TRACE_BYTES = 65536;      // per bus in PSRAM (1/8 without PSRAM), ~2500 polls of 8 registers
+const uint16_t MAX_REGISTER_GAP = 8;   // ranges of the same server are merged into one request if the gap is smaller
+const int8_t BUS0_RX_PIN = 16; // Serial2, RS485 bus 0
+const int8_t BUS0_TX_PIN = 17;
+const int8_t BUS1_RX_PIN = 13; // Serial1, RS485 bus 1 (second RS485 module)
+const int8_t BUS1_TX_PIN = 15;
+
+// clang-format off
+// Device table - add or remove servers here, nothing else has to be changed!
+// A server may have several rows with different register ranges, they are merged into as few requests as possible
+// Every row has its own poll period, deadline 0 means the request has to be sent within one poll period
+// XY-MD02 needs some 'resting' time before and after the request, see header comment
+// The buses are polled in parallel: the slow XY-MD02 sits on bus 1, so its guard times don't block the fast servers
+const ModbusDevice DEVICES[] = {
+//  name             ID  function code         start   count  guard before  after  period  deadline  format          bus
+//{"Arduino-Nano",   42, READ_INPUT_REGISTER,  0x0001,   8,      0,          50,   5000,      0,     FORMAT_DECIMAL, 0}, // Arduino Nano and 5V RS485 Shield
+  {"M5Atom-27",      27, READ_HOLD_REGISTER,   0x012C,  80,      0,          50,   5000,      0,     FORMAT_DECIMAL, 0}, // M5Atom with RS485 Module (0x012C = 300d)
+  {"XY-MD02-1",       1, READ_INPUT_REGISTER,  0x0001,   2,   1000,        1000,  30000,      0,     FORMAT_TENTHS,  1}, // XY-MD02 cheap chinese temperature sensor (https://www.aliexpress.com/i/1005001475675808.html)
+//{"XY-MD02-2",       3, READ_INPUT_REGISTER,  0x0001,   2,   1000,        1000,  30000,      0,     FORMAT_TENTHS,  1}, // XY-MD02 cheap chinese temperature sensor
+//{"M5Atom-26",      26, READ_HOLD_REGISTER,   0x012C,  80,      0,          50,   5000,      0,     FORMAT_DECIMAL, 0}, // M5Atom with RS485 Module
+//{"M5Atom-25",      25, READ_HOLD_REGISTER,   0x012C,  80,      0,          50,   5000,      0,     FORMAT_DECIMAL, 0}, // M5Atom with RS485 Module
+};
+// clang-format on
+const uint16_t NUM_DEVICES = sizeof(DEVICES) / sizeof(DEVICES[0]);
+static_assert(NUM_DEVICES <= POLL_MAX_DEVICES, "device table too large, raise POLL_MAX_DEVICES (see PollScheduler.h)");
+
+// received data from the servers, written by the eModbus tasks of the buses, read by loop() and the web handlers
+RegisterSnapshot Snapshots[NUM_DEVICES];
+ChangeDetector Changes[NUM_DEVICES]; // report by exception
+
+// deadbands for the change detection, registers without entry report every change
+struct DeadbandConfig
+{
+  uint8_t serverID;
+  uint16_t address; // first register
+  uint16_t count;   // number of registers
+  uint16_t deadband;
+};
+const DeadbandConfig DEADBANDS[] = {
+    {1, 0x0001, 1, 2}, // XY-MD02 temperature 0.2 degC
+    {1, 0x0002, 1, 5}, // XY-MD02 humidity 0.5 %rH
+    {3, 0x0001, 1, 2},
+    {3, 0x0002, 1, 5},
+};
+// registers with an in-RAM history (GET /history?id=1&reg=1)
+struct HistoryConfig
+{
+  uint8_t serverID;
+  uint16_t address;
+};
+const HistoryConfig HISTORY[] = {
+    {1, 0x0001}, // XY-MD02 temperature
+    {1, 0x0002}, // XY-MD02 humidity
+    {27, 0x012C}, // M5Atom
+};
+const uint16_t NUM_HISTORY = sizeof(HISTORY) / sizeof(HISTORY[0]);
+const size_t HISTORY_BYTES = 8192; // per register, ~3 bytes per sample -> ~2700 samples (3.7 h @ 5 s)
+const uint16_t HISTORY_CHUNK = 64;  // samples of a /history request copied at once under the lock
+HistorySeries History[NUM_HISTORY];
+int16_t HistoryDevice[NUM_HISTORY]; // device table row of each history register, -1 = not found
+uint16_t HistoryOffset[NUM_HISTORY];
+SemaphoreHandle_t HistoryLock; // append() in loop(), query() in the web server task
+
+// registers shown on the LCD, one line each
+struct DisplayConfig
+{
+  uint8_t serverID;
+  uint16_t address;
+  const char *label;
+};
+const DisplayConfig DISPLAY_TAGS[] = {
+    {1, 0x0001, "Temp"},
+    {1, 0x0002, "Hum"},
+    {27, 0x012C, "Atom"},
+};
+const uint16_t NUM_DISPLAY_TAGS = sizeof(DISPLAY_TAGS) / sizeof(DISPLAY_TAGS[0]);
+const uint32_t LCD_FRAME_TIME = 200; // [ms] max. 5 screen updates per second
+LcdView Lcd(LCD_FRAME_TIME);
+int16_t LcdHeader; // field of the request counters
+int16_t LcdFields[NUM_DISPLAY_TAGS];
+int16_t DisplayDevice[NUM_DISPLAY_TAGS]; // device table row of each display register, -1 = not found
+uint16_t DisplayOffset[NUM_DISPLAY_TAGS];
+uint32_t LcdRenderMax = 0; // [us] longest screen update
+
+const bool REPORT_ONLY_CHANGES = true; // printRequests() shows only the values changed since the last report
+
+// read requests built from the device table by the RegisterPlanner
+ModbusDevice REQUESTS[NUM_DEVICES];
+TagMapping TAG_MAP[NUM_DEVICES]; // request and offset of each device table row
+const uint16_t NUM_REQUESTS = RegisterPlanner(MAX_REGISTER_GAP).plan(DEVICES, NUM_DEVICES, REQUESTS, TAG_MAP);
+
+// shared by the buses, indexed by the request of the whole table
+RequestDispatcher Dispatcher(REQUESTS, NUM_REQUESTS, TAG_MAP, NUM_DEVICES);
+BusMetrics Metrics;
+CircuitBreaker Breaker; // quarantines devices after consecutive timeouts
+WireBudget Budget(REQUESTS, NUM_REQUESTS, BAUDRATE); // wire time vs. measured bus time, per report cycle
+
+// Modbus TCP gateway, unit ID = RTU server ID
+CacheGateway Gateway(DEVICES, Snapshots, NUM_DEVICES);
+ModbusServerEthernet MBserver;
+
+#ifdef SIMULATED_BUS
+#ifdef REPLAY_BUS
+// no RS485 hardware: the servers answer like in the captured traces /trace0.bin and /trace1.bin
+// on the SD card (env m5stack-replay)
+TraceReplay SimBus0(BAUDRATE);
+TraceReplay SimBus1(BAUDRATE);
+TraceReplay *const REPLAY_BUSES[MODBUS_MAX_BUSES] = {&SimBus0, &SimBus1};
+#else
+// no RS485 hardware: the servers are simulated (env m5stack-simulated)
+// ID, latency [ms], timeouts [1/1000], CRC errors [1/1000], bus disturbed after the answer [ms]
+const SimServer SIM_SERVERS[] = {
+    {42, 15, 2, 2, 0},    // Arduino-Nano (not in the device table)
+    {27, 10, 2, 2, 0},    // M5Atom
+    {1, 40, 10, 5, 1000}, // XY-MD02: disturbs the bus, needs the long guard times
+};
+SimulatedBus SimBus0(BAUDRATE, SIM_SERVERS, sizeof(SIM_SERVERS) / sizeof(SIM_SERVERS[0]));
+SimulatedBus SimBus1(BAUDRATE, SIM_SERVERS, sizeof(SIM_SERVERS) / sizeof(SIM_SERVERS[0]), 0x9E3779B9);
+#endif
+SimulatedBus *const SIM_BUSES[MODBUS_MAX_BUSES] = {&SimBus0, &SimBus1};
+SimulatedClient MB0(SimBus0);
+SimulatedClient MB1(SimBus1);
+#else
+// Create a ModbusRTU client instance per bus
+// The RS485 module has halfduplex, so the second parameter with the DE/RE pin is not required!
+ModbusClientRTU MB0(Serial2);
+ModbusClientRTU MB1(Serial1);
+#endif
+// every bus has its own UART, client, scheduler, guard tuner, request lanes and polling task
+ModbusBus Bus0(0, MB0, Serial2, BUS0_RX_PIN, BUS0_TX_PIN, REQUESTS, NUM_REQUESTS);
+ModbusBus Bus1(1, MB1, Serial1, BUS1_RX_PIN, BUS1_TX_PIN, REQUESTS, NUM_REQUESTS);
+ModbusBus *const BUSES[MODBUS_MAX_BUSES] = {&Bus0, &Bus1};
+
+// bus of a request of the whole table
+ModbusBus &busOf(uint16_t request)
+{
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    if (BUSES[b]->owns(request))
+    {
+      return *BUSES[b];
+    }
+  }
+  return Bus0;
+}
+
+// index of a request in the scheduler and guard tuner of its bus
+uint16_t localIndex(uint16_t request)
+{
+  return request - busOf(request).first();
+}
+
+// request (whole table) of the first read request of a server, PollScheduler::NO_DEVICE if not in the table
+int16_t findServer(uint8_t serverID)
+{
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    int16_t index = BUSES[b]->findServer(serverID);
+    if (index != PollScheduler::NO_DEVICE)
+    {
+      return index;
+    }
+  }
+  return PollScheduler::NO_DEVICE;
+}
+
+// bus of a server, writes to servers not in the device table go to bus 0
+ModbusBus &busOfServer(uint8_t serverID)
+{
+  int16_t index = findServer(serverID);
+  return index != PollScheduler::NO_DEVICE ? busOf(index) : Bus0;
+}
 
-enum STATES // different tasks in the state machine
+// the bus tasks sleep until the next bus slot or one of these events, loop() until the report timer
+enum LOOP_EVENT
 {
-  READ_SENSOR_1,
-  READ_SENSOR_2,
-  READ_SENSOR_3,
-  READ_SENSOR_4,
-  READ_SENSOR_5,
-  READ_SENSOR_6,
-  LAST_TASK
+  EVENT_RESPONSE = 0x01, // eModbus callback: the bus is free again
+  EVENT_REQUEST = 0x02,  // a control write or alarm read was submitted
+  EVENT_REPORT = 0x04,   // report timer
 };
+TaskHandle_t LoopTask = NULL;
+TimerHandle_t ReportTimer;
 
-byte STATE_NR;                       // state tracking
-unsigned long STATE_START_DELAY = 0; // global delay for each state
-unsigned long STATE_WAIT_DELAY = 0;  // global delay for each state
+void wakeLoop(uint32_t event)
+{
+  if (LoopTask != NULL)
+  {
+    xTaskNotify(LoopTask, event, eSetBits);
+  }
+}
 
-unsigned long STATE_MACHINE_START = 0; // measurement of runtime of the whole state machine
-unsigned long STATE_MACHINE_END = 0;   // to calculate the difference to STATE_MACHINE_INTERVAL
+void wakeBus(ModbusBus &bus, uint32_t event)
+{
+  if (bus.task != NULL)
+  {
+    xTaskNotify(bus.task, event, eSetBits);
+  }
+}
 
-#define BAUDRATE 9600
-// #define READ_INTERVAL 5000
-// #define POLL_DELAY 500 // important! XY-MD02 need a delay between requests!
-
-// Server Arduino Nano and 5V RS485 Shield
-#define SERVER1_ID 42
-#define SERVER1_TOKEN 42              // only for Test same # as ID
-#define SERVER1_INPUT_REGISTER 0x0001 // statt 0x0000
-#define SERVER1_NUM_VALUES 8
-
-// Server M5Atom with RS485 Module
-#define SERVER2_ID 27
-#define SERVER2_TOKEN 27             // only for Test same # as ID
-#define SERVER2_HOLD_REGISTER 0x012C // =300d
-#define SERVER2_NUM_VALUES 80
-
-// XY-MD02 cheap chinese temperature sensor (https://www.aliexpress.com/i/1005001475675808.html)
-#define SERVER3_ID 1
-#define SERVER3_TOKEN 1               // only for Test same # as ID
-#define SERVER3_INPUT_REGISTER 0x0001 //
-#define SERVER3_NUM_VALUES 2
-
-// XY-MD02 cheap chinese temperature sensor (https://www.aliexpress.com/i/1005001475675808.html)
-#define SERVER4_ID 3
-#define SERVER4_TOKEN 3               // only for Test same # as ID
-#define SERVER4_INPUT_REGISTER 0x0001 //
-#define SERVER4_NUM_VALUES 2
-
-// Server M5Atom with RS485 Module
-#define SERVER5_ID 26
-#define SERVER5_TOKEN 26             // only for Test same # as ID
-#define SERVER5_HOLD_REGISTER 0x012C // =300d
-#define SERVER5_NUM_VALUES 80
-
-// Server M5Atom with RS485 Module
-#define SERVER6_ID 25
-#define SERVER6_TOKEN 25             // only for Test same # as ID
-#define SERVER6_HOLD_REGISTER 0x012C // =300d
-#define SERVER6_NUM_VALUES 80
-
-// received data from the servers
-uint16_t Server1_values[SERVER1_NUM_VALUES];
-uint16_t Server2_values[SERVER2_NUM_VALUES];
-uint16_t Server3_values[SERVER3_NUM_VALUES];
-uint16_t Server4_values[SERVER4_NUM_VALUES];
-uint16_t Server5_values[SERVER5_NUM_VALUES];
-uint16_t Server6_values[SERVER6_NUM_VALUES];
-
-// Create a ModbusRTU client instance
-// The RS485 module has halfduplex, so the second parameter with the DE/RE pin is not required!
-ModbusClientRTU MB(Serial2);
+// test variables, counted by both bus tasks
+std::atomic<uint32_t> MB_Errors(0);
+std::atomic<uint32_t> MB_Requests(0);
 
-Error MB_ERROR1;
-Error MB_ERROR2;
-Error MB_ERROR3;
-Error MB_ERROR4;
-Error MB_ERROR5;
-Error MB_ERROR6;
+// request headers read by the handlers, filled by aWOT for every request
+char HttpConnectionHeader[16]; // "Connection" header of the current request
+char HttpIfNoneMatchHeader[32];
+char HttpAcceptHeader[64];
 
-// test variables
-uint32_t MB_Errors = 0;
-uint32_t MB_Requests = 0;
+// Server-Sent Events: one change cursor per device for every connection
+struct EventClient
+{
+  uint32_t cursor[NUM_DEVICES];
+  uint32_t lastWrite;
+};
+EventClient EventClients[HTTP_CLIENTS];
+uint32_t EventsSent = 0;
+uint32_t EventsSkipped = 0; // not sent because the browser was too slow, the next event brings the newer values
 
 void indexCmd(Request &req, Response &res)
 {
@@ -220,64 +391,899 @@ void indexCmd(Request &req, Response &res)
                 uxTaskGetStackHighWaterMark(xTaskGetIdleTaskHandle()));
 }
 
-void getValues(ModbusMessage response, uint16_t values[], uint16_t numVal)
+// one Prometheus sample with the labels of a read request
+void printMetric(Response &res, const char *name, uint16_t index, uint32_t value)
+{
+  const ModbusDevice &dev = REQUESTS[index];
+  res.printf("%s{server=\"%i\",name=\"%s\"} %lu\n", name, dev.serverID, dev.name, (unsigned long)value);
+}
+
+// Prometheus text format, written directly to the client without building the page in RAM
+void metricsCmd(Request &req, Response &res)
+{
+  res.set("Content-Type", "text/plain; version=0.0.4");
+
+  res.print("# TYPE modbus_requests_total counter\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_requests_total", i, Metrics.device(i).requests);
+  res.print("# TYPE modbus_responses_total counter\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_responses_total", i, Metrics.device(i).responses);
+  res.print("# TYPE modbus_timeouts_total counter\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_timeouts_total", i, Metrics.device(i).timeouts);
+  res.print("# TYPE modbus_crc_errors_total counter\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_crc_errors_total", i, Metrics.device(i).crcErrors);
+  res.print("# TYPE modbus_exceptions_total counter\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_exceptions_total", i, Metrics.device(i).exceptions);
+  res.print("# TYPE modbus_other_errors_total counter\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_other_errors_total", i, Metrics.device(i).otherErrors);
+  res.print("# TYPE modbus_poll_interval_ms gauge\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_poll_interval_ms", i, Metrics.device(i).pollInterval);
+  res.print("# TYPE modbus_poll_interval_max_ms gauge\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_poll_interval_max_ms", i, Metrics.device(i).maxPollInterval);
+  res.print("# TYPE modbus_deadline_missed_total counter\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_deadline_missed_total", i, busOf(i).scheduler.missedDeadlines(localIndex(i)));
+  res.print("# TYPE modbus_lateness_ms gauge\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_lateness_ms", i, busOf(i).scheduler.lateness(localIndex(i)));
+  res.print("# TYPE modbus_guard_after_ms gauge\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_guard_after_ms", i, busOf(i).tuner.state(localIndex(i)).guardAfter);
+  res.print("# TYPE modbus_wire_time_us gauge\n"); // theoretical RTU time of request and response
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_wire_time_us", i, Budget.wireTime(i));
+  res.print("# TYPE modbus_overhead_us gauge\n"); // turnaround - wire time, average of the last report cycle
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+  {
+    const BudgetStats &bs = Budget.request(i);
+    printMetric(res, "modbus_overhead_us", i, bs.transfers > 0 && bs.busyTime > bs.wireTime ? (bs.busyTime - bs.wireTime) / bs.transfers : 0);
+  }
+  res.print("# TYPE modbus_breaker_state gauge\n"); // 0 = ok, 1 = quarantined, 2 = probing
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_breaker_state", i, Breaker.state(i).state);
+  res.print("# TYPE modbus_quarantines_total counter\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_quarantines_total", i, Breaker.state(i).quarantines);
+  res.print("# TYPE modbus_probes_total counter\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+    printMetric(res, "modbus_probes_total", i, Breaker.state(i).probes);
+
+  res.print("# TYPE modbus_latency_ms histogram\n");
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+  {
+    const DeviceMetrics &m = Metrics.device(i);
+    const ModbusDevice &dev = REQUESTS[i];
+    uint32_t cumulated = 0;
+    for (uint8_t b = 0; b < LATENCY_BUCKETS; ++b)
+    {
+      cumulated += m.latencyBuckets[b];
+      if (b < LATENCY_BUCKETS - 1)
+        res.printf("modbus_latency_ms_bucket{server=\"%i\",name=\"%s\",le=\"%lu\"} %lu\n",
+                   dev.serverID, dev.name, (unsigned long)LATENCY_BOUNDS[b], (unsigned long)cumulated);
+      else
+        res.printf("modbus_latency_ms_bucket{server=\"%i\",name=\"%s\",le=\"+Inf\"} %lu\n",
+                   dev.serverID, dev.name, (unsigned long)cumulated);
+    }
+    printMetric(res, "modbus_latency_ms_sum", i, m.latencySum);
+    printMetric(res, "modbus_latency_ms_count", i, cumulated);
+  }
+
+  res.print("# TYPE modbus_errors_total counter\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    for (uint16_t code = 0; code < 256; ++code)
+    {
+      if (Metrics.errorCount(b, code) > 0)
+        res.printf("modbus_errors_total{bus=\"%u\",code=\"%02X\"} %lu\n", b, code, (unsigned long)Metrics.errorCount(b, code));
+    }
+  }
+  DispatchStats ds = Dispatcher.stats();
+  res.print("# TYPE modbus_dropped_responses_total counter\n");
+  res.printf("modbus_dropped_responses_total{reason=\"stale\"} %lu\n", (unsigned long)ds.stale);
+  res.printf("modbus_dropped_responses_total{reason=\"server\"} %lu\n", (unsigned long)ds.serverMismatch);
+  res.printf("modbus_dropped_responses_total{reason=\"function\"} %lu\n", (unsigned long)ds.functionMismatch);
+  res.printf("modbus_dropped_responses_total{reason=\"length\"} %lu\n", (unsigned long)ds.lengthMismatch);
+  res.printf("modbus_dropped_responses_total{reason=\"token\"} %lu\n", (unsigned long)ds.unknownToken);
+
+  // wire-time budget of every bus in the last report cycle
+  res.print("# TYPE modbus_bus_utilization_permille gauge\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    res.printf("modbus_bus_utilization_permille{bus=\"%u\"} %u\n", b, Budget.utilization(b));
+  res.print("# TYPE modbus_bus_time_ms gauge\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    const BudgetStats &bs = Budget.bus(b);
+    res.printf("modbus_bus_time_ms{bus=\"%u\",type=\"wire\"} %lu\n", b, (unsigned long)(bs.wireTime / 1000));
+    res.printf("modbus_bus_time_ms{bus=\"%u\",type=\"busy\"} %lu\n", b, (unsigned long)(bs.busyTime / 1000));
+    res.printf("modbus_bus_time_ms{bus=\"%u\",type=\"guard\"} %lu\n", b, (unsigned long)(bs.guardTime / 1000));
+    res.printf("modbus_bus_time_ms{bus=\"%u\",type=\"idle\"} %lu\n", b, (unsigned long)Budget.idleTime(b));
+  }
+  res.print("# TYPE modbus_bus_cycle_ms gauge\n");
+  res.printf("modbus_bus_cycle_ms %lu\n", (unsigned long)Budget.cycleTime());
+  res.print("# TYPE modbus_bus_spare_registers gauge\n"); // registers per second the idle time could still transfer
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    res.printf("modbus_bus_spare_registers{bus=\"%u\"} %lu\n", b, (unsigned long)Budget.spareRegisters(b));
+
+  // the request lanes of every bus
+  res.print("# TYPE modbus_lane_requests_total counter\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    for (uint8_t p = 0; p < PRIORITY_CLASSES; ++p)
+      res.printf("modbus_lane_requests_total{bus=\"%u\",class=\"%s\"} %lu\n", b, RequestLanes::className(p),
+                 (unsigned long)BUSES[b]->lanes.stats(p).requests);
+  res.print("# TYPE modbus_lane_failed_total counter\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    for (uint8_t p = 0; p < PRIORITY_CLASSES; ++p)
+      res.printf("modbus_lane_failed_total{bus=\"%u\",class=\"%s\"} %lu\n", b, RequestLanes::className(p),
+                 (unsigned long)BUSES[b]->lanes.stats(p).failed);
+  res.print("# TYPE modbus_lane_rejected_total counter\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    for (uint8_t p = 0; p < PRIORITY_CLASSES; ++p)
+      res.printf("modbus_lane_rejected_total{bus=\"%u\",class=\"%s\"} %lu\n", b, RequestLanes::className(p),
+                 (unsigned long)BUSES[b]->lanes.stats(p).rejected);
+  res.print("# TYPE modbus_lane_wait_ms summary\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    for (uint8_t p = 0; p < PRIORITY_CLASSES; ++p)
+    {
+      const LaneStats &ls = BUSES[b]->lanes.stats(p);
+      const char *name = RequestLanes::className(p);
+      res.printf("modbus_lane_wait_ms_sum{bus=\"%u\",class=\"%s\"} %lu\n", b, name, (unsigned long)ls.waitSum);
+      res.printf("modbus_lane_wait_ms_count{bus=\"%u\",class=\"%s\"} %lu\n", b, name, (unsigned long)ls.requests);
+      res.printf("modbus_lane_wait_ms_max{bus=\"%u\",class=\"%s\"} %lu\n", b, name, (unsigned long)ls.waitMax);
+    }
+  res.print("# TYPE modbus_lane_latency_ms summary\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    for (uint8_t p = 0; p < PRIORITY_CLASSES; ++p)
+    {
+      const LaneStats &ls = BUSES[b]->lanes.stats(p);
+      const char *name = RequestLanes::className(p);
+      res.printf("modbus_lane_latency_ms_sum{bus=\"%u\",class=\"%s\"} %lu\n", b, name, (unsigned long)ls.latencySum);
+      res.printf("modbus_lane_latency_ms_count{bus=\"%u\",class=\"%s\"} %lu\n", b, name, (unsigned long)(ls.completed + ls.failed));
+      res.printf("modbus_lane_latency_ms_max{bus=\"%u\",class=\"%s\"} %lu\n", b, name, (unsigned long)ls.latencyMax);
+    }
+
+  res.print("# TYPE modbus_trace_bytes gauge\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    res.printf("modbus_trace_bytes{bus=\"%u\",capture=\"%u\"} %lu\n", b, BUSES[b]->trace.active(), (unsigned long)BUSES[b]->trace.length());
+  res.print("# TYPE modbus_trace_dropped_total counter\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    res.printf("modbus_trace_dropped_total{bus=\"%u\"} %lu\n", b, (unsigned long)BUSES[b]->trace.dropped());
+
+  res.print("# TYPE modbus_queue_depth gauge\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    res.printf("modbus_queue_depth{bus=\"%u\"} %lu\n", b, (unsigned long)Metrics.queueDepth(b));
+  res.print("# TYPE modbus_queue_depth_max gauge\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    res.printf("modbus_queue_depth_max{bus=\"%u\"} %lu\n", b, (unsigned long)Metrics.maxQueueDepth(b));
+  res.print("# TYPE modbus_loop_time_max_ms gauge\n");
+  res.printf("modbus_loop_time_max_ms %lu\n", (unsigned long)Metrics.maxLoopTime());
+  const LcdStats &ls = Lcd.stats();
+  res.print("# TYPE lcd_fields_drawn_total counter\n");
+  res.printf("lcd_fields_drawn_total %lu\n", (unsigned long)ls.fieldsDrawn);
+  res.print("# TYPE lcd_chars_drawn_total counter\n");
+  res.printf("lcd_chars_drawn_total %lu\n", (unsigned long)ls.charsDrawn);
+  res.print("# TYPE lcd_render_time_max_us gauge\n");
+  res.printf("lcd_render_time_max_us %lu\n", (unsigned long)LcdRenderMax);
+  res.print("# TYPE http_events_sent_total counter\n");
+  res.printf("http_events_sent_total %lu\n", (unsigned long)EventsSent);
+  res.print("# TYPE http_events_skipped_total counter\n");
+  res.printf("http_events_skipped_total %lu\n", (unsigned long)EventsSkipped);
+#ifdef SIMULATED_BUS
+  res.print("# TYPE sim_requests_total counter\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    res.printf("sim_requests_total{bus=\"%u\"} %lu\n", b, (unsigned long)SIM_BUSES[b]->stats().requests);
+  res.print("# TYPE sim_faults_total counter\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    const SimStats &ss = SIM_BUSES[b]->stats();
+    res.printf("sim_faults_total{bus=\"%u\",type=\"timeout\"} %lu\n", b, (unsigned long)ss.timeouts);
+    res.printf("sim_faults_total{bus=\"%u\",type=\"crc\"} %lu\n", b, (unsigned long)ss.crcErrors);
+    res.printf("sim_faults_total{bus=\"%u\",type=\"disturbed\"} %lu\n", b, (unsigned long)ss.disturbed);
+  }
+  res.print("# TYPE sim_bus_time_ms_total counter\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+    res.printf("sim_bus_time_ms_total{bus=\"%u\"} %lu\n", b, (unsigned long)SIM_BUSES[b]->stats().busTime);
+#ifdef REPLAY_BUS
+  res.print("# TYPE replay_requests_total counter\n");
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    res.printf("replay_requests_total{bus=\"%u\",result=\"replayed\"} %lu\n", b, (unsigned long)REPLAY_BUSES[b]->replayed());
+    res.printf("replay_requests_total{bus=\"%u\",result=\"missing\"} %lu\n", b, (unsigned long)REPLAY_BUSES[b]->missing());
+  }
+#endif
+#endif
+  res.print("# TYPE log_dropped_total counter\n");
+  res.printf("log_dropped_total %lu\n", (unsigned long)Log.dropped());
+  res.print("# TYPE esp_free_heap_bytes gauge\n");
+  res.printf("esp_free_heap_bytes %lu\n", (unsigned long)ESP.getFreeHeap());
+}
+
+// query parameter as number, returns false if missing or not a number
+bool queryNumber(Request &req, const char *name, uint32_t &value)
+{
+  char buf[12];
+  if (!req.query(name, buf, sizeof(buf)) || buf[0] == 0)
+  {
+    return false;
+  }
+  char *end;
+  value = strtoul(buf, &end, 0);
+  return *end == 0;
+}
+
+// POST /write?id=27&reg=300&value=1234 - control write with the highest priority
+void writeCmd(Request &req, Response &res)
+{
+  uint32_t id, reg, value;
+  if (!queryNumber(req, "id", id) || !queryNumber(req, "reg", reg) || !queryNumber(req, "value", value) ||
+      id == 0 || id > 247 || reg > 0xFFFF || value > 0xFFFF)
+  {
+    res.sendStatus(400);
+    return;
+  }
+  uint16_t v = value;
+  ModbusBus &bus = busOfServer(id);
+  bool accepted = bus.lanes.submitWrite(id, reg, &v, 1, millis());
+  wakeBus(bus, EVENT_REQUEST);
+  res.sendStatus(accepted ? 202 : 503);
+}
+
+// POST /poll?id=27 - read all requests of a server now, out of schedule
+void pollCmd(Request &req, Response &res)
+{
+  uint32_t id;
+  if (!queryNumber(req, "id", id))
+  {
+    res.sendStatus(400);
+    return;
+  }
+  bool found = false;
+  bool accepted = true;
+  for (uint16_t i = 0; i < NUM_REQUESTS; ++i)
+  {
+    if (REQUESTS[i].serverID == id)
+    {
+      found = true;
+      ModbusBus &bus = busOf(i);
+      accepted &= bus.lanes.submitRead(id, localIndex(i), millis());
+      wakeBus(bus, EVENT_REQUEST);
+    }
+  }
+  res.sendStatus(!found ? 404 : accepted ? 202 : 503);
+}
+
+// prints one history sample as CSV line
+// samples of a /history request copied under the lock, printed without it
+struct HistoryChunk
+{
+  uint32_t time[HISTORY_CHUNK];
+  uint16_t value[HISTORY_CHUNK];
+  uint16_t count;
+};
+
+bool collectSample(void *context, uint32_t time, uint16_t value)
+{
+  HistoryChunk *chunk = (HistoryChunk *)context;
+  chunk->time[chunk->count] = time;
+  chunk->value[chunk->count] = value;
+  return ++chunk->count < HISTORY_CHUNK;
+}
+
+// GET /history?id=1&reg=1[&from=<millis>][&to=<millis>] - CSV stream of the stored samples
+void historyCmd(Request &req, Response &res)
+{
+  uint32_t id, reg;
+  if (!queryNumber(req, "id", id) || !queryNumber(req, "reg", reg))
+  {
+    res.sendStatus(400);
+    return;
+  }
+  for (uint16_t h = 0; h < NUM_HISTORY; ++h)
+  {
+    if (HISTORY[h].serverID != id || HISTORY[h].address != reg)
+    {
+      continue;
+    }
+    uint32_t now = millis();
+    uint32_t from, to;
+    xSemaphoreTake(HistoryLock, portMAX_DELAY);
+    uint32_t oldest = History[h].oldest();
+    uint32_t samples = History[h].samples();
+    size_t bytes = History[h].bytesUsed();
+    xSemaphoreGive(HistoryLock);
+    if (!queryNumber(req, "from", from))
+      from = oldest;
+    if (!queryNumber(req, "to", to))
+      to = now;
+    res.set("Content-Type", "text/csv");
+    res.printf("# now=%lu samples=%lu bytes=%u\n", (unsigned long)now, (unsigned long)samples, (unsigned)bytes);
+    res.print("millis,value\n");
+    // the lock is held only to copy a chunk, the slow network output runs without it,
+    // so loop() never waits for the client (every sample has its own time, one per snapshot)
+    HistoryChunk chunk;
+    while (true)
+    {
+      chunk.count = 0;
+      xSemaphoreTake(HistoryLock, portMAX_DELAY);
+      History[h].query(from, to, &collectSample, &chunk);
+      xSemaphoreGive(HistoryLock);
+      for (uint16_t i = 0; i < chunk.count; ++i)
+      {
+        res.printf("%lu,%u\n", (unsigned long)chunk.time[i], chunk.value[i]);
+      }
+      if (chunk.count < HISTORY_CHUNK || chunk.time[HISTORY_CHUNK - 1] == to)
+      {
+        break;
+      }
+      from = chunk.time[HISTORY_CHUNK - 1] + 1;
+    }
+    return;
+  }
+  res.sendStatus(404);
+}
+
+// GET /trace?bus=0 - binary trace of the captured traffic of a bus (TraceRecorder)
+void traceCmd(Request &req, Response &res)
+{
+  uint32_t bus;
+  if (!queryNumber(req, "bus", bus) || bus >= MODBUS_MAX_BUSES)
+  {
+    res.sendStatus(400);
+    return;
+  }
+  const TraceRecorder &trace = BUSES[bus]->trace;
+  size_t length = trace.length(); // complete records only, the capture may go on
+  if (length == 0)
+  {
+    res.sendStatus(404);
+    return;
+  }
+  res.set("Content-Type", "application/octet-stream");
+  res.write(trace.data(), length);
+}
+
+// POST /trace?bus=0&capture=1 - starts (1) or stops (0) the capture of a bus
+void traceCaptureCmd(Request &req, Response &res)
+{
+  uint32_t bus, capture;
+  if (!queryNumber(req, "bus", bus) || bus >= MODBUS_MAX_BUSES || !queryNumber(req, "capture", capture))
+  {
+    res.sendStatus(400);
+    return;
+  }
+  ModbusBus &b = *BUSES[bus];
+  if (capture == 0)
+  {
+    b.trace.stop();
+    res.sendStatus(200);
+    return;
+  }
+  if (b.trace.size() == 0)
+  {
+    res.sendStatus(503); // no buffer
+    return;
+  }
+  b.traceStart = true; // started by the bus task between two requests
+  wakeBus(b, EVENT_REQUEST);
+  res.sendStatus(202);
+}
+
+// web server task: several keep-alive connections, served one request at a time,
+// so a slow browser or dashboard never delays a Modbus slot of the bus tasks
+// The handlers only read snapshots and counters, the only shared writer is the
+// RequestLanes producer side of every bus (this task is their single producer).
+HttpConnection HttpClients[HTTP_CLIENTS];
+
+// quality flags of a device table row, 0 = good
+enum DATA_QUALITY
+{
+  QUALITY_GOOD = 0,
+  QUALITY_NO_DATA = 0x01,     // no snapshot yet
+  QUALITY_STALE = 0x02,       // older than GATEWAY_STALE_PERIODS poll periods (like the Modbus TCP gateway)
+  QUALITY_QUARANTINED = 0x04, // the circuit breaker has stopped the polling
+};
+
+uint8_t dataQuality(uint16_t d, const SnapshotData &snap, bool valid, uint32_t now)
+{
+  uint8_t quality = QUALITY_GOOD;
+  if (!valid || snap.sequence == 0)
+    quality |= QUALITY_NO_DATA;
+  else if (now - snap.timestamp > GATEWAY_STALE_PERIODS * DEVICES[d].pollPeriod)
+    quality |= QUALITY_STALE;
+  if (!Breaker.isClosed(TAG_MAP[d].request))
+    quality |= QUALITY_QUARANTINED;
+  return quality;
+}
+
+// weak ETag of the rows of a server (0 = all): last value change and the quality of every row,
+// a new poll with the same values (within the deadband) keeps the ETag
+void deviceETag(char *etag, size_t size, uint8_t serverID, uint32_t now)
+{
+  static SnapshotData snap;
+  uint32_t lastChange = 0;
+  uint32_t qualities = 2166136261UL; // FNV-1a
+  for (uint16_t d = 0; d < NUM_DEVICES; ++d)
+  {
+    if (serverID != 0 && DEVICES[d].serverID != serverID)
+      continue;
+    if ((int32_t)(Changes[d].lastChange() - lastChange) > 0)
+      lastChange = Changes[d].lastChange();
+    bool valid = Snapshots[d].read(snap);
+    qualities = (qualities ^ dataQuality(d, snap, valid, now)) * 16777619UL;
+  }
+  snprintf(etag, size, "W/\"%lx.%lx\"", (unsigned long)lastChange, (unsigned long)qualities);
+}
+
+// JSON written directly to the client:
+// {"now":<millis>,"devices":[{"id":1,"name":"XY-MD02-1","fc":4,"start":1,"seq":17,"t":<millis>,"quality":0,"values":[215,550]},...]}
+void devicesJson(Response &res, uint8_t serverID, uint32_t now)
+{
+  static SnapshotData snap;
+  res.set("Content-Type", "application/json");
+  res.printf("{\"now\":%lu,\"devices\":[", (unsigned long)now);
+  bool first = true;
+  for (uint16_t d = 0; d < NUM_DEVICES; ++d)
+  {
+    const ModbusDevice &dev = DEVICES[d];
+    if (serverID != 0 && dev.serverID != serverID)
+      continue;
+    bool valid = Snapshots[d].read(snap);
+    res.printf("%s{\"id\":%u,\"name\":\"%s\",\"fc\":%u,\"start\":%u,\"seq\":%lu,\"t\":%lu,\"quality\":%u,\"values\":[",
+               first ? "" : ",", dev.serverID, dev.name, dev.functionCode, dev.startRegister,
+               (unsigned long)(valid ? snap.sequence : 0), (unsigned long)(valid ? snap.timestamp : 0),
+               dataQuality(d, snap, valid, now));
+    for (uint16_t i = 0; valid && i < snap.numValues; ++i)
+      res.printf(i ? ",%u" : "%u", snap.values[i]);
+    res.print("]}");
+    first = false;
+  }
+  res.print("]}");
+}
+
+// binary format for machines, all numbers little endian:
+//   header: 'M' 'B' version(1) rows(1) now(4)
+//   row:    serverID(1) fc(1) quality(1) reserved(1) start(2) numValues(2) sequence(4) timestamp(4) values(2 * numValues)
+void devicesBinary(Response &res, uint8_t serverID, uint32_t now)
+{
+  static SnapshotData snap;
+  uint8_t rows = 0;
+  for (uint16_t d = 0; d < NUM_DEVICES; ++d)
+    rows += serverID == 0 || DEVICES[d].serverID == serverID;
+  res.set("Content-Type", "application/octet-stream");
+  uint8_t header[8] = {'M', 'B', 1, rows, (uint8_t)now, (uint8_t)(now >> 8), (uint8_t)(now >> 16), (uint8_t)(now >> 24)};
+  res.write(header, sizeof(header));
+  for (uint16_t d = 0; d < NUM_DEVICES; ++d)
+  {
+    const ModbusDevice &dev = DEVICES[d];
+    if (serverID != 0 && dev.serverID != serverID)
+      continue;
+    bool valid = Snapshots[d].read(snap);
+    uint16_t n = valid ? snap.numValues : 0;
+    uint32_t sequence = valid ? snap.sequence : 0;
+    uint32_t timestamp = valid ? snap.timestamp : 0;
+    uint8_t row[16] = {dev.serverID, dev.functionCode, dataQuality(d, snap, valid, now), 0,
+                       (uint8_t)dev.startRegister, (uint8_t)(dev.startRegister >> 8), (uint8_t)n, (uint8_t)(n >> 8),
+                       (uint8_t)sequence, (uint8_t)(sequence >> 8), (uint8_t)(sequence >> 16), (uint8_t)(sequence >> 24),
+                       (uint8_t)timestamp, (uint8_t)(timestamp >> 8), (uint8_t)(timestamp >> 16), (uint8_t)(timestamp >> 24)};
+    res.write(row, sizeof(row));
+    uint8_t values[2 * MODBUS_MAX_READ_REGISTERS];
+    for (uint16_t i = 0; i < n; ++i)
+    {
+      values[2 * i] = snap.values[i];
+      values[2 * i + 1] = snap.values[i] >> 8;
+    }
+    res.write(values, 2 * n);
+  }
+}
+
+// snapshot of all rows or of the rows of one server: JSON or binary (?format=bin or Accept: application/octet-stream),
+// 304 if the If-None-Match header has the current ETag
+void sendDevices(Request &req, Response &res, uint8_t serverID)
+{
+  uint32_t now = millis();
+  char etag[32];
+  deviceETag(etag, sizeof(etag), serverID, now);
+  res.set("Cache-Control", "no-cache");
+  res.set("ETag", etag);
+  if (strcmp(HttpIfNoneMatchHeader, etag) == 0)
+  {
+    res.sendStatus(304);
+    return;
+  }
+  char format[8];
+  if ((req.query("format", format, sizeof(format)) && strcmp(format, "bin") == 0) ||
+      strstr(HttpAcceptHeader, "application/octet-stream") != NULL)
+    devicesBinary(res, serverID, now);
+  else
+    devicesJson(res, serverID, now);
+}
+
+// GET /api/devices
+void devicesCmd(Request &req, Response &res)
+{
+  sendDevices(req, res, 0);
+}
+
+// GET /api/devices/<server ID>
+void deviceCmd(Request &req, Response &res)
+{
+  char buf[8];
+  char *end;
+  req.route("id", buf, sizeof(buf));
+  uint32_t id = strtoul(buf, &end, 10);
+  if (*end != 0 || id == 0 || id > 247 || findServer(id) == PollScheduler::NO_DEVICE)
+  {
+    res.sendStatus(404);
+    return;
+  }
+  sendDevices(req, res, id);
+}
+
+// clock and CSV output of the benchmarks
+uint32_t benchClock()
+{
+  return micros();
+}
+
+void printBench(void *context, const char *name, uint32_t param, uint32_t iterations, uint32_t totalMicros, uint32_t nanosPerOp)
+{
+  ((Response *)context)->printf("%s,%lu,%lu,%lu,%lu\n", name, (unsigned long)param, (unsigned long)iterations,
+                                (unsigned long)totalMicros, (unsigned long)nanosPerOp);
+}
+
+// GET /bench - CSV of the hot path benchmarks, runs in the web server task (~1 s),
+// loop() and the polling go on in their own task
+void benchCmd(Request &req, Response &res)
+{
+  res.set("Content-Type", "text/csv");
+  res.print("benchmark,param,iterations,total_us,ns_per_op\n");
+  Benchmark bench(&benchClock, &printBench, &res);
+  bench.runAll(BAUDRATE);
+}
+
+// GET /events - text/event-stream, the updates are written by the web server task
+void eventsCmd(Request &req, Response &res)
+{
+  res.set("Content-Type", "text/event-stream");
+  res.set("Cache-Control", "no-cache");
+  res.print("retry: 2000\n\n");
+}
+
+// writes the changes since the cursors of the connection, one event per device:
+//   id: <change sequence>
+//   data: {"id":<server ID>,"dev":<row>,"t":<millis>,"reg":[<address>,...],"val":[<value>,...]}
+// If the socket buffer can't take an event, the cursor stays and the changes
+// are sent later with their newest values, nothing is buffered for the browser.
+bool pushEvents(HttpConnection &conn, EventClient &ec, uint32_t now)
+{
+  static SnapshotData snap;
+  static char text[96 + MODBUS_MAX_READ_REGISTERS * 12]; // worst case: 125 x ",65535" for address and value
+  uint16_t offsets[MODBUS_MAX_READ_REGISTERS];
+  bool sent = false;
+  for (uint16_t d = 0; d < NUM_DEVICES; ++d)
+  {
+    uint32_t cursor = ec.cursor[d];
+    uint16_t n = Changes[d].changedSince(cursor, offsets, MODBUS_MAX_READ_REGISTERS);
+    if (n == 0 || !Snapshots[d].read(snap))
+    {
+      continue;
+    }
+    const ModbusDevice &dev = DEVICES[d];
+    int len = snprintf(text, sizeof(text), "id: %lu\ndata: {\"id\":%u,\"dev\":%u,\"t\":%lu,\"reg\":[",
+                       (unsigned long)cursor, dev.serverID, d, (unsigned long)snap.timestamp);
+    for (uint16_t i = 0; i < n; ++i)
+      len += snprintf(text + len, sizeof(text) - len, i ? ",%u" : "%u", dev.startRegister + offsets[i]);
+    len += snprintf(text + len, sizeof(text) - len, "],\"val\":[");
+    for (uint16_t i = 0; i < n; ++i)
+      len += snprintf(text + len, sizeof(text) - len, i ? ",%u" : "%u", snap.values[offsets[i]]);
+    len += snprintf(text + len, sizeof(text) - len, "]}\n\n");
+
+    if (conn.availableForWrite() < len)
+    {
+      EventsSkipped++;
+      return sent; // try again later, the other devices too
+    }
+    conn.write((const uint8_t *)text, len);
+    ec.cursor[d] = cursor;
+    ec.lastWrite = now;
+    EventsSent++;
+    sent = true;
+  }
+  if (now - ec.lastWrite > EVENT_HEARTBEAT && conn.availableForWrite() > 2)
+  {
+    conn.write((const uint8_t *)":\n\n", 3);
+    ec.lastWrite = now;
+  }
+  return sent;
+}
+
+void httpTask(void *parameter)
+{
+  server.begin();
+  while (true)
+  {
+    uint32_t now = millis();
+    EthernetClient client = server.accept(); // a new connection, returned only once
+    if (client)
+    {
+      uint8_t c = 0;
+      while (c < HTTP_CLIENTS && HttpClients[c].active())
+        ++c;
+      if (c < HTTP_CLIENTS)
+        HttpClients[c].attach(client, now);
+      else
+        client.stop(); // all slots busy
+    }
+    bool served = false;
+    for (uint8_t c = 0; c < HTTP_CLIENTS; ++c)
+    {
+      HttpConnectionHeader[0] = 0;
+      HttpIfNoneMatchHeader[0] = 0;
+      HttpAcceptHeader[0] = 0;
+      if (HttpClients[c].serve(app, HttpConnectionHeader, millis()))
+      {
+        served = true;
+        if (HttpClients[c].eventStream())
+        {
+          memset(&EventClients[c], 0, sizeof(EventClient)); // the first events bring all values
+          EventClients[c].lastWrite = millis();
+        }
+      }
+      else if (HttpClients[c].eventStream())
+      {
+        served |= pushEvents(HttpClients[c], EventClients[c], millis());
+      }
+      HttpClients[c].checkIdle(millis(), HTTP_IDLE_TIMEOUT);
+    }
+    if (!served)
+    {
+      vTaskDelay(pdMS_TO_TICKS(HTTP_POLL_INTERVAL));
+    }
+  }
+}
+
+// FC03/FC04 worker of the Modbus TCP server, never touches the RTU bus
+ModbusMessage gatewayWorker(ModbusMessage request)
+{
+  uint8_t frame[GATEWAY_MAX_RESPONSE];
+  ModbusMessage response;
+  response.add(frame, Gateway.respond(request.data(), request.size(), frame, millis()));
+  return response;
+}
+
+bool getValues(const ModbusMessage &response, uint16_t values[], uint16_t numVal, uint16_t firstValue = 0)
 {
   // First value is on pos 3, after server ID, function code and length byte
-  uint16_t offs = 3;
-  // Read the requested in a loop
-  for (uint8_t i = 0; i < numVal; ++i)
+  uint16_t offs = 3 + firstValue * 2;
+  if (response.size() < offs)
   {
-    offs = response.get(offs, values[i]);
+    return false;
   }
+  // decode all requested registers in one pass
+  return decodeRegisters(response.data() + offs, response.size() - offs, values, numVal);
+}
+
+// the bus was reserved for the read request until now, its guard times are added to the budget
+void budgetCompleted(ModbusBus &bus, uint16_t request)
+{
+  const GuardState &guard = bus.tuner.state(request - bus.first());
+  Budget.completed(request, micros(), guard.guardBefore, guard.guardAfter);
 }
 
 // Define an onData handler function to receive the regular responses
 // Arguments are received response message and the request's token
-void handleData(ModbusMessage response, uint32_t token)
+// The token holds the index of the read request, the response is scattered to all device table rows of this request
+void handleData(ModbusBus &bus, const ModbusMessage &response, uint32_t token)
 {
-  // received ID from active server
-  uint8_t ID;
-  // get server ID from active server
-  ID = response.getServerID();
-  // according to the length of the server data, change the number of values directly
-  if (ID == SERVER1_ID)
+  bus.trace.response(micros(), response.data(), response.size());
+  if (RequestDispatcher::isWrite(token))
   {
-    getValues(response, Server1_values, SERVER1_NUM_VALUES);
+    bus.lanes.completed(PRIORITY_CONTROL, true, millis()); // the echo of the write, nothing to store
+    Budget.writeCompleted(bus.number(), micros());
+    return;
   }
-  if (ID == SERVER2_ID)
+  uint8_t byteCount = response.size() > 2 ? response[2] : 0;
+  int16_t index = Dispatcher.validate(bus.number(), token, response.getServerID(), response.getFunctionCode(), byteCount, response.size());
+  // the request of the token was on the bus until now, even if its response has to be dropped
+  int16_t request = Dispatcher.request(token);
+  if (request != RequestDispatcher::NO_REQUEST && bus.owns(request))
   {
-    getValues(response, Server2_values, SERVER2_NUM_VALUES);
+    budgetCompleted(bus, request);
   }
-  if (ID == SERVER3_ID) // XY-MD02 sensor
+  if (RequestDispatcher::isProbe(token))
   {
-    getValues(response, Server3_values, SERVER3_NUM_VALUES);
+    // any answer of the server (even a dropped one) shows that it is alive again
+    bus.client.setTimeout(MB_TIMEOUT);
+    bus.probeActive = false;
+    if (request != RequestDispatcher::NO_REQUEST)
+    {
+      ALOG("I: ServerID:%i answered the probe, quarantine lifted\n", REQUESTS[request].serverID);
+      Breaker.success(request);
+      Metrics.responseReceived(request, millis());
+    }
+    return; // a probe has only one register, the next regular poll brings the values
   }
-  if (ID == SERVER4_ID) // XY-MD02 sensor
+  bus.lanes.completed(RequestDispatcher::priority(token), index != RequestDispatcher::NO_REQUEST, millis());
+  if (index == RequestDispatcher::NO_REQUEST)
   {
-    getValues(response, Server4_values, SERVER4_NUM_VALUES);
+    ALOG("W: Dropped response token %08X from ServerID:%i FC:%02X size:%u\n",
+         token, response.getServerID(), response.getFunctionCode(), response.size());
+    return;
   }
-  if (ID == SERVER5_ID) // XY-MD02 sensor
+  Breaker.success(index);
+  bus.tuner.responseReceived(index - bus.first(), millis());
+  Metrics.responseReceived(index, millis());
+
+  const uint16_t *tags = Dispatcher.tags(index);
+  for (uint16_t t = 0; t < Dispatcher.numTags(index); ++t)
   {
-    getValues(response, Server5_values, SERVER5_NUM_VALUES);
+    uint16_t d = tags[t];
+    uint16_t *values = Snapshots[d].beginWrite();
+    if (getValues(response, values, DEVICES[d].numValues, TAG_MAP[d].offset))
+    {
+      Snapshots[d].commit(millis(), DEVICES[d].numValues);
+      Changes[d].update(values, DEVICES[d].numValues); // only this task writes the buffer, so it can still be used
+    }
   }
-  if (ID == SERVER6_ID) // XY-MD02 sensor
+}
+
+// writes the formatted log entries to the console
+void logSink(const char *text, size_t length)
+{
+  Serial.write((const uint8_t *)text, length);
+}
+
+// low priority task: the console output is done when nothing else is to do
+void logTask(void *parameter)
+{
+  while (true)
   {
-    getValues(response, Server6_values, SERVER6_NUM_VALUES);
+    if (Log.drain(&logSink) == 0)
+    {
+      vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL));
+    }
   }
 }
 
 // Define an onError handler function to receive error responses
 // Arguments are the error code returned and a user-supplied token to identify the causing request
-void handleError(Error error, uint32_t token)
+void handleError(ModbusBus &bus, Error error, uint32_t token)
 {
+  bus.trace.error(micros(), error);
   // ModbusError wraps the error code and provides a readable error message for it
   ModbusError me(error);
   // LOG_E("Error: %02X - %s ServerID:n/a Time: %8.3fs\n", (int)me, (const char *)me, (millis() - token) / 1000.0);
-  LOG_E("Error: %02X - %s ServerID:%i \n", (int)me, (const char *)me, token);
+  int16_t index = Dispatcher.request(token);
+  ALOG("E: Error: %02X - %s ServerID:%i \n", (int)me, (const char *)me,
+       index != RequestDispatcher::NO_REQUEST ? REQUESTS[index].serverID : 0);
   MB_Errors++;
+  Metrics.error(bus.number(), index, error);
+  if (!RequestDispatcher::isProbe(token))
+  {
+    bus.lanes.completed(RequestDispatcher::priority(token), false, millis()); // probes are not in the lane statistics
+  }
+  if (RequestDispatcher::isWrite(token))
+  {
+    Budget.writeCompleted(bus.number(), micros()); // a failed write reserved the bus as well
+  }
+  if (index == RequestDispatcher::NO_REQUEST)
+  {
+    return;
+  }
+  budgetCompleted(bus, index); // a timeout reserves the bus as well
+
+  if (RequestDispatcher::isProbe(token))
+  {
+    // any answer of the server (even an exception) shows that it is alive again
+    if (error == TIMEOUT || error == CRC_ERROR)
+    {
+      Breaker.timeout(index, millis());
+      bus.scheduler.deferUntil(index - bus.first(), Breaker.state(index).nextProbe);
+    }
+    else
+    {
+      Breaker.success(index);
+    }
+    bus.client.setTimeout(MB_TIMEOUT);
+    bus.probeActive = false;
+    return;
+  }
+
+  // too many timeouts in a row: stop polling, probe it from time to time
+  if (error == TIMEOUT && Breaker.timeout(index, millis()))
+  {
+    bus.scheduler.deferUntil(index - bus.first(), Breaker.state(index).nextProbe);
+  }
+  // a timeout or a disturbed frame is a sign for a too short guard time
+  if (error == TIMEOUT || error == CRC_ERROR)
+  {
+    bus.tuner.busError(index - bus.first());
+  }
+}
+
+// the eModbus callbacks wake the task of the bus, the bus is free for the next request.
+// eModbus removes the request from its queue only after the callback, so pendingRequests()
+// may still count it when the woken task runs: the task checks busFree instead
+void onData(ModbusBus &bus, const ModbusMessage &response, uint32_t token)
+{
+  handleData(bus, response, token);
+  bus.busFree = true;
+  wakeBus(bus, EVENT_RESPONSE);
+}
+
+void onError(ModbusBus &bus, Error error, uint32_t token)
+{
+  handleError(bus, error, token);
+  bus.busFree = true;
+  wakeBus(bus, EVENT_RESPONSE);
+}
+
+// polling task of a bus: the buses are polled in parallel, every task sleeps
+// until the next slot of its bus or until a response or lane request wakes it up
+uint32_t NonBlockingStateMachine(ModbusBus &bus); // defined with the send functions below
+
+void busTask(void *parameter)
+{
+  ModbusBus &bus = *(ModbusBus *)parameter;
+  while (true)
+  {
+    uint32_t sleep = NonBlockingStateMachine(bus);
+    xTaskNotifyWait(0, 0xFFFFFFFF, NULL, pdMS_TO_TICKS(sleep < BUS_MAX_SLEEP ? sleep : BUS_MAX_SLEEP));
+  }
+}
+
+// report timer: printRequests() is done in loop()
+void reportTimer(TimerHandle_t timer)
+{
+  wakeLoop(EVENT_REPORT);
+}
+
+// device table row and offset of a register, false if no device reads it
+bool findTag(uint8_t serverID, uint16_t address, int16_t &device, uint16_t &offset)
+{
+  for (uint16_t d = 0; d < NUM_DEVICES; ++d)
+  {
+    const ModbusDevice &dev = DEVICES[d];
+    if (dev.serverID == serverID && address >= dev.startRegister && address < dev.startRegister + dev.numValues &&
+        TAG_MAP[d].request != RegisterPlanner::NO_REQUEST)
+    {
+      device = d;
+      offset = address - dev.startRegister;
+      return true;
+    }
+  }
+  device = -1;
+  return false;
 }
 
 // Setup() - initialization happens here
+#ifdef REPLAY_BUS
+// reads a trace from the SD card, it stays in memory for the replay
+bool loadTrace(TraceReplay &replay, const char *path)
+{
+  File file = SD.open(path);
+  if (!file)
+  {
+    return false;
+  }
+  size_t size = file.size();
+  uint8_t *buffer = (uint8_t *)(psramFound() ? ps_malloc(size) : malloc(size));
+  bool loaded = buffer != NULL && file.read(buffer, size) == size && replay.begin(buffer, size);
+  file.close();
+  if (!loaded)
+  {
+    free(buffer); // the replay keeps the buffer only if the trace is valid
+  }
+  return loaded;
+}
+#endif
+
 void setup()
 {
   // init M5Stack
@@ -287,8 +1293,8 @@ void setup()
   SPI.begin(SCK, MISO, MOSI, -1);
   Ethernet.init(CS);
 
-  // Set up Serial2 connected to Modbus RTU
-  Serial2.begin(BAUDRATE, SERIAL_8N1);
+  // console output of the time critical code (ALOG) is written by this task
+  xTaskCreatePinnedToCore(logTask, "log", 4096, NULL, tskIDLE_PRIORITY + 1, NULL, tskNO_AFFINITY);
 
   Serial.println("\nPress some serial key or M5 Button B to start program"); // DEBUG
   M5.Lcd.println("Press some serial key or M5 Button B to start program");
@@ -303,21 +1309,109 @@ void setup()
   Serial.println("OK"); // DEBUG
   M5.Lcd.println("OK");
 
-  // Set up ModbusRTU client.
-  // - provide onData handler function
-  MB.onDataHandler(&handleData);
-  // - provide onError handler function
-  MB.onErrorHandler(&handleError);
-  // Set message timeout to 2000ms
-  MB.setTimeout(2500);
-  // Start ModbusRTU background task
-  MB.begin();
+  // rows on a bus that doesn't exist are not polled (RegisterPlanner)
+  for (uint16_t d = 0; d < NUM_DEVICES; ++d)
+  {
+    if (TAG_MAP[d].request == RegisterPlanner::NO_REQUEST)
+    {
+      LOG_E("%s @ID %i: no bus %u, not polled\n", DEVICES[d].name, DEVICES[d].serverID, DEVICES[d].bus);
+    }
+  }
+
+  // deadbands of the change detection, by server ID and register address
+  for (uint16_t b = 0; b < sizeof(DEADBANDS) / sizeof(DEADBANDS[0]); ++b)
+  {
+    const DeadbandConfig &db = DEADBANDS[b];
+    for (uint16_t d = 0; d < NUM_DEVICES; ++d)
+    {
+      const ModbusDevice &dev = DEVICES[d];
+      for (uint32_t reg = db.address; reg < (uint32_t)db.address + db.count; ++reg)
+      {
+        if (dev.serverID == db.serverID && reg >= dev.startRegister && reg < (uint32_t)dev.startRegister + dev.numValues)
+          Changes[d].setDeadband(reg - dev.startRegister, db.deadband);
+      }
+    }
+  }
+
+  // history buffers, in PSRAM if available
+  for (uint16_t h = 0; h < NUM_HISTORY; ++h)
+  {
+    bool found = findTag(HISTORY[h].serverID, HISTORY[h].address, HistoryDevice[h], HistoryOffset[h]);
+    uint8_t *buffer = found ? (uint8_t *)(psramFound() ? ps_malloc(HISTORY_BYTES) : malloc(HISTORY_BYTES)) : NULL;
+    if (!found || !History[h].begin(buffer, HISTORY_BYTES))
+    {
+      LOG_E("No history for ServerID %i register %04X\n", HISTORY[h].serverID, HISTORY[h].address);
+      HistoryDevice[h] = -1; // nothing is recorded
+      free(buffer);
+    }
+  }
+
+  // capture buffers of the traces, in PSRAM if available
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    size_t size = psramFound() ? TRACE_BYTES : TRACE_BYTES / 8;
+    uint8_t *buffer = (uint8_t *)(psramFound() ? ps_malloc(size) : malloc(size));
+    if (!BUSES[b]->trace.begin(buffer, size))
+    {
+      LOG_E("No trace buffer for bus %u\n", b);
+    }
+  }
+#ifdef REPLAY_BUS
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    char path[16];
+    snprintf(path, sizeof(path), "/trace%u.bin", b);
+    if (BUSES[b]->numRequests() > 0 && !loadTrace(*REPLAY_BUSES[b], path))
+    {
+      LOG_E("No trace %s for the replay of bus %u\n", path, b);
+    }
+  }
+#endif
+
+  // Set up the UART and the ModbusRTU client of every bus with devices and start its polling task
+  LoopTask = xTaskGetCurrentTaskHandle(); // setup() and loop() run in the same task
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    ModbusBus *bus = BUSES[b];
+    if (bus->numRequests() == 0)
+    {
+      continue;
+    }
+    bus->begin(
+        BAUDRATE, MB_TIMEOUT,
+        [bus](ModbusMessage response, uint32_t token) { onData(*bus, response, token); },
+        [bus](Error error, uint32_t token) { onError(*bus, error, token); },
+        millis());
+    xTaskCreatePinnedToCore(busTask, "bus", 4096, bus, tskIDLE_PRIORITY + 2, &bus->task, tskNO_AFFINITY);
+  }
+  ReportTimer = xTimerCreate("report", pdMS_TO_TICKS(REPORT_INTERVAL), pdTRUE, NULL, reportTimer);
+  xTimerStart(ReportTimer, 0);
 
   M5.Lcd.setTextSize(2);
+  M5.Lcd.fillScreen(BLACK);
+  // screen layout: counters and one line per display register
+  LcdHeader = Lcd.addField(10, 30, 25);
+  for (uint16_t f = 0; f < NUM_DISPLAY_TAGS; ++f)
+  {
+    LcdFields[f] = Lcd.addField(1, 60 + f * 30, 25);
+    Lcd.print(LcdFields[f], "%-6s ---", DISPLAY_TAGS[f].label); // until the first value arrives
+    if (!findTag(DISPLAY_TAGS[f].serverID, DISPLAY_TAGS[f].address, DisplayDevice[f], DisplayOffset[f]))
+    {
+      LOG_E("No display for ServerID %i register %04X\n", DISPLAY_TAGS[f].serverID, DISPLAY_TAGS[f].address);
+    }
+  }
 
   if (Ethernet.begin(mac))
   {
     Serial.println(Ethernet.localIP());
+
+    // register the gateway worker once for every server ID in the device table
+    for (uint16_t d = 0; d < NUM_DEVICES; ++d)
+    {
+      MBserver.registerWorker(DEVICES[d].serverID, READ_HOLD_REGISTER, &gatewayWorker);
+      MBserver.registerWorker(DEVICES[d].serverID, READ_INPUT_REGISTER, &gatewayWorker);
+    }
+    MBserver.start(MODBUS_TCP_PORT, MODBUS_TCP_CLIENTS, MODBUS_TCP_IDLE_TIMEOUT);
   }
   else
   {
@@ -326,6 +1420,21 @@ void setup()
 
   // mount the handler to the default router
   app.get("/", &indexCmd);
+  app.get("/metrics", &metricsCmd);
+  app.post("/write", &writeCmd);
+  app.post("/poll", &pollCmd);
+  app.get("/history", &historyCmd);
+  app.get("/trace", &traceCmd);
+  app.post("/trace", &traceCaptureCmd);
+  app.get("/events", &eventsCmd);
+  app.get("/bench", &benchCmd);
+  app.get("/api/devices", &devicesCmd);
+  app.get("/api/devices/:id", &deviceCmd);
+  app.header("Connection", HttpConnectionHeader, sizeof(HttpConnectionHeader));
+  app.header("If-None-Match", HttpIfNoneMatchHeader, sizeof(HttpIfNoneMatchHeader));
+  app.header("Accept", HttpAcceptHeader, sizeof(HttpAcceptHeader));
+  HistoryLock = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(httpTask, "http", 8192, NULL, tskIDLE_PRIORITY + 1, NULL, tskNO_AFFINITY);
 
   Serial.println("Mem after settings:");
   Serial.printf("MinFreeHeap %d, MaxAllocHeap %d\n", ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
@@ -338,274 +1447,349 @@ void setup()
 void printRequests()
 {
   // if data is ready
-  Serial.printf("                 Requests %i / Errors %i\n", MB_Requests, MB_Errors);
-  M5.Lcd.setCursor(10, 30);
-  M5.Lcd.printf("Requests %i / Errors %i\n", MB_Requests, MB_Errors);
-
-  Serial.printf("\nRequested from Server1 @ID %2i\n", SERVER1_ID);
-  M5.Lcd.setCursor(1, 60);
-  M5.Lcd.printf("Server1 @ID %2i\n", SERVER1_ID);
-  // Serial.printf("\nRequested from Server1 @ID%2i  Time: %8.3fs\n", SERVER1_ID, request_time1 / 1000.0);
-  // M5.Lcd.setCursor(1, 80);
-  // M5.Lcd.printf("Server1@ID%2i  Time:%8.3fs\n", SERVER1_ID, request_time1 / 1000.0);
-  for (uint8_t i = 0; i < SERVER1_NUM_VALUES; ++i) // DEBUG SHOW ONLY 8 of 50!
-  {
-    if (((i + 1) % 4) == 0) // format print output to 4 collumns @ xx rows
-      Serial.printf("    %04X: %8i\n", i, Server1_values[i]);
-    else
-      Serial.printf("    %04X: %8i", i, Server1_values[i]);
+  ALOG("                 Requests %lu / Errors %lu\n", (unsigned long)MB_Requests.load(), (unsigned long)MB_Errors.load());
+  DispatchStats ds = Dispatcher.stats();
+  ALOG("                 Dropped: stale %lu / server %lu / FC %lu / length %lu / token %lu\n",
+       (unsigned long)ds.stale, (unsigned long)ds.serverMismatch, (unsigned long)ds.functionMismatch,
+       (unsigned long)ds.lengthMismatch, (unsigned long)ds.unknownToken);
+  // wire-time budget: how much of the report interval every bus was used
+  uint32_t cycle = Budget.endCycle(millis());
+  for (uint8_t b = 0; b < MODBUS_MAX_BUSES; ++b)
+  {
+    const BudgetStats &bs = Budget.bus(b);
+    if (BUSES[b]->numRequests() == 0)
+      continue;
+    ALOG("                 Bus %u: %.1f %% used (wire %lu + overhead %lu + guard %lu ms), idle %lu of %lu ms, spare %lu regs/s\n",
+         b, Budget.utilization(b) / 10.0, (unsigned long)(bs.wireTime / 1000),
+         (unsigned long)(bs.busyTime > bs.wireTime ? (bs.busyTime - bs.wireTime) / 1000 : 0),
+         (unsigned long)(bs.guardTime / 1000), (unsigned long)Budget.idleTime(b), (unsigned long)cycle,
+         (unsigned long)Budget.spareRegisters(b));
   }
 
-  Serial.printf("\nRequested from Server2 @ID %2i\n", SERVER2_ID);
-  M5.Lcd.setCursor(1, 90);
-  M5.Lcd.printf("Server2 @ID %2i\n", SERVER2_ID);
-  for (uint8_t i = 0; i < SERVER2_NUM_VALUES; ++i)
+  static SnapshotData snap; // too large for the stack of loop()
+  static uint32_t cursor[NUM_DEVICES];
+  uint16_t offsets[MODBUS_MAX_READ_REGISTERS];
+  for (uint16_t d = 0; d < NUM_DEVICES; ++d)
   {
-    if (((i + 1) % 4) == 0) // format print output to 4 collumns @ xx rows
-      Serial.printf("    %04X: %8i\n", i, Server2_values[i]);
-    else
-      Serial.printf("    %04X: %8i", i, Server2_values[i]);
+    const ModbusDevice &dev = DEVICES[d];
+    // collect the changes first, a newer snapshot only means a newer value
+    uint16_t numChanged = Changes[d].changedSince(cursor[d], offsets, MODBUS_MAX_READ_REGISTERS);
+    if (!Snapshots[d].read(snap))
+    {
+      ALOG("\nNo data from %s @ID %2i\n", dev.name, dev.serverID);
+      continue;
+    }
+    uint32_t changed[DIRTY_WORDS] = {0};
+    for (uint16_t c = 0; c < numChanged; ++c)
+    {
+      changed[offsets[c] / 32] |= 1UL << (offsets[c] % 32);
+    }
+    uint16_t request = TAG_MAP[d].request;
+    ModbusBus &bus = busOf(request);
+    const GuardState &guard = bus.tuner.state(request - bus.first());
+    ALOG("\nRequested from %s @ID %2i bus %u  guard %lu/%lu ms  latency %lu ms (max %lu)  timeouts %lu\n",
+         dev.name, dev.serverID, bus.number(), (unsigned long)guard.guardBefore, (unsigned long)guard.guardAfter,
+         (unsigned long)guard.latency, (unsigned long)guard.maxLatency, (unsigned long)guard.timeouts);
+    ALOG("    snapshot #%lu, %lu ms old, period %lu ms, missed deadlines %lu, state %s, %i changed\n",
+         (unsigned long)snap.sequence, millis() - snap.timestamp, (unsigned long)REQUESTS[request].pollPeriod,
+         (unsigned long)bus.scheduler.missedDeadlines(request - bus.first()), CircuitBreaker::stateName(Breaker.state(request).state),
+         numChanged);
+    const BudgetStats &budget = Budget.request(request);
+    if (budget.transfers > 0)
+    {
+      ALOG("    wire %lu us, turnaround %lu us, overhead %lu us per transfer (%lu transfers)\n",
+           (unsigned long)Budget.wireTime(request), (unsigned long)(budget.busyTime / budget.transfers),
+           (unsigned long)(budget.busyTime > budget.wireTime ? (budget.busyTime - budget.wireTime) / budget.transfers : 0),
+           (unsigned long)budget.transfers);
+    }
+    WORD_ORDER order = (dev.format & FORMAT_WORDSWAP) ? WORD_ORDER_LOW_FIRST : WORD_ORDER_HIGH_FIRST;
+    uint8_t format = dev.format & ~FORMAT_WORDSWAP;
+    if (format == FORMAT_UINT32 || format == FORMAT_INT32 || format == FORMAT_FLOAT32)
+    {
+      for (uint16_t i = 0; i + 1 < snap.numValues; i += 2) // two registers per value
+      {
+        if (REPORT_ONLY_CHANGES && !ChangeDetector::isDirty(changed, i) && !ChangeDetector::isDirty(changed, i + 1))
+          continue;
+        if (format == FORMAT_UINT32)
+          ALOG("    %04X: %10lu\n", i, (unsigned long)registersToUint32(&snap.values[i], order));
+        else if (format == FORMAT_INT32)
+          ALOG("    %04X: %10li\n", i, (long)registersToInt32(&snap.values[i], order));
+        else
+          ALOG("    %04X: %10.3f\n", i, registersToFloat(&snap.values[i], order));
+      }
+      continue;
+    }
+    uint16_t column = 0;
+    for (uint16_t i = 0; i < snap.numValues; ++i)
+    {
+      if (REPORT_ONLY_CHANGES && !ChangeDetector::isDirty(changed, i))
+        continue;
+      if (format == FORMAT_TENTHS)
+        ALOG("    %04X: %5.1f\n", i, snap.values[i] / 10.0);
+      else if ((++column % 4) == 0) // format print output to 4 collumns @ xx rows
+        ALOG("    %04X: %8i\n", i, snap.values[i]);
+      else
+        ALOG("    %04X: %8i", i, snap.values[i]);
+    }
+    if (format != FORMAT_TENTHS && (column % 4) != 0)
+      ALOG("\n");
   }
 
-  Serial.printf("\nRequested from Server3 @ID %2i\n", SERVER3_ID);
-  M5.Lcd.setCursor(1, 120);
-  M5.Lcd.printf("Server3@ ID %2i\n", SERVER3_ID);
-  for (uint8_t i = 0; i < SERVER3_NUM_VALUES; ++i)
+  ALOG("-------------------------------------------\n");
+}
+
+// send the read request <index> of the bus (regular poll or alarm read)
+void sendPoll(ModbusBus &bus, uint16_t index, uint8_t priority)
+{
+  uint16_t request = bus.first() + index;
+  const ModbusDevice &dev = REQUESTS[request];
+  ALOG("Poll %-14s @ID %2i bus %u delay: %lu %s\n", dev.name, dev.serverID, bus.number(), millis() - bus.lastSlot,
+       priority == PRIORITY_BULK ? "" : RequestLanes::className(priority));
+  bus.lastSlot = millis();
+
+  MB_Requests++; // TEST DEBUG
+  bus.tuner.requestSent(index, millis());
+  Metrics.requestSent(request, millis());
+  Budget.requestSent(request, micros());
+  bus.trace.request(micros(), dev.serverID, dev.functionCode, dev.startRegister, dev.numValues);
+  bus.busFree = false;
+  Error err = bus.client.addRequest(Dispatcher.nextToken(request, false, priority), dev.serverID, dev.functionCode, dev.startRegister, dev.numValues);
+  if (err != SUCCESS)
   {
-    Serial.printf("    %04X: %5.1f\n", i, Server3_values[i] / 10.0);
+    bus.busFree = true; // no callback will come
+    bus.trace.error(micros(), err);
+    ModbusError e(err);
+    ALOG("E: Error creating request for ServerID %i: %02X - %s\n", dev.serverID, (int)e, (const char *)e);
   }
+  bus.scheduler.issued(index, millis());
+}
 
-  Serial.printf("\nRequested from Server4 @ID %2i\n", SERVER4_ID);
-  M5.Lcd.setCursor(1, 150);
-  M5.Lcd.printf("Server4 @ID %2i\n", SERVER4_ID);
-  for (uint8_t i = 0; i < SERVER4_NUM_VALUES; ++i) // DEBUG SHOW ONLY 8 of 50!
+// send the waiting control write or alarm read, as soon as the guard time of its device allows it
+// returns the time until the bus is free for it, 0 if it was sent
+uint32_t sendLaneRequest(ModbusBus &bus, const LaneRequest &lane, uint8_t priority)
+{
+  int16_t index = priority == PRIORITY_ALARM ? (int16_t)lane.request : bus.scheduler.findServer(lane.serverID);
+  uint32_t busWait = bus.scheduler.busFreeIn(index, millis());
+  if (busWait > 0)
   {
-    Serial.printf("    %04X: %5.1f\n", i, Server4_values[i] / 10.0);
+    return busWait; // wait, but don't let the bulk polling take the slot
   }
+  uint32_t waitTime = millis() - lane.submitted;
 
-  Serial.printf("\nRequested from Server5 @ID %2i\n", SERVER5_ID);
-  M5.Lcd.setCursor(1, 180);
-  M5.Lcd.printf("Server5 @ID %2i\n", SERVER5_ID);
-  for (uint8_t i = 0; i < SERVER5_NUM_VALUES; ++i) // DEBUG SHOW ONLY 8 of 50!
+  if (priority == PRIORITY_ALARM)
   {
-    if (((i + 1) % 4) == 0) // format print output to 4 collumns @ xx rows
-      Serial.printf("    %04X: %8i\n", i, Server5_values[i]);
-    else
-      Serial.printf("    %04X: %8i", i, Server5_values[i]);
+    if (index >= bus.numRequests() || !Breaker.isClosed(bus.first() + index))
+    {
+      bus.lanes.drop(priority); // quarantined device: the probe decides when it is read again
+      return 0;
+    }
+    sendPoll(bus, index, PRIORITY_ALARM);
+    bus.lanes.sent(PRIORITY_ALARM, waitTime, millis());
+    bus.lanes.pop(priority);
+    return 0;
   }
-  Serial.printf("\nRequested from Server6 @ID %2i\n", SERVER6_ID);
-  M5.Lcd.setCursor(1, 210);
-  M5.Lcd.printf("Server6 @ID %2i\n", SERVER6_ID);
-  for (uint8_t i = 0; i < SERVER6_NUM_VALUES; ++i) // DEBUG SHOW ONLY 8 of 50!
+
+  // control write: FC06 for a single register, FC16 for more
+  uint32_t token = RequestDispatcher::WRITE_FLAG | ((uint32_t)PRIORITY_CONTROL << RequestDispatcher::PRIORITY_SHIFT);
+  Error err;
+  bus.tuner.requestSent(bus.numRequests(), millis()); // not a read request: no guard time to learn
+  uint32_t guardAfter = index != PollScheduler::NO_DEVICE ? bus.scheduler.guardAfter(index) : WRITE_GUARD_AFTER;
+  Budget.writeSent(bus.number(), lane.count == 1 ? WRITE_HOLD_REGISTER : WRITE_MULT_REGISTERS, lane.count,
+                   index != PollScheduler::NO_DEVICE ? bus.scheduler.guardBefore(index) : 0, guardAfter, micros());
+  bus.trace.request(micros(), lane.serverID, lane.count == 1 ? WRITE_HOLD_REGISTER : WRITE_MULT_REGISTERS, lane.address,
+                    lane.count == 1 ? lane.values[0] : lane.count, lane.values);
+  bus.busFree = false;
+  if (lane.count == 1)
+    err = bus.client.addRequest(token, lane.serverID, WRITE_HOLD_REGISTER, lane.address, lane.values[0]);
+  else
+    err = bus.client.addRequest(token, lane.serverID, WRITE_MULT_REGISTERS, lane.address, lane.count, lane.count * 2, (uint16_t *)lane.values);
+  ALOG("Write ServerID %i register %04X (%i values) after %lu ms\n", lane.serverID, lane.address, lane.count, (unsigned long)waitTime);
+  if (err != SUCCESS)
   {
-    if (((i + 1) % 4) == 0) // format print output to 4 collumns @ xx rows
-      Serial.printf("    %04X: %8i\n", i, Server6_values[i]);
-    else
-      Serial.printf("    %04X: %8i", i, Server6_values[i]);
+    bus.busFree = true;
+    bus.trace.error(micros(), err);
+    ModbusError e(err);
+    ALOG("E: Error creating write request for ServerID %i: %02X - %s\n", lane.serverID, (int)e, (const char *)e);
   }
-
-  Serial.printf("-------------------------------------------\n");
+  bus.lanes.sent(PRIORITY_CONTROL, waitTime, millis());
+  bus.lanes.pop(priority);
+  bus.scheduler.occupy(millis(), guardAfter);
+  return 0;
 }
 
-void NonBlockingStateMachine()
+// returns the time [ms] until the next request of the bus can be sent, the bus task sleeps
+// until then or until an event (response, new lane request) wakes it up
+uint32_t NonBlockingStateMachine(ModbusBus &bus)
 {
   /*
- non blocking delayed state machine with constant loop time
- ##########################################################
-
- based on the code from 'GoForSmoke' in the arduino forum
- https://forum.arduino.cc/t/fading-led-up-and-down-with-predetermined-intervals-non-blocking/559601/4
-
-
-                                           STATE MACHINE DIAGRAM
-
-                  Task 1           Task 2             Task 3           Task n
-                 +-----+       +-----------+        +--------+       +-------+
-                 |     |       |           |        |        |       |       |
-                 |     |       |           |        |        |       |       |
-                 |     |       |           |        |        |       |       |
-                 |     |       |           |        |        |       |       |
-                 +     +-------+           +--------+        +-------+       +-----/ /------+
-
-                 |             |                    |                |                      |
-                 |             |                    |                |                      |
-                 |<----------->|<------------------>|<-------------->|<-------------------->|
-                 |                                                                          |
-                 |   State 1          State 2             State 3       State n + last Task |
-                 |                                                                          |
-                 |<------------------------------------------------------------------------>|
-                                        state machine interval time
-
-
-              every state includes some blocking code (Task) and a nonblocking delay
-              the last task fills the gap between runtime and interval time if necessary
+ non blocking table driven poll scheduler
+ ########################################
+
+ replaces the former delayed state machine with one case per device.
+ The PollScheduler computes the next bus slot from the device table:
+ a device is requested if its poll period is over AND the guard time after
+ the last request plus the guard time before this device has elapsed.
+ There is no fixed cycle any more, so no bus time is wasted for padding.
+
+        device 1         device 2            device 3
+       +--------+      +--------+           +--------+
+       |request |      |request |           |request |
+  -----+        +------+        +-----------+        +-----------/ /---
+       |<------------->|<------------------>|
+        guardAfter(1)    guardAfter(2) +
+        + guardBefore(2) guardBefore(3)
 
  */
-  // start of one-shot timer
-  if (STATE_WAIT_DELAY > 0) // one-shot timer only runs when set
+  if (bus.probeActive)
   {
-    if (millis() - STATE_START_DELAY < STATE_WAIT_DELAY)
-    {
-      return; // instead of blocking, the undelayed function returns
-    }
-    else
-    {
-      STATE_WAIT_DELAY = 0; // time's up! turn off the timer and run the STATE_NR case
-    }
+    return BUS_MAX_SLEEP; // the timeout is global for all requests of the bus, so nothing else is sent during a probe
   }
-
-  static unsigned long timer = millis();
-  if (STATE_NR == 0)
+  // only one request at a time is handed to eModbus (FIFO!),
+  // so the highest class always gets the next free bus slot
+  Metrics.queueDepth(bus.number(), bus.client.pendingRequests());
+  if (!bus.busFree)
   {
-    Serial.printf("----- state machine interval: %lu ms\n", millis() - timer);
-    timer = millis();
+    return BUS_MAX_SLEEP; // the response callback wakes the task
+  }
+  if (bus.traceStart)
+  {
+    bus.trace.start(bus.number(), BAUDRATE, micros()); // no request on the bus, nobody else writes the trace
+    bus.traceStart = false;
   }
-  // end of one-shot timer
 
-  switch (STATE_NR) // runs the case numbered in STATE_NR
+  // control writes and alarm reads first
+  uint8_t priority;
+  const LaneRequest *lane = bus.lanes.peek(priority);
+  if (lane != 0)
   {
-  case READ_SENSOR_1:
-    STATE_MACHINE_START = millis(); // start measuring loop time of state machine
+    return sendLaneRequest(bus, *lane, priority);
+  }
 
-    Serial.printf("StateNo:%2i delay: %lu\n", READ_SENSOR_1, millis() - STATE_START_DELAY);
-    STATE_START_DELAY = millis();
+  uint32_t waitTime;
+  int16_t index = bus.scheduler.next(millis(), waitTime);
+  if (index == PollScheduler::NO_DEVICE)
+  {
+    return waitTime; // instead of blocking, the undelayed function returns
+  }
 
-    // put some blocking code always AFTER this line
-    /*
-    MB_Requests++; // TEST DEBUG
-    MB_ERROR1 = MB.addRequest(SERVER1_TOKEN, SERVER1_ID, READ_INPUT_REGISTER, SERVER1_INPUT_REGISTER, SERVER1_NUM_VALUES);
-    if (MB_ERROR1 != SUCCESS)
+  uint16_t request = bus.first() + index;
+  const ModbusDevice &dev = REQUESTS[request];
+  if (!Breaker.isClosed(request))
+  {
+    // quarantined device: a single register with a short timeout
+    ALOG("Probe %-13s @ID %2i\n", dev.name, dev.serverID);
+    bus.probeActive = true;
+    bus.client.setTimeout(PROBE_TIMEOUT);
+    Breaker.probeSent(request);
+    Metrics.requestSent(request, millis());
+    Budget.requestSent(request, micros());
+    bus.trace.request(micros(), dev.serverID, dev.functionCode, dev.startRegister, 1);
+    bus.busFree = false;
+    Error err = bus.client.addRequest(Dispatcher.nextToken(request, true, PRIORITY_BULK), dev.serverID, dev.functionCode, dev.startRegister, 1);
+    if (err != SUCCESS)
     {
-      ModbusError e(MB_ERROR1);
-      LOG_E("Error creating request: %02X - %s\n", (int)e, (const char *)e);
+      bus.busFree = true;
+      bus.trace.error(micros(), err);
+      bus.client.setTimeout(MB_TIMEOUT);
+      bus.probeActive = false;
     }
-    */
-    // end of blocking code
-
-    STATE_WAIT_DELAY = DELAY_AFTER_STATE_1; // for the next DELAY_AFTER_STATE_1, this function will return on entry.
-    STATE_NR++;                             // when the switch-case runs again it will be the next case that runs
-    break;                                  // exit switch-case
+    bus.scheduler.issued(index, millis());
+    return 0;
+  }
+  sendPoll(bus, index, PRIORITY_BULK);
+  bus.lanes.sent(PRIORITY_BULK, bus.scheduler.lateness(index), millis());
+  return 0;
+}
 
-  case READ_SENSOR_2:
-    Serial.printf("StateNo:%2i delay: %lu\n", READ_SENSOR_2, millis() - STATE_START_DELAY);
-    STATE_START_DELAY = millis();
 
-    MB_Requests++; // TEST DEBUG
-    MB_ERROR2 = MB.addRequest(SERVER2_TOKEN, SERVER2_ID, READ_HOLD_REGISTER, SERVER2_HOLD_REGISTER, SERVER2_NUM_VALUES);
-    if (MB_ERROR2 != SUCCESS)
+// append new values of the history registers
+void recordHistory()
+{
+  static uint32_t lastSequence[NUM_HISTORY];
+  xSemaphoreTake(HistoryLock, portMAX_DELAY); // a /history query holds it only for one chunk
+  for (uint16_t h = 0; h < NUM_HISTORY; ++h)
+  {
+    int16_t d = HistoryDevice[h];
+    if (d < 0 || Snapshots[d].sequence() == lastSequence[h])
     {
-      ModbusError e(MB_ERROR2);
-      LOG_E("Error creating request2: %02X - %s\n", (int)e, (const char *)e);
+      continue;
     }
-
-    STATE_WAIT_DELAY = DELAY_AFTER_STATE_2;
-    STATE_NR++;
-    break;
-
-  case READ_SENSOR_3:
-    Serial.printf("StateNo:%2i delay: %lu\n", READ_SENSOR_3, millis() - STATE_START_DELAY);
-    STATE_START_DELAY = millis();
-
-    MB_Requests++; // TEST DEBUG
-    MB_ERROR3 = MB.addRequest(SERVER3_TOKEN, SERVER3_ID, READ_INPUT_REGISTER, SERVER3_INPUT_REGISTER, SERVER3_NUM_VALUES);
-    if (MB_ERROR3 != SUCCESS)
+    lastSequence[h] = Snapshots[d].sequence();
+    uint16_t value;
+    uint32_t timestamp;
+    if (Snapshots[d].read(HistoryOffset[h], 1, &value, &timestamp))
     {
-      ModbusError e(MB_ERROR3);
-      LOG_E("Error creating request3: %02X - %s\n", (int)e, (const char *)e);
+      History[h].append(timestamp, value);
     }
+  }
+  xSemaphoreGive(HistoryLock);
+}
 
-    STATE_WAIT_DELAY = DELAY_AFTER_STATE_3;
-    STATE_NR++;
-    break;
-
-  case READ_SENSOR_4:
-    Serial.printf("StateNo:%2i delay: %lu\n", READ_SENSOR_4, millis() - STATE_START_DELAY);
-    STATE_START_DELAY = millis();
-    /*
-        MB_Requests++; // TEST DEBUG
-        MB_ERROR4 = MB.addRequest(SERVER4_TOKEN, SERVER4_ID, READ_INPUT_REGISTER, SERVER4_INPUT_REGISTER, SERVER4_NUM_VALUES);
-        if (MB_ERROR4 != SUCCESS)
-        {
-          ModbusError e(MB_ERROR4);
-          LOG_E("Error creating request3: %02X - %s\n", (int)e, (const char *)e);
-        }
-    */
-    STATE_WAIT_DELAY = DELAY_AFTER_STATE_4;
-    STATE_NR++;
-    break;
-
-  case READ_SENSOR_5:
-    Serial.printf("StateNo:%2i delay: %lu\n", READ_SENSOR_5, millis() - STATE_START_DELAY);
-    STATE_START_DELAY = millis();
-    /*
-        MB_Requests++; // TEST DEBUG
-        MB_ERROR5 = MB.addRequest(SERVER5_TOKEN, SERVER5_ID, READ_HOLD_REGISTER, SERVER5_HOLD_REGISTER, SERVER5_NUM_VALUES);
-        if (MB_ERROR5 != SUCCESS)
-        {
-          ModbusError e(MB_ERROR5);
-          LOG_E("Error creating request2: %02X - %s\n", (int)e, (const char *)e);
-        }
-    */
-    STATE_WAIT_DELAY = DELAY_AFTER_STATE_5;
-    STATE_NR++;
-    break;
-
-  case READ_SENSOR_6:
-    Serial.printf("StateNo:%2i delay: %lu\n", READ_SENSOR_6, millis() - STATE_START_DELAY);
-    STATE_START_DELAY = millis();
-    /*
-        MB_Requests++; // TEST DEBUG
-        MB_ERROR6 = MB.addRequest(SERVER6_TOKEN, SERVER6_ID, READ_HOLD_REGISTER, SERVER6_HOLD_REGISTER, SERVER6_NUM_VALUES);
-        if (MB_ERROR6 != SUCCESS)
-        {
-          ModbusError e(MB_ERROR6);
-          LOG_E("Error creating request2: %02X - %s\n", (int)e, (const char *)e);
-        }
-    */
-    STATE_WAIT_DELAY = DELAY_AFTER_STATE_6;
-    STATE_NR++;
-    break;
-
-  case LAST_TASK:
-    // End of state machine loop --> do some other stuff!
-    // E.g. send all the collected values via MQTT or something similar to an upper layer/server
-    // ---------------------------------------------------
-    printRequests();
-
-    // fill up the gap between runntime and looptime if necessary
-    STATE_MACHINE_END = millis() - STATE_MACHINE_START; // calculate running time of state machine
-    // be careful: Serial.println() takes about 3ms (at least with wokwi.com online sim) - so timing is not very accurate
-    //      Serial.printf("[%s] Last task %2i delay: %i  time left:%i\n",
-    //                     runtime(), LAST_TASK, millis() - STATE_START_DELAY, STATE_MACHINE_INTERVAL - STATE_MACHINE_END);
-    STATE_START_DELAY = millis();
+// draws one changed field of the LcdView
+void lcdDraw(uint16_t x, uint16_t y, const char *text)
+{
+  M5.Lcd.setCursor(x, y);
+  M5.Lcd.setTextColor(WHITE, BLACK); // the background overwrites the old text
+  M5.Lcd.print(text);
+}
 
-    Serial.printf("Looptime state machine: %lu ms\n", STATE_MACHINE_END);
-    if (STATE_MACHINE_END <= STATE_MACHINE_INTERVAL) // if runtime smaller than looptime of state machine
+// prints the current values into the fields, only changed texts reach the LCD
+void updateDisplay()
+{
+  Lcd.print(LcdHeader, "Requests %lu / Errors %lu", (unsigned long)MB_Requests.load(), (unsigned long)MB_Errors.load());
+  // only the registers changed since the last update are read and formatted again,
+  // the display is the consumer of the dirty bitmaps of the change detection
+  uint32_t dirty[DIRTY_WORDS];
+  for (uint16_t d = 0; d < NUM_DEVICES; ++d)
+  {
+    bool displayed = false;
+    for (uint16_t f = 0; f < NUM_DISPLAY_TAGS; ++f)
     {
-      STATE_WAIT_DELAY = STATE_MACHINE_INTERVAL - STATE_MACHINE_END;
-      // be careful: Serial.println() takes about 3ms (at least with wokwi.com online sim) - so timing is not very accurate
-      //        Serial.printf("compensate time: %i ms\n", STATE_WAIT_DELAY);
+      displayed = displayed || DisplayDevice[f] == d;
     }
-    else
+    if (!displayed)
     {
-      STATE_WAIT_DELAY = 0;
-      Serial.printf("WARNING: blocking code took longer (%lu ms) than overall interval (%i ms) !\n",
-                    STATE_MACHINE_END - STATE_MACHINE_INTERVAL, STATE_MACHINE_INTERVAL);
+      continue;
+    }
+    Changes[d].takeDirty(dirty);
+    for (uint16_t f = 0; f < NUM_DISPLAY_TAGS; ++f)
+    {
+      uint16_t value;
+      if (DisplayDevice[f] != d || !ChangeDetector::isDirty(dirty, DisplayOffset[f]) ||
+          !Snapshots[d].read(DisplayOffset[f], 1, &value, NULL))
+        continue;
+      if ((DEVICES[d].format & ~FORMAT_WORDSWAP) == FORMAT_TENTHS)
+        Lcd.print(LcdFields[f], "%-6s %7.1f", DISPLAY_TAGS[f].label, value / 10.0);
+      else
+        Lcd.print(LcdFields[f], "%-6s %7u", DISPLAY_TAGS[f].label, value);
     }
-    STATE_NR = 0; // finish, start again
-    break;
+  }
+  unsigned long start = micros();
+  if (Lcd.render(millis(), &lcdDraw) && micros() - start > LcdRenderMax)
+  {
+    LcdRenderMax = micros() - start;
   }
 }
 
-// loop() - cyclically request the data
+// loop() - history, display and report of the data
+// The buses are polled by their own tasks (busTask), the loop sleeps until the report timer
+// wakes it up, LOOP_MAX_SLEEP limits the sleep for the display and the history.
 void loop()
 {
+  unsigned long loopStart = millis();
   M5.update();
-  NonBlockingStateMachine();
-  EthernetClient client = server.available();
-  if (client.connected())
+  recordHistory();
+  updateDisplay();
+
+  // End of a report interval --> do some other stuff!
+  // E.g. send all the collected values via MQTT or something similar to an upper layer/server
+  static uint32_t events = 0;
+  if (events & EVENT_REPORT)
   {
-    app.process(&client);
-    client.stop();
+    printRequests();
   }
-}
\ No newline at end of file
+  Metrics.loopTime(millis() - loopStart);
+
+  events = 0;
+  xTaskNotifyWait(0, 0xFFFFFFFF, &events, pdMS_TO_TICKS(LOOP_MAX_SLEEP));
+}
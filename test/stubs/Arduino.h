@@ -0,0 +1,56 @@
+/*
+Arduino core stub for the native test environment
+
+millis() and micros() are a fake clock which only the tests advance
+(FakeClock), Serial prints to stdout. Only what the tested modules and
+the tests use is stubbed.
+
+customized by Armin Pressler 2022
+*/
+#ifndef ARDUINO_STUB_H
+#define ARDUINO_STUB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+class FakeClock
+{
+public:
+  static void set(uint32_t ms) { _micros = (uint64_t)ms * 1000; }
+  static void setMicros(uint64_t us) { _micros = us; }
+  static void advance(uint32_t ms) { _micros += (uint64_t)ms * 1000; }
+  static void advanceMicros(uint32_t us) { _micros += us; }
+  static uint32_t millis() { return (uint32_t)(_micros / 1000); } // wraps like on the ESP32
+  static uint32_t micros() { return (uint32_t)_micros; }
+
+protected:
+  static inline uint64_t _micros = 0;
+};
+
+inline unsigned long millis() { return FakeClock::millis(); }
+inline unsigned long micros() { return FakeClock::micros(); }
+inline void delay(uint32_t ms) { FakeClock::advance(ms); }
+
+class HardwareSerial
+{
+public:
+  void begin(unsigned long, uint32_t = 0, int8_t = -1, int8_t = -1) {}
+  size_t write(uint8_t c) { return fputc(c, stdout) != EOF ? 1 : 0; }
+  size_t print(const char *s) { return fputs(s, stdout) >= 0 ? strlen(s) : 0; }
+  size_t println(const char *s = "") { return print(s) + print("\n"); }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+  {
+    va_list args;
+    va_start(args, format);
+    int n = vprintf(format, args);
+    va_end(args);
+    return n > 0 ? n : 0;
+  }
+};
+
+inline HardwareSerial Serial;
+
+#endif
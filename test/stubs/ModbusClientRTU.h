@@ -0,0 +1,129 @@
+/*
+eModbus ModbusClientRTU stub for the native test environment
+
+The RTU servers behind the stub are a SimulatedBus. There is no worker task:
+the test calls process() which transfers the oldest queued request, advances
+the FakeClock by its transfer time and calls onData/onError. Like eModbus the
+request is removed from the queue only after the callback, so it is still
+counted by pendingRequests() inside the callback.
+
+customized by Armin Pressler 2022
+*/
+#ifndef MODBUS_CLIENT_RTU_STUB_H
+#define MODBUS_CLIENT_RTU_STUB_H
+
+#include <Arduino.h>
+#include <deque>
+#include "ModbusMessage.h"
+#include "SimulatedBus.h"
+
+class ModbusClientRTU
+{
+public:
+  explicit ModbusClientRTU(HardwareSerial &, int8_t = -1, uint16_t queueLimit = 100)
+      : _bus(0),
+        _queueLimit(queueLimit),
+        _timeout(2000)
+  {
+  }
+
+  void attach(SimulatedBus &bus) { _bus = &bus; } // servers behind the client
+  void begin(int = -1) {}
+  void setTimeout(uint32_t timeout) { _timeout = timeout; }
+  bool onDataHandler(MBOnData handler)
+  {
+    _onData = handler;
+    return true;
+  }
+  bool onErrorHandler(MBOnError handler)
+  {
+    _onError = handler;
+    return true;
+  }
+  uint32_t pendingRequests() const { return _queue.size(); }
+
+  Error addRequest(uint32_t token, uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2)
+  {
+    return addRequest(token, serverID, functionCode, p1, p2, 0, 0);
+  }
+
+  Error addRequest(uint32_t token, uint8_t serverID, uint8_t functionCode, uint16_t p1, uint16_t p2, uint8_t count,
+                   uint16_t *values)
+  {
+    if (serverID == 0 || serverID > 247)
+    {
+      return INVALID_SERVER;
+    }
+    if (functionCode == WRITE_MULT_REGISTERS && (values == 0 || count != p2 * 2))
+    {
+      return PARAMETER_LIMIT_ERROR;
+    }
+    if (_queue.size() >= _queueLimit)
+    {
+      return REQUEST_QUEUE_FULL;
+    }
+    Request request = {token, _timeout, serverID, functionCode, p1, p2, {}};
+    for (uint16_t i = 0; functionCode == WRITE_MULT_REGISTERS && i < p2; ++i)
+    {
+      request.values.push_back(values[i]);
+    }
+    _queue.push_back(request);
+    return SUCCESS;
+  }
+
+  // transfers the oldest request, false if the queue is empty
+  bool process()
+  {
+    if (_queue.empty() || _bus == 0)
+    {
+      return false;
+    }
+    const Request &request = _queue.front();
+    uint8_t frame[3 + 2 * MODBUS_MAX_READ_REGISTERS];
+    uint16_t length;
+    SIM_RESULT result;
+    uint32_t time = _bus->transfer(request.serverID, request.functionCode, request.p1, request.p2,
+                                   request.values.data(), millis(), request.timeout, frame, length, result);
+    FakeClock::advance(time);
+
+    if (result != SIM_OK)
+    {
+      if (_onError)
+        _onError(result == SIM_TIMEOUT ? TIMEOUT : CRC_ERROR, request.token);
+    }
+    else if (frame[1] & 0x80)
+    {
+      if (_onError)
+        _onError((Error)frame[2], request.token); // exception response
+    }
+    else if (_onData)
+    {
+      ModbusMessage response;
+      response.add(frame, length);
+      _onData(response, request.token);
+    }
+    _queue.pop_front();
+    return true;
+  }
+
+protected:
+  struct Request
+  {
+    uint32_t token;
+    uint32_t timeout;
+    uint8_t serverID;
+    uint8_t functionCode;
+    uint16_t p1;
+    uint16_t p2;
+    std::vector<uint16_t> values;
+  };
+
+  SimulatedBus *_bus;
+  uint16_t _queueLimit;
+  uint32_t _timeout;
+  MBOnData _onData;
+  MBOnError _onError;
+  std::deque<Request> _queue;
+};
+
+#endif
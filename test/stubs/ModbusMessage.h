@@ -0,0 +1,50 @@
+/*
+eModbus ModbusMessage stub for the native test environment
+
+customized by Armin Pressler 2022
+*/
+#ifndef MODBUS_MESSAGE_STUB_H
+#define MODBUS_MESSAGE_STUB_H
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include "ModbusTypes.h"
+
+class ModbusMessage
+{
+public:
+  const uint8_t *data() const { return _data.data(); }
+  uint16_t size() const { return _data.size(); }
+  uint8_t operator[](uint16_t index) const { return index < _data.size() ? _data[index] : 0; }
+  uint8_t getServerID() const { return (*this)[0]; }
+  uint8_t getFunctionCode() const { return (*this)[1]; }
+  Error getError() const { return (getFunctionCode() & 0x80) ? (Error)(*this)[2] : SUCCESS; }
+  void clear() { _data.clear(); }
+
+  uint16_t add(const uint8_t *data, uint16_t length)
+  {
+    _data.insert(_data.end(), data, data + length);
+    return _data.size();
+  }
+
+  // big endian value at index like eModbus, returns the index behind it
+  template <class T>
+  uint16_t get(uint16_t index, T &value) const
+  {
+    value = 0;
+    for (uint16_t i = 0; i < sizeof(T) && index < _data.size(); ++i)
+    {
+      value = (value << 8) | _data[index++];
+    }
+    return index;
+  }
+
+protected:
+  std::vector<uint8_t> _data;
+};
+
+typedef std::function<void(ModbusMessage, uint32_t)> MBOnData;
+typedef std::function<void(Error, uint32_t)> MBOnError;
+
+#endif
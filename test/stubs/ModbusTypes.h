@@ -0,0 +1,35 @@
+/*
+eModbus types stub for the native test environment (codes like eModbus)
+
+customized by Armin Pressler 2022
+*/
+#ifndef MODBUS_TYPES_STUB_H
+#define MODBUS_TYPES_STUB_H
+
+#include <stdint.h>
+
+enum FunctionCode : uint8_t
+{
+  READ_HOLD_REGISTER = 0x03,
+  READ_INPUT_REGISTER = 0x04,
+  WRITE_HOLD_REGISTER = 0x06,
+  WRITE_MULT_REGISTERS = 0x10,
+};
+
+enum Error : uint8_t
+{
+  SUCCESS = 0x00,
+  ILLEGAL_FUNCTION = 0x01,
+  ILLEGAL_DATA_ADDRESS = 0x02,
+  ILLEGAL_DATA_VALUE = 0x03,
+  SERVER_DEVICE_FAILURE = 0x04,
+  GATEWAY_TARGET_NO_RESP = 0x0B,
+  TIMEOUT = 0xE0,
+  INVALID_SERVER = 0xE1,
+  CRC_ERROR = 0xE2,
+  PARAMETER_LIMIT_ERROR = 0xE7,
+  REQUEST_QUEUE_FULL = 0xE8,
+  UNDEFINED_ERROR = 0xFF,
+};
+
+#endif
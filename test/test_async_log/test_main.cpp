@@ -0,0 +1,140 @@
+/*
+Tests of the AsyncLog: format walker, truncation and dropped entries
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "AsyncLog.h"
+
+static AsyncLog *logger;
+static std::vector<std::string> lines;
+
+static void sink(const char *text, size_t length)
+{
+  lines.push_back(std::string(text, length));
+}
+
+void setUp(void)
+{
+  logger = new AsyncLog();
+  lines.clear();
+}
+
+void tearDown(void)
+{
+  delete logger;
+}
+
+// writes and formats one entry, the text is in lines.back()
+template <typename... Args>
+static void logOne(const char *format, Args... args)
+{
+  TEST_ASSERT_TRUE(logger->write(format, args...));
+  TEST_ASSERT_EQUAL_UINT32(1, logger->drain(&sink));
+}
+
+static void assertLine(const char *expected)
+{
+  TEST_ASSERT_EQUAL_UINT32(strlen(expected), lines.back().size());
+  TEST_ASSERT_EQUAL_STRING_LEN(expected, lines.back().c_str(), strlen(expected));
+}
+
+void test_integer_conversions(void)
+{
+  logOne("Poll delay: %lu ms", (unsigned long)4000000000UL);
+  assertLine("Poll delay: 4000000000 ms");
+  logOne("%i %d %ld %u", -5, (int16_t)-7, -100000L, (uint8_t)200);
+  assertLine("-5 -7 -100000 200");
+  logOne("token %08X %02x", 0xBEEFu, (uint8_t)0x0A);
+  assertLine("token 0000BEEF 0a");
+  logOne("%c%c", 'o', 'k');
+  assertLine("ok");
+}
+
+void test_float_conversions(void)
+{
+  logOne("T=%5.1f H=%.2f", 21.54, 48.25f); // float arguments are stored as double
+  assertLine("T= 21.5 H=48.25");
+  logOne("%8.3fs", 1.5);
+  assertLine("   1.500s");
+}
+
+void test_string_conversions(void)
+{
+  const char *name = "Temp_Hum";
+  logOne("Poll %-14s @ID %2i", name, 1);
+  assertLine("Poll Temp_Hum       @ID  1");
+  logOne("[%5s] %s", "ab", (const char *)0);
+  assertLine("[   ab] (null)");
+}
+
+void test_percent_and_missing_args(void)
+{
+  logOne("load 50%% of %d%%", 8);
+  assertLine("load 50% of 8%");
+  logOne("no value: %d");
+  assertLine("no value: 0");
+}
+
+void test_line_truncation(void)
+{
+  LogEntry entry;
+  entry.format = "%s and more";
+  entry.numArgs = 1;
+  entry.args[0].p = "0123456789";
+  char text[8];
+  TEST_ASSERT_EQUAL_UINT32(7, AsyncLog::format(entry, text, sizeof(text)));
+  TEST_ASSERT_EQUAL_STRING_LEN("0123456", text, 8);
+
+  entry.format = "0123456789";
+  entry.numArgs = 0;
+  TEST_ASSERT_EQUAL_UINT32(7, AsyncLog::format(entry, text, sizeof(text)));
+  TEST_ASSERT_EQUAL_STRING_LEN("0123456", text, 8);
+
+  // drain() formats into a line buffer of 160 characters
+  static char longName[400];
+  memset(longName, 'x', sizeof(longName) - 1);
+  logOne("%s|", (const char *)longName);
+  TEST_ASSERT_EQUAL_UINT32(159, lines.back().size());
+  TEST_ASSERT_EQUAL_UINT8('x', lines.back()[158]);
+}
+
+void test_full_ring_drops(void)
+{
+  for (uint32_t n = 0; n < LOG_QUEUE_SIZE; ++n)
+  {
+    TEST_ASSERT_TRUE(logger->write("line %u", n));
+  }
+  TEST_ASSERT_FALSE(logger->write("lost"));
+  TEST_ASSERT_FALSE(logger->write("lost too"));
+  TEST_ASSERT_EQUAL_UINT32(2, logger->dropped());
+
+  TEST_ASSERT_EQUAL_UINT32(LOG_QUEUE_SIZE, logger->drain(&sink));
+  TEST_ASSERT_EQUAL_UINT32(LOG_QUEUE_SIZE, logger->written());
+  TEST_ASSERT_EQUAL_STRING_LEN("line 0", lines.front().c_str(), 7);
+  char last[16];
+  snprintf(last, sizeof(last), "line %u", LOG_QUEUE_SIZE - 1);
+  assertLine(last);
+
+  // room again after draining, the order is kept
+  TEST_ASSERT_TRUE(logger->write("again %d", 1));
+  TEST_ASSERT_EQUAL_UINT32(1, logger->drain(&sink));
+  assertLine("again 1");
+  TEST_ASSERT_EQUAL_UINT32(2, logger->dropped());
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_integer_conversions);
+  RUN_TEST(test_float_conversions);
+  RUN_TEST(test_string_conversions);
+  RUN_TEST(test_percent_and_missing_args);
+  RUN_TEST(test_line_truncation);
+  RUN_TEST(test_full_ring_drops);
+  return UNITY_END();
+}
@@ -0,0 +1,111 @@
+/*
+Host run of the hot path benchmarks (same suite as GET /bench)
+
+pio test -e native -f test_benchmark prints the CSV and writes it to
+benchmark.csv in the project directory. The rows come in a fixed order
+with fixed parameters, so two runs (e.g. before and after a change) can be
+compared with diff or a spreadsheet. The native build has room for 512
+requests (POLL_MAX_DEVICES), so dispatch and schedule run up to 512.
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "Benchmark.h"
+#include "PollScheduler.h"
+
+#define BAUDRATE 9600
+#define CSV_FILE "benchmark.csv"
+#define CSV_HEADER "benchmark,param,iterations,total_us,ns_per_op"
+
+struct BenchRow
+{
+  std::string name;
+  uint32_t param;
+  uint32_t iterations;
+  uint32_t totalMicros;
+  uint32_t nanosPerOp;
+};
+
+static uint32_t hostClock()
+{
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void collect(void *context, const char *name, uint32_t param, uint32_t iterations, uint32_t totalMicros,
+                    uint32_t nanosPerOp)
+{
+  ((std::vector<BenchRow> *)context)->push_back({name, param, iterations, totalMicros, nanosPerOp});
+}
+
+static void writeCsv(FILE *file, const std::vector<BenchRow> &rows)
+{
+  fprintf(file, "%s\n", CSV_HEADER);
+  for (const BenchRow &r : rows)
+  {
+    fprintf(file, "%s,%lu,%lu,%lu,%lu\n", r.name.c_str(), (unsigned long)r.param, (unsigned long)r.iterations,
+            (unsigned long)r.totalMicros, (unsigned long)r.nanosPerOp);
+  }
+}
+
+static std::vector<uint32_t> params(const std::vector<BenchRow> &rows, const char *name)
+{
+  std::vector<uint32_t> result;
+  for (const BenchRow &r : rows)
+  {
+    if (r.name == name)
+      result.push_back(r.param);
+  }
+  return result;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_run_all(void)
+{
+  std::vector<BenchRow> rows;
+  Benchmark bench(&hostClock, &collect, &rows);
+  bench.runAll(BAUDRATE);
+
+  writeCsv(stdout, rows);
+  FILE *file = fopen(CSV_FILE, "w");
+  TEST_ASSERT_NOT_NULL(file);
+  writeCsv(file, rows);
+  fclose(file);
+
+  std::vector<uint32_t> sizes;
+  for (uint32_t n : {1, 8, 32, 64, 128, 256, 512})
+  {
+    if (n <= POLL_MAX_DEVICES)
+      sizes.push_back(n);
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(256, sizes.back()); // hundreds of requests (-DPOLL_MAX_DEVICES=512)
+  TEST_ASSERT_TRUE(params(rows, "dispatch") == sizes);
+  TEST_ASSERT_TRUE(params(rows, "schedule") == sizes);
+  TEST_ASSERT_EQUAL(6, params(rows, "decode").size());
+  TEST_ASSERT_EQUAL(1, params(rows, "sim_cycle").size());
+  for (const BenchRow &r : rows)
+  {
+    TEST_ASSERT_GREATER_THAN(0, r.iterations);
+  }
+  // bus time of a request at 9600 baud: at least the wire time of 8 + 45 characters
+  const BenchRow &wire = rows.back();
+  TEST_ASSERT_TRUE(wire.name == "sim_wire");
+  TEST_ASSERT_GREATER_THAN(53UL * 1041 * 1000, wire.nanosPerOp);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_run_all);
+  return UNITY_END();
+}
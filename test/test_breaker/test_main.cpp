@@ -0,0 +1,121 @@
+/*
+Tests of the CircuitBreaker: quarantine, probe backoff and recovery
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include "CircuitBreaker.h"
+
+static CircuitBreaker breaker;
+
+void setUp(void)
+{
+  breaker = CircuitBreaker();
+}
+
+void tearDown(void)
+{
+}
+
+// quarantine device 0 at 'now'
+static void quarantine(uint32_t now)
+{
+  for (uint16_t n = 0; n < BREAKER_THRESHOLD; ++n)
+  {
+    breaker.timeout(0, now);
+  }
+}
+
+void test_threshold_opens_breaker(void)
+{
+  for (uint16_t n = 1; n < BREAKER_THRESHOLD; ++n)
+  {
+    TEST_ASSERT_FALSE(breaker.timeout(0, 1000));
+    TEST_ASSERT_TRUE(breaker.isClosed(0));
+  }
+  TEST_ASSERT_TRUE(breaker.timeout(0, 1000));
+  TEST_ASSERT_FALSE(breaker.isClosed(0));
+  TEST_ASSERT_EQUAL_UINT8(BREAKER_OPEN, breaker.state(0).state);
+  TEST_ASSERT_EQUAL_UINT32(BREAKER_BACKOFF_MIN, breaker.state(0).backoff);
+  TEST_ASSERT_EQUAL_UINT32(1000 + BREAKER_BACKOFF_MIN, breaker.state(0).nextProbe);
+  TEST_ASSERT_EQUAL_UINT32(1, breaker.state(0).quarantines);
+  TEST_ASSERT_TRUE(breaker.isClosed(1)); // the other devices are not affected
+}
+
+void test_success_resets_error_count(void)
+{
+  for (uint16_t n = 1; n < BREAKER_THRESHOLD; ++n)
+  {
+    breaker.timeout(0, 0);
+  }
+  breaker.success(0);
+  for (uint16_t n = 1; n < BREAKER_THRESHOLD; ++n)
+  {
+    TEST_ASSERT_FALSE(breaker.timeout(0, 0));
+  }
+  TEST_ASSERT_TRUE(breaker.isClosed(0));
+}
+
+void test_backoff_doubles_up_to_cap(void)
+{
+  uint32_t now = 0;
+  quarantine(now);
+  uint32_t expected = BREAKER_BACKOFF_MIN;
+  for (uint16_t n = 0; n < 20; ++n)
+  {
+    now = breaker.state(0).nextProbe;
+    breaker.probeSent(0);
+    TEST_ASSERT_EQUAL_UINT8(BREAKER_PROBING, breaker.state(0).state);
+    TEST_ASSERT_TRUE(breaker.timeout(0, now));
+    expected = expected * 2 > BREAKER_BACKOFF_MAX ? BREAKER_BACKOFF_MAX : expected * 2;
+    TEST_ASSERT_EQUAL_UINT8(BREAKER_OPEN, breaker.state(0).state);
+    TEST_ASSERT_EQUAL_UINT32(expected, breaker.state(0).backoff);
+    TEST_ASSERT_EQUAL_UINT32(now + expected, breaker.state(0).nextProbe);
+  }
+  TEST_ASSERT_EQUAL_UINT32(BREAKER_BACKOFF_MAX, breaker.state(0).backoff);
+  TEST_ASSERT_EQUAL_UINT32(20, breaker.state(0).probes);
+  TEST_ASSERT_EQUAL_UINT32(1, breaker.state(0).quarantines);
+}
+
+void test_probe_success_closes(void)
+{
+  quarantine(0);
+  breaker.probeSent(0);
+  breaker.timeout(0, BREAKER_BACKOFF_MIN); // first probe lost
+  breaker.probeSent(0);
+  breaker.success(0);
+  TEST_ASSERT_TRUE(breaker.isClosed(0));
+  TEST_ASSERT_EQUAL_UINT16(0, breaker.state(0).consecutiveErrors);
+  TEST_ASSERT_EQUAL_UINT32(0, breaker.state(0).backoff);
+
+  // a new quarantine starts again with the shortest backoff
+  quarantine(100000);
+  TEST_ASSERT_EQUAL_UINT32(BREAKER_BACKOFF_MIN, breaker.state(0).backoff);
+  TEST_ASSERT_EQUAL_UINT32(100000 + BREAKER_BACKOFF_MIN, breaker.state(0).nextProbe);
+  TEST_ASSERT_EQUAL_UINT32(2, breaker.state(0).quarantines);
+}
+
+void test_late_timeouts_while_open(void)
+{
+  quarantine(1000);
+  // requests queued before the quarantine time out one after the other
+  for (uint32_t late = 1; late <= 5; ++late)
+  {
+    TEST_ASSERT_TRUE(breaker.timeout(0, 1000 + late * 500));
+  }
+  TEST_ASSERT_EQUAL_UINT8(BREAKER_OPEN, breaker.state(0).state);
+  TEST_ASSERT_EQUAL_UINT32(BREAKER_BACKOFF_MIN, breaker.state(0).backoff);
+  TEST_ASSERT_EQUAL_UINT32(1000 + BREAKER_BACKOFF_MIN, breaker.state(0).nextProbe);
+  TEST_ASSERT_EQUAL_UINT32(1, breaker.state(0).quarantines);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_threshold_opens_breaker);
+  RUN_TEST(test_success_resets_error_count);
+  RUN_TEST(test_backoff_doubles_up_to_cap);
+  RUN_TEST(test_probe_success_closes);
+  RUN_TEST(test_late_timeouts_while_open);
+  return UNITY_END();
+}
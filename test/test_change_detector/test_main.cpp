@@ -0,0 +1,150 @@
+/*
+Tests of the ChangeDetector: deadbands, change cursors and the dirty bitmap
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include "ChangeDetector.h"
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_first_update_reports_all(void)
+{
+  ChangeDetector detector;
+  const uint16_t values[4] = {0, 1, 2, 3};
+  TEST_ASSERT_EQUAL_UINT16(4, detector.update(values, 4)); // even the zero
+  TEST_ASSERT_EQUAL_UINT16(0, detector.update(values, 4));
+}
+
+void test_deadband(void)
+{
+  ChangeDetector detector;
+  detector.setDeadband(5);
+  detector.setDeadband(1, 0); // every change of register 1
+  uint16_t values[3] = {100, 100, 100};
+  detector.update(values, 3);
+  uint32_t dirty[DIRTY_WORDS];
+  detector.takeDirty(dirty);
+
+  values[0] = 105; // within the deadband
+  values[1] = 101;
+  values[2] = 94; // below the deadband
+  TEST_ASSERT_EQUAL_UINT16(2, detector.update(values, 3));
+  detector.takeDirty(dirty);
+  TEST_ASSERT_FALSE(ChangeDetector::isDirty(dirty, 0));
+  TEST_ASSERT_TRUE(ChangeDetector::isDirty(dirty, 1));
+  TEST_ASSERT_TRUE(ChangeDetector::isDirty(dirty, 2));
+
+  // a slow drift is measured against the last reported value, not the last update
+  values[0] = 106;
+  TEST_ASSERT_EQUAL_UINT16(1, detector.update(values, 3));
+  values[0] = 102;
+  TEST_ASSERT_EQUAL_UINT16(0, detector.update(values, 3));
+}
+
+void test_deadband_full_range(void)
+{
+  ChangeDetector detector;
+  detector.setDeadband(100);
+  uint16_t value = 0xFFFF;
+  detector.update(&value, 1);
+  value = 0; // no wrap around of the unsigned registers
+  TEST_ASSERT_EQUAL_UINT16(1, detector.update(&value, 1));
+}
+
+void test_cursor_semantics(void)
+{
+  ChangeDetector detector;
+  uint16_t offsets[MODBUS_MAX_READ_REGISTERS];
+  uint32_t cursor = 0;
+  uint16_t values[4] = {1, 2, 3, 4};
+  detector.update(values, 4);
+  TEST_ASSERT_EQUAL_UINT16(4, detector.changedSince(cursor, offsets, MODBUS_MAX_READ_REGISTERS));
+  TEST_ASSERT_EQUAL_UINT32(detector.lastChange(), cursor);
+  TEST_ASSERT_EQUAL_UINT16(0, detector.changedSince(cursor, offsets, MODBUS_MAX_READ_REGISTERS));
+
+  // a second consumer with its own cursor sees the same changes
+  uint32_t other = 0;
+  values[3] = 40;
+  detector.update(values, 4);
+  values[1] = 20;
+  detector.update(values, 4);
+  TEST_ASSERT_EQUAL_UINT16(2, detector.changedSince(cursor, offsets, MODBUS_MAX_READ_REGISTERS));
+  TEST_ASSERT_EQUAL_UINT16(1, offsets[0]);
+  TEST_ASSERT_EQUAL_UINT16(3, offsets[1]);
+  TEST_ASSERT_EQUAL_UINT16(4, detector.changedSince(other, offsets, MODBUS_MAX_READ_REGISTERS));
+  TEST_ASSERT_EQUAL_UINT32(cursor, other);
+}
+
+void test_sequence_is_global(void)
+{
+  ChangeDetector a, b;
+  uint16_t value = 1;
+  a.update(&value, 1);
+  b.update(&value, 1);
+  TEST_ASSERT_TRUE(b.lastChange() > a.lastChange());
+
+  // a cursor of device a does not hide the later changes of a
+  uint32_t cursor = b.lastChange();
+  uint16_t offsets[MODBUS_MAX_READ_REGISTERS];
+  TEST_ASSERT_EQUAL_UINT16(0, a.changedSince(cursor, offsets, MODBUS_MAX_READ_REGISTERS));
+  value = 2;
+  a.update(&value, 1);
+  TEST_ASSERT_EQUAL_UINT16(1, a.changedSince(cursor, offsets, MODBUS_MAX_READ_REGISTERS));
+}
+
+void test_cursor_kept_if_offsets_too_small(void)
+{
+  ChangeDetector detector;
+  uint16_t values[8] = {};
+  detector.update(values, 8);
+  uint16_t offsets[MODBUS_MAX_READ_REGISTERS];
+  uint32_t cursor = 0;
+  TEST_ASSERT_EQUAL_UINT16(4, detector.changedSince(cursor, offsets, 4));
+  TEST_ASSERT_EQUAL_UINT32(0, cursor);
+  TEST_ASSERT_EQUAL_UINT16(8, detector.changedSince(cursor, offsets, MODBUS_MAX_READ_REGISTERS));
+}
+
+void test_take_dirty_clears(void)
+{
+  ChangeDetector detector;
+  uint16_t values[MODBUS_MAX_READ_REGISTERS] = {};
+  detector.update(values, 40);
+  uint32_t dirty[DIRTY_WORDS];
+  detector.takeDirty(dirty);
+  TEST_ASSERT_TRUE(ChangeDetector::isDirty(dirty, 0));
+  TEST_ASSERT_TRUE(ChangeDetector::isDirty(dirty, 39)); // second word
+  TEST_ASSERT_FALSE(ChangeDetector::isDirty(dirty, 40));
+
+  detector.takeDirty(dirty);
+  TEST_ASSERT_FALSE(ChangeDetector::isDirty(dirty, 0));
+
+  // changes of several updates add up until they are taken
+  values[3] = 1;
+  detector.update(values, 40);
+  values[33] = 1;
+  detector.update(values, 40);
+  detector.takeDirty(dirty);
+  TEST_ASSERT_TRUE(ChangeDetector::isDirty(dirty, 3));
+  TEST_ASSERT_TRUE(ChangeDetector::isDirty(dirty, 33));
+  TEST_ASSERT_FALSE(ChangeDetector::isDirty(dirty, 4));
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_update_reports_all);
+  RUN_TEST(test_deadband);
+  RUN_TEST(test_deadband_full_range);
+  RUN_TEST(test_cursor_semantics);
+  RUN_TEST(test_sequence_is_global);
+  RUN_TEST(test_cursor_kept_if_offsets_too_small);
+  RUN_TEST(test_take_dirty_clears);
+  return UNITY_END();
+}
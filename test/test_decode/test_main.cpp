@@ -0,0 +1,131 @@
+/*
+Tests of the bulk register decoding and a benchmark against the old
+per register ModbusMessage::get() loop of handleData()
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <chrono>
+#include <ModbusMessage.h>
+#include "ModbusDevice.h"
+#include "RegisterDecode.h"
+
+#define BENCH_ITERATIONS 20000
+
+static uint8_t frame[3 + 2 * MODBUS_MAX_READ_REGISTERS + 1]; // + 1: payload at an odd address
+static volatile uint32_t sink;
+
+void setUp(void)
+{
+  for (uint16_t i = 0; i < sizeof(frame); ++i)
+  {
+    frame[i] = (uint8_t)(i * 37 + 11);
+  }
+}
+
+void tearDown(void)
+{
+}
+
+static uint16_t reference(const uint8_t *payload, uint16_t i)
+{
+  return (uint16_t)(payload[2 * i] << 8 | payload[2 * i + 1]);
+}
+
+void test_all_sizes_and_alignments(void)
+{
+  uint16_t values[MODBUS_MAX_READ_REGISTERS + 1];
+  for (uint8_t offset = 0; offset < 2; ++offset)
+  {
+    const uint8_t *payload = frame + 3 + offset;
+    for (uint16_t n = 1; n <= MODBUS_MAX_READ_REGISTERS; ++n)
+    {
+      values[n] = 0xBEEF;
+      TEST_ASSERT_TRUE(decodeRegisters(payload, 2 * n, values, n));
+      for (uint16_t i = 0; i < n; ++i)
+      {
+        TEST_ASSERT_EQUAL_HEX16(reference(payload, i), values[i]);
+      }
+      TEST_ASSERT_EQUAL_HEX16(0xBEEF, values[n]); // nothing written behind the registers
+    }
+  }
+}
+
+void test_short_payload_is_rejected(void)
+{
+  uint16_t values[4] = {1, 2, 3, 4};
+  TEST_ASSERT_FALSE(decodeRegisters(frame, 7, values, 4));
+  TEST_ASSERT_FALSE(decodeRegisters(0, 8, values, 4));
+  TEST_ASSERT_EQUAL_UINT16(1, values[0]);
+  TEST_ASSERT_EQUAL_UINT16(4, values[3]);
+  TEST_ASSERT_TRUE(decodeRegisters(frame, 9, values, 4)); // more bytes than needed are ok
+}
+
+void test_32bit_values(void)
+{
+  const uint8_t payload[] = {0x12, 0x34, 0x56, 0x78, 0x40, 0x49, 0x0F, 0xDB, 0xFF, 0xFF, 0xFF, 0xFE};
+  uint16_t regs[6];
+  TEST_ASSERT_TRUE(decodeRegisters(payload, sizeof(payload), regs, 6));
+  TEST_ASSERT_EQUAL_UINT32(0x12345678, registersToUint32(regs));
+  TEST_ASSERT_EQUAL_UINT32(0x56781234, registersToUint32(regs, WORD_ORDER_LOW_FIRST));
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 3.1415927f, registersToFloat(regs + 2));
+  TEST_ASSERT_EQUAL_INT32(-2, registersToInt32(regs + 4));
+  uint16_t swapped[2] = {regs[5], regs[4]};
+  TEST_ASSERT_EQUAL_INT32(-2, registersToInt32(swapped, WORD_ORDER_LOW_FIRST));
+}
+
+// ns per decoded response of numValues registers
+template <class Decode>
+static uint32_t measure(uint16_t numValues, Decode decode)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t n = 0; n < BENCH_ITERATIONS; ++n)
+  {
+    sink = sink + decode(numValues);
+  }
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  return (uint32_t)(ns / BENCH_ITERATIONS);
+}
+
+void test_benchmark_against_get_loop(void)
+{
+  ModbusMessage response;
+  response.add(frame, sizeof(frame) - 1);
+  static uint16_t values[MODBUS_MAX_READ_REGISTERS];
+
+  static const uint16_t REGISTERS[] = {2, 10, 32, 80, MODBUS_MAX_READ_REGISTERS};
+  char line[96];
+  TEST_MESSAGE("registers,get_loop_ns,bulk_ns");
+  for (uint16_t numValues : REGISTERS)
+  {
+    // the loop of handleData() before the bulk decoding
+    uint32_t getLoop = measure(numValues, [&](uint16_t count) {
+      uint16_t offs = 3;
+      for (uint16_t i = 0; i < count; ++i)
+      {
+        offs = response.get(offs, values[i]);
+      }
+      return values[count - 1];
+    });
+    uint32_t bulk = measure(numValues, [&](uint16_t count) {
+      decodeRegisters(response.data() + 3, response.size() - 3, values, count);
+      return values[count - 1];
+    });
+    snprintf(line, sizeof(line), "%u,%u,%u", numValues, (unsigned)getLoop, (unsigned)bulk);
+    TEST_MESSAGE(line);
+    if (numValues == MODBUS_MAX_READ_REGISTERS)
+    {
+      TEST_ASSERT_LESS_THAN(getLoop, bulk); // the bulk decoding must pay off for large responses
+    }
+  }
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_all_sizes_and_alignments);
+  RUN_TEST(test_short_payload_is_rejected);
+  RUN_TEST(test_32bit_values);
+  RUN_TEST(test_benchmark_against_get_loop);
+  return UNITY_END();
+}
@@ -0,0 +1,219 @@
+/*
+Tests of the wake-up of a bus task by the eModbus callbacks
+
+A simulated clock and event loop replace FreeRTOS: the bus task of main.cpp
+(NonBlockingStateMachine + xTaskNotifyWait) sleeps until its timeout or a
+notification, the stub client is the eModbus worker. With <preempt> the
+notified task runs at once, inside the callback, like a bus task on the
+other core or with a higher priority than the eModbus worker.
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <ModbusClientRTU.h>
+#include "PollScheduler.h"
+#include "SimulatedBus.h"
+
+#define BAUDRATE 9600
+#define BUS_MAX_SLEEP 100 // [ms] like main.cpp
+
+enum BUS_GATE
+{
+  GATE_BUS_FREE,         // the task waits for busFree, set at the end of the callback
+  GATE_PENDING_REQUESTS, // the task waits for pendingRequests() == 0 (the old check)
+};
+
+static const SimServer SERVERS[] = {
+    // ID, latency, timeoutRate, crcRate, disturbTime
+    {1, 5, 0, 0, 0},
+    {2, 5, 50, 0, 0},
+};
+
+static const ModbusDevice DEVICES[] = {
+    {"a", 1, 0x03, 0, 2, 0, 0, 20, 0, FORMAT_DECIMAL, 0},
+    {"b", 2, 0x03, 0, 2, 0, 0, 20, 0, FORMAT_DECIMAL, 0},
+};
+
+class BusTaskModel
+{
+public:
+  BusTaskModel(BUS_GATE gate, bool preempt)
+      : client(Serial),
+        scheduler(DEVICES, 2),
+        sim(BAUDRATE, SERVERS, 2),
+        busFree(true),
+        laneWakeInCallback(false),
+        pendingInCallback(0),
+        sent(0),
+        completed(0),
+        sentWhileBusy(0),
+        _gate(gate),
+        _preempt(preempt),
+        _notified(false),
+        _wakeAt(0)
+  {
+    client.attach(sim);
+    client.setTimeout(200);
+    client.onDataHandler([this](ModbusMessage, uint32_t) { callback(); });
+    client.onErrorHandler([this](Error, uint32_t) { callback(); });
+    scheduler.begin(millis());
+  }
+
+  // runs the bus until <end>
+  void run(uint32_t end)
+  {
+    task();
+    while ((int32_t)(millis() - end) < 0)
+    {
+      if (client.process()) // the eModbus worker transfers the queued request
+      {
+        continue;
+      }
+      if (!_notified && (int32_t)(_wakeAt - millis()) > 0)
+      {
+        FakeClock::set(_wakeAt); // xTaskNotifyWait() times out
+      }
+      task();
+    }
+  }
+
+  ModbusClientRTU client;
+  PollScheduler scheduler;
+  SimulatedBus sim;
+  bool busFree;
+  bool laneWakeInCallback; // a lane request wakes the task while the response is handled
+  uint32_t pendingInCallback;
+  uint32_t sent;
+  uint32_t completed;
+  uint32_t sentWhileBusy; // requests handed to the client while another one was not finished
+
+protected:
+  // onData / onError of main.cpp
+  void callback()
+  {
+    pendingInCallback = client.pendingRequests();
+    if (laneWakeInCallback)
+    {
+      notify(); // e.g. a control write submitted by the web server
+    }
+    completed++; // handleData / handleError
+    busFree = true;
+    notify(); // wakeBus(bus, EVENT_RESPONSE)
+  }
+
+  void notify()
+  {
+    _notified = true;
+    if (_preempt)
+    {
+      task();
+    }
+  }
+
+  // busTask(): NonBlockingStateMachine() until it wants to sleep
+  void task()
+  {
+    while (true)
+    {
+      _notified = false; // xTaskNotifyWait() clears the bits
+      uint32_t sleep = stateMachine();
+      if (sleep > 0 && !_notified)
+      {
+        _wakeAt = millis() + (sleep < BUS_MAX_SLEEP ? sleep : BUS_MAX_SLEEP);
+        return;
+      }
+    }
+  }
+
+  uint32_t stateMachine()
+  {
+    if (_gate == GATE_BUS_FREE ? !busFree : client.pendingRequests() > 0)
+    {
+      return BUS_MAX_SLEEP; // the response callback wakes the task
+    }
+    uint32_t waitTime;
+    int16_t index = scheduler.next(millis(), waitTime);
+    if (index == PollScheduler::NO_DEVICE)
+    {
+      return waitTime;
+    }
+    if (sent != completed)
+    {
+      sentWhileBusy++;
+    }
+    busFree = false;
+    client.addRequest(index, DEVICES[index].serverID, DEVICES[index].functionCode, DEVICES[index].startRegister,
+                      DEVICES[index].numValues);
+    scheduler.issued(index, millis());
+    sent++;
+    return 0;
+  }
+
+  BUS_GATE _gate;
+  bool _preempt;
+  bool _notified;
+  uint32_t _wakeAt;
+};
+
+void setUp(void)
+{
+  FakeClock::set(1000);
+}
+
+void tearDown(void)
+{
+}
+
+void test_callback_still_counts_the_request(void)
+{
+  BusTaskModel bus(GATE_BUS_FREE, false);
+  bus.run(millis() + 100);
+  TEST_ASSERT_GREATER_THAN(0, bus.completed);
+  TEST_ASSERT_EQUAL_UINT32(1, bus.pendingInCallback); // like eModbus: removed after the callback
+}
+
+void test_bus_free_flag_keeps_the_bus_busy(void)
+{
+  BusTaskModel cooperative(GATE_BUS_FREE, false);
+  cooperative.run(millis() + 10000);
+  FakeClock::set(1000);
+  BusTaskModel preemptive(GATE_BUS_FREE, true);
+  preemptive.run(millis() + 10000);
+
+  // the requests follow each other without a gap: ~25 ms per transfer, some timeouts
+  TEST_ASSERT_GREATER_THAN(250, cooperative.sent);
+  TEST_ASSERT_UINT32_WITHIN(1, cooperative.sent, preemptive.sent);
+  TEST_ASSERT_EQUAL_UINT32(0, cooperative.sentWhileBusy);
+  TEST_ASSERT_EQUAL_UINT32(0, preemptive.sentWhileBusy);
+}
+
+void test_pending_requests_gate_loses_the_wake_up(void)
+{
+  BusTaskModel flag(GATE_BUS_FREE, true);
+  flag.run(millis() + 10000);
+  FakeClock::set(1000);
+  BusTaskModel pending(GATE_PENDING_REQUESTS, true);
+  pending.run(millis() + 10000);
+
+  // the woken task sees the finished request and sleeps BUS_MAX_SLEEP after every response
+  TEST_ASSERT_LESS_THAN(flag.sent / 2, pending.sent);
+}
+
+void test_wake_up_during_the_callback_sends_nothing(void)
+{
+  BusTaskModel bus(GATE_BUS_FREE, true);
+  bus.laneWakeInCallback = true;
+  bus.run(millis() + 10000);
+  TEST_ASSERT_GREATER_THAN(250, bus.sent);
+  TEST_ASSERT_EQUAL_UINT32(0, bus.sentWhileBusy); // only one request on the bus
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_callback_still_counts_the_request);
+  RUN_TEST(test_bus_free_flag_keeps_the_bus_busy);
+  RUN_TEST(test_pending_requests_gate_loses_the_wake_up);
+  RUN_TEST(test_wake_up_during_the_callback_sends_nothing);
+  return UNITY_END();
+}
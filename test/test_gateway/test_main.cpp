@@ -0,0 +1,310 @@
+/*
+Test of the Modbus TCP gateway on a Linux host: a small Modbus TCP server
+(MBAP on a loopback socket, the frames answered by CacheGateway::respond() like
+in gatewayWorker() of main.cpp)
+answers from the register snapshots while a writer thread updates them like
+the bus tasks, several TCP clients poll it at the same time
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <Arduino.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "CacheGateway.h"
+#include "RegisterSnapshot.h"
+
+#define CLIENTS 4
+#define REQUESTS_PER_CLIENT 500
+
+static const ModbusDevice DEVICES[] = {
+    {"XY-MD02-1", 1, 0x04, 0x0001, 2, 1000, 1000, 30000, 0, FORMAT_TENTHS, 1},
+    {"M5Atom-27", 27, 0x03, 0x012C, 80, 0, 50, 5000, 0, FORMAT_DECIMAL, 0},
+    {"M5Atom-27", 27, 0x03, 0x017C, 10, 0, 50, 5000, 0, FORMAT_DECIMAL, 0}, // directly behind the first range
+    {"XY-MD02-2", 3, 0x04, 0x0001, 2, 1000, 1000, 30000, 0, FORMAT_TENTHS, 1}, // never answers
+};
+static const uint16_t NUM_DEVICES = sizeof(DEVICES) / sizeof(DEVICES[0]);
+
+static RegisterSnapshot Snapshots[NUM_DEVICES];
+static CacheGateway Gateway(DEVICES, Snapshots, NUM_DEVICES);
+static std::atomic<bool> running; // TCP server
+static std::atomic<bool> polling;  // bus writer
+
+// snapshot of generation g: register i of the row holds g + i
+static void publish(uint16_t row, uint16_t generation, uint32_t now)
+{
+  uint16_t *values = Snapshots[row].beginWrite();
+  for (uint16_t i = 0; i < DEVICES[row].numValues; ++i)
+  {
+    values[i] = generation + i;
+  }
+  Snapshots[row].commit(now, DEVICES[row].numValues);
+}
+
+static void busWriter()
+{
+  for (uint16_t generation = 1; polling; ++generation)
+  {
+    for (uint16_t row = 0; row < 3; ++row)
+    {
+      publish(row, generation, millis());
+    }
+    std::this_thread::yield();
+  }
+}
+
+static bool receiveAll(int fd, uint8_t *buffer, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t n = recv(fd, buffer, length, 0);
+    if (n <= 0)
+    {
+      return false;
+    }
+    buffer += n;
+    length -= n;
+  }
+  return true;
+}
+
+static void serveConnection(int fd)
+{
+  uint8_t header[7];
+  uint8_t request[1 + 256];
+  uint8_t response[6 + GATEWAY_MAX_RESPONSE];
+  while (receiveAll(fd, header, sizeof(header)))
+  {
+    uint16_t length = header[4] << 8 | header[5]; // unit ID + PDU
+    if (length < 2 || length > sizeof(request) || !receiveAll(fd, request + 1, length - 1))
+    {
+      break;
+    }
+    // the request frame (unit ID + PDU) is handled by the gateway worker of main.cpp
+    request[0] = header[6];
+    uint16_t frameLength = Gateway.respond(request, length, response + 6, millis());
+    memcpy(response, header, 4); // transaction and protocol ID
+    response[4] = frameLength >> 8;
+    response[5] = frameLength & 0xFF;
+    if (send(fd, response, 6 + frameLength, 0) != 6 + frameLength)
+    {
+      break;
+    }
+  }
+  close(fd);
+}
+
+static void tcpServer(int listener)
+{
+  std::vector<std::thread> connections;
+  while (running)
+  {
+    int fd = accept(listener, 0, 0);
+    if (fd < 0)
+    {
+      break; // listener shut down
+    }
+    connections.emplace_back(serveConnection, fd);
+  }
+  for (std::thread &t : connections)
+  {
+    t.join();
+  }
+}
+
+class TcpClient
+{
+public:
+  explicit TcpClient(uint16_t port)
+      : _transaction(0)
+  {
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    _connected = connect(_fd, (sockaddr *)&addr, sizeof(addr)) == 0;
+  }
+  ~TcpClient() { close(_fd); }
+
+  bool connected() const { return _connected; }
+
+  // returns 0 and the registers or the exception code, 0xFF for a broken response
+  uint8_t read(uint8_t serverID, uint8_t functionCode, uint16_t address, uint16_t count, uint16_t *values)
+  {
+    uint16_t transaction = ++_transaction;
+    uint8_t request[12] = {(uint8_t)(transaction >> 8), (uint8_t)transaction, 0, 0, 0, 6, serverID, functionCode,
+                           (uint8_t)(address >> 8), (uint8_t)address, (uint8_t)(count >> 8), (uint8_t)count};
+    uint8_t response[7 + 2 + 2 * MODBUS_MAX_READ_REGISTERS];
+    if (send(_fd, request, sizeof(request), 0) != sizeof(request) || !receiveAll(_fd, response, 7))
+    {
+      return 0xFF;
+    }
+    uint16_t length = response[4] << 8 | response[5];
+    if ((response[0] << 8 | response[1]) != transaction || response[6] != serverID || length < 3 ||
+        length > sizeof(response) - 6 || !receiveAll(_fd, response + 7, length - 1))
+    {
+      return 0xFF;
+    }
+    if (response[7] == (functionCode | 0x80))
+    {
+      return response[8];
+    }
+    if (response[7] != functionCode || response[8] != 2 * count || length != 3 + 2 * count)
+    {
+      return 0xFF;
+    }
+    for (uint16_t i = 0; i < count && i < MODBUS_MAX_READ_REGISTERS; ++i)
+    {
+      values[i] = response[9 + 2 * i] << 8 | response[10 + 2 * i];
+    }
+    return 0;
+  }
+
+protected:
+  int _fd;
+  bool _connected;
+  uint16_t _transaction;
+};
+
+static int listener;
+static uint16_t port;
+static std::thread server;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+static void startServer()
+{
+  FakeClock::set(100000); // no clock changes while the threads run
+  for (uint16_t row = 0; row < 3; ++row)
+  {
+    publish(row, 0, millis());
+  }
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = 0; // any free port
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t size = sizeof(addr);
+  TEST_ASSERT_EQUAL(0, bind(listener, (sockaddr *)&addr, sizeof(addr)));
+  TEST_ASSERT_EQUAL(0, listen(listener, CLIENTS));
+  getsockname(listener, (sockaddr *)&addr, &size);
+  port = ntohs(addr.sin_port);
+  running = true;
+  server = std::thread(tcpServer, listener);
+}
+
+static void stopServer()
+{
+  running = false;
+  shutdown(listener, SHUT_RDWR);
+  server.join();
+  close(listener);
+}
+
+void test_exceptions(void)
+{
+  TcpClient client(port);
+  TEST_ASSERT_TRUE(client.connected());
+  uint16_t values[MODBUS_MAX_READ_REGISTERS] = {};
+  TEST_ASSERT_EQUAL_HEX8(0, client.read(1, 0x04, 0x0001, 2, values));
+  TEST_ASSERT_EQUAL_HEX8(0x02, client.read(1, 0x04, 0x0000, 2, values)); // register 0 not in the table
+  TEST_ASSERT_EQUAL_HEX8(0x02, client.read(1, 0x03, 0x0001, 2, values)); // wrong function code
+  TEST_ASSERT_EQUAL_HEX8(0x02, client.read(99, 0x04, 0x0001, 1, values)); // unknown server
+  TEST_ASSERT_EQUAL_HEX8(0x0B, client.read(3, 0x04, 0x0001, 2, values)); // no data yet
+  TEST_ASSERT_EQUAL_HEX8(0x03, client.read(27, 0x03, 0x012C, 126, values));
+
+  // values older than GATEWAY_STALE_PERIODS poll periods
+  publish(3, 7, millis() - GATEWAY_STALE_PERIODS * DEVICES[3].pollPeriod - 1);
+  TEST_ASSERT_EQUAL_HEX8(0x0B, client.read(3, 0x04, 0x0001, 2, values));
+  publish(3, 7, millis());
+  TEST_ASSERT_EQUAL_HEX8(0, client.read(3, 0x04, 0x0001, 2, values));
+  TEST_ASSERT_EQUAL_UINT16(7, values[0]);
+  TEST_ASSERT_EQUAL_UINT16(8, values[1]);
+}
+
+static void clientTask(uint8_t number, uint32_t *errors, uint32_t *torn)
+{
+  TcpClient client(port);
+  if (!client.connected())
+  {
+    *errors = REQUESTS_PER_CLIENT;
+    return;
+  }
+  uint16_t values[MODBUS_MAX_READ_REGISTERS] = {};
+  for (uint32_t n = 0; n < REQUESTS_PER_CLIENT; ++n)
+  {
+    switch ((n + number) % 3)
+    {
+    case 0:
+      if (client.read(1, 0x04, 0x0001, 2, values) != 0)
+        (*errors)++;
+      else if (values[1] != (uint16_t)(values[0] + 1))
+        (*torn)++;
+      break;
+    case 1: // the whole first range
+      if (client.read(27, 0x03, 0x012C, 80, values) != 0)
+        (*errors)++;
+      for (uint16_t i = 1; i < 80; ++i)
+        *torn += values[i] != (uint16_t)(values[0] + i) ? 1 : 0;
+      break;
+    default: // across both ranges of the server: every row is consistent in itself
+      if (client.read(27, 0x03, 0x0170, 20, values) != 0)
+        (*errors)++;
+      for (uint16_t i = 1; i < 12; ++i)
+        *torn += values[i] != (uint16_t)(values[0] + i) ? 1 : 0;
+      for (uint16_t i = 13; i < 20; ++i)
+        *torn += values[i] != (uint16_t)(values[12] + i - 12) ? 1 : 0;
+      break;
+    }
+  }
+}
+
+void test_concurrent_clients(void)
+{
+  polling = true;
+  std::thread writer(busWriter);
+  std::thread clients[CLIENTS];
+  uint32_t errors[CLIENTS] = {};
+  uint32_t torn[CLIENTS] = {};
+  for (uint8_t c = 0; c < CLIENTS; ++c)
+  {
+    clients[c] = std::thread(clientTask, c, &errors[c], &torn[c]);
+  }
+  for (uint8_t c = 0; c < CLIENTS; ++c)
+  {
+    clients[c].join();
+  }
+  polling = false;
+  writer.join();
+  for (uint8_t c = 0; c < CLIENTS; ++c)
+  {
+    TEST_ASSERT_EQUAL_UINT32(0, errors[c]);
+    TEST_ASSERT_EQUAL_UINT32(0, torn[c]);
+  }
+  TEST_ASSERT_GREATER_THAN(0, Snapshots[1].sequence() - 1); // the values changed during the test
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  startServer();
+  RUN_TEST(test_exceptions);
+  RUN_TEST(test_concurrent_clients);
+  stopServer();
+  return UNITY_END();
+}
@@ -0,0 +1,191 @@
+/*
+Tests of the GuardTuner, unit tests and a slow slave on the simulated bus
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <Arduino.h>
+#include "GuardTuner.h"
+#include "PollScheduler.h"
+#include "SimulatedBus.h"
+
+static const ModbusDevice DEVICES[] = {
+    {"fast", 27, 0x03, 0x012C, 8, 0, 0, 500, 0, FORMAT_DECIMAL, 0},
+    {"slow", 1, 0x04, 0x0001, 2, 0, 0, 5000, 0, FORMAT_TENTHS, 0}, // XY-MD02, guard times unknown
+};
+
+void setUp(void)
+{
+  FakeClock::set(0);
+}
+
+void tearDown(void)
+{
+}
+
+void test_error_grows_guard_before_from_zero(void)
+{
+  PollScheduler scheduler(DEVICES, 2);
+  GuardTuner tuner(scheduler);
+  tuner.requestSent(1, 0);
+  tuner.busError(1);
+  TEST_ASSERT_EQUAL_UINT32(GUARD_START, tuner.state(1).guardBefore);
+  TEST_ASSERT_EQUAL_UINT32(GUARD_START, scheduler.guardBefore(1));
+  tuner.requestSent(1, 100);
+  tuner.busError(1);
+  TEST_ASSERT_EQUAL_UINT32(2 * GUARD_START, scheduler.guardBefore(1));
+  TEST_ASSERT_EQUAL_UINT32(GUARD_START, tuner.state(1).floorBefore);
+}
+
+void test_error_charges_previous_request(void)
+{
+  PollScheduler scheduler(DEVICES, 2);
+  GuardTuner tuner(scheduler);
+  tuner.requestSent(1, 0); // slow device answers, but disturbs the bus afterwards
+  tuner.responseReceived(1, 50);
+  tuner.requestSent(0, 60);
+  tuner.busError(0);
+  TEST_ASSERT_EQUAL_UINT32(GUARD_START, scheduler.guardBefore(0));
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.guardAfter(0));
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.guardBefore(1));
+  TEST_ASSERT_EQUAL_UINT32(GUARD_START, scheduler.guardAfter(1));
+  TEST_ASSERT_EQUAL_UINT32(1, tuner.state(0).timeouts);
+  TEST_ASSERT_EQUAL_UINT32(0, tuner.state(1).timeouts);
+}
+
+void test_no_previous_after_write(void)
+{
+  PollScheduler scheduler(DEVICES, 2);
+  GuardTuner tuner(scheduler);
+  tuner.requestSent(1, 0);
+  tuner.requestSent(scheduler.numDevices(), 50); // a control write
+  tuner.requestSent(0, 100);
+  tuner.busError(0);
+  TEST_ASSERT_EQUAL_UINT32(GUARD_START, scheduler.guardBefore(0));
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.guardAfter(1));
+}
+
+void test_decrease_keeps_margin_above_floor(void)
+{
+  static const ModbusDevice TABLE[] = {{"xy", 1, 0x04, 1, 2, 1000, 1000, 5000, 0, FORMAT_TENTHS, 0}};
+  PollScheduler scheduler(TABLE, 1);
+  GuardTuner tuner(scheduler);
+  uint32_t now = 0;
+  tuner.requestSent(0, now);
+  tuner.responseReceived(0, now + 40);
+  tuner.requestSent(0, now += 5000);
+  tuner.busError(0); // 1000 failed before and after the device itself: both doubled, 1000 is the floor
+  TEST_ASSERT_EQUAL_UINT32(2000, scheduler.guardBefore(0));
+  TEST_ASSERT_EQUAL_UINT32(2000, scheduler.guardAfter(0));
+  for (uint16_t n = 0; n < 100; ++n)
+  {
+    tuner.requestSent(0, now);
+    tuner.responseReceived(0, now + 40);
+    now += 5000;
+  }
+  TEST_ASSERT_EQUAL_UINT32(1250, scheduler.guardBefore(0)); // floor + 1/4
+  TEST_ASSERT_EQUAL_UINT32(1250, scheduler.guardAfter(0));
+  TEST_ASSERT_EQUAL_UINT32(40, tuner.state(0).latency);
+}
+
+void test_decrease_without_errors(void)
+{
+  static const ModbusDevice TABLE[] = {{"atom", 27, 0x03, 0, 8, 0, 50, 100, 0, FORMAT_DECIMAL, 0}};
+  PollScheduler scheduler(TABLE, 1);
+  GuardTuner tuner(scheduler);
+  for (uint16_t n = 0; n < 5 * GUARD_DECREASE_AFTER; ++n)
+  {
+    tuner.requestSent(0, n * 100);
+    tuner.responseReceived(0, n * 100 + 10);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.guardBefore(0)); // not needed: stays 0
+  TEST_ASSERT_EQUAL_UINT32(28, scheduler.guardAfter(0)); // 50 -> 44 -> 39 -> 35 -> 31 -> 28
+}
+
+void test_decrease_reaches_guard_min(void)
+{
+  static const ModbusDevice TABLE[] = {{"atom", 27, 0x03, 0, 8, 20, 9, 100, 0, FORMAT_DECIMAL, 0}};
+  PollScheduler scheduler(TABLE, 1);
+  GuardTuner tuner(scheduler);
+  for (uint16_t n = 0; n < 40 * GUARD_DECREASE_AFTER; ++n)
+  {
+    tuner.requestSent(0, n * 100);
+    tuner.responseReceived(0, n * 100 + 10);
+  }
+  // below 8 ms the guard times go down by 1 ms per step instead of getting stuck at 7 ms
+  TEST_ASSERT_EQUAL_UINT32(GUARD_MIN, scheduler.guardBefore(0));
+  TEST_ASSERT_EQUAL_UINT32(GUARD_MIN, scheduler.guardAfter(0));
+}
+
+// polls both devices on a simulated bus for <duration> ms, returns the errors in this time
+static uint32_t poll(PollScheduler &scheduler, GuardTuner &tuner, SimulatedBus &bus, uint32_t duration, uint32_t *requests)
+{
+  uint8_t frame[3 + 2 * MODBUS_MAX_READ_REGISTERS];
+  uint16_t length;
+  SIM_RESULT result;
+  uint32_t errors = 0;
+  uint32_t end = millis() + duration;
+  while ((int32_t)(millis() - end) < 0)
+  {
+    uint32_t waitTime;
+    int16_t index = scheduler.next(millis(), waitTime);
+    if (index == PollScheduler::NO_DEVICE)
+    {
+      FakeClock::advance(waitTime > 0 ? waitTime : 1);
+      continue;
+    }
+    const ModbusDevice &dev = DEVICES[index];
+    tuner.requestSent(index, millis());
+    scheduler.issued(index, millis());
+    requests[index]++;
+    FakeClock::advance(bus.transfer(dev.serverID, dev.functionCode, dev.startRegister, dev.numValues, 0, millis(), 1000,
+                                    frame, length, result));
+    if (result == SIM_OK)
+    {
+      tuner.responseReceived(index, millis());
+    }
+    else
+    {
+      tuner.busError(index);
+      errors++;
+    }
+  }
+  return errors;
+}
+
+void test_slow_slave_is_learned(void)
+{
+  // the XY-MD02 disturbs the bus for 800 ms after its answer, the table has no guard times
+  static const SimServer SERVERS[] = {{27, 10, 0, 0, 0}, {1, 40, 0, 0, 800}};
+  SimulatedBus bus(9600, SERVERS, 2);
+  PollScheduler scheduler(DEVICES, 2);
+  GuardTuner tuner(scheduler);
+  scheduler.begin(millis());
+  uint32_t requests[2] = {0, 0};
+
+  uint32_t learning = poll(scheduler, tuner, bus, 600000, requests);
+  TEST_ASSERT_GREATER_THAN(0, learning);
+  // learned: the guardAfter of the slow device covers its answer and the disturbance
+  TEST_ASSERT_GREATER_OR_EQUAL(800, scheduler.guardAfter(1));
+  TEST_ASSERT_LESS_OR_EQUAL(GUARD_MAX, scheduler.guardAfter(1));
+
+  requests[0] = requests[1] = 0;
+  uint32_t errors = poll(scheduler, tuner, bus, 600000, requests);
+  uint32_t total = requests[0] + requests[1];
+  TEST_ASSERT_LESS_THAN(total / 50, errors); // < 2 %, the floors keep the tuner away from the edge
+  TEST_ASSERT_GREATER_THAN(1100, requests[0]); // 1200 at its period, the guard time of the slow device costs a few
+  TEST_ASSERT_UINT32_WITHIN(2, 120, requests[1]);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_error_grows_guard_before_from_zero);
+  RUN_TEST(test_error_charges_previous_request);
+  RUN_TEST(test_no_previous_after_write);
+  RUN_TEST(test_decrease_keeps_margin_above_floor);
+  RUN_TEST(test_decrease_without_errors);
+  RUN_TEST(test_decrease_reaches_guard_min);
+  RUN_TEST(test_slow_slave_is_learned);
+  return UNITY_END();
+}
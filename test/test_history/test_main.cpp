@@ -0,0 +1,256 @@
+/*
+Tests of the compressed register history and a benchmark of the
+compression ratio and the append/query throughput
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include "HistorySeries.h"
+
+#define CHUNK 64 // like HISTORY_CHUNK of historyCmd()
+
+struct Sample
+{
+  uint32_t time;
+  uint16_t value;
+};
+
+static bool collect(void *context, uint32_t time, uint16_t value)
+{
+  ((std::vector<Sample> *)context)->push_back({time, value});
+  return true;
+}
+
+// the chunked query of historyCmd(): at most CHUNK samples per query call
+struct Chunk
+{
+  Sample samples[CHUNK];
+  uint16_t count;
+};
+
+static bool collectChunk(void *context, uint32_t time, uint16_t value)
+{
+  Chunk *chunk = (Chunk *)context;
+  chunk->samples[chunk->count] = {time, value};
+  return ++chunk->count < CHUNK;
+}
+
+static std::vector<Sample> chunkedQuery(const HistorySeries &history, uint32_t from, uint32_t to)
+{
+  std::vector<Sample> result;
+  Chunk chunk;
+  while (true)
+  {
+    chunk.count = 0;
+    history.query(from, to, &collectChunk, &chunk);
+    result.insert(result.end(), chunk.samples, chunk.samples + chunk.count);
+    if (chunk.count < CHUNK || chunk.samples[CHUNK - 1].time == to)
+    {
+      break;
+    }
+    from = chunk.samples[CHUNK - 1].time + 1;
+  }
+  return result;
+}
+
+static uint32_t seed = 1;
+static uint32_t random32()
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+// polled every 5 s with some jitter, the value is a temperature in 1/10 degC (random walk)
+static std::vector<Sample> temperature(uint32_t count, uint32_t start)
+{
+  std::vector<Sample> samples;
+  uint32_t time = start;
+  uint16_t value = 215;
+  for (uint32_t n = 0; n < count; ++n)
+  {
+    time += 4990 + random32() % 20;
+    uint32_t r = random32() % 8;
+    value += r == 0 ? 1 : r == 1 ? -1 : 0;
+    samples.push_back({time, value});
+  }
+  return samples;
+}
+
+static uint8_t buffer[64 * 1024];
+
+void setUp(void)
+{
+  seed = 1;
+}
+
+void tearDown(void)
+{
+}
+
+void test_round_trip(void)
+{
+  HistorySeries history;
+  TEST_ASSERT_TRUE(history.begin(buffer, sizeof(buffer)));
+  std::vector<Sample> in = temperature(2000, 1000);
+  for (const Sample &s : in)
+  {
+    history.append(s.time, s.value);
+  }
+  std::vector<Sample> out;
+  TEST_ASSERT_EQUAL_UINT32(2000, history.query(0, in.back().time, &collect, &out));
+  TEST_ASSERT_EQUAL_UINT32(2000, history.samples());
+  TEST_ASSERT_EQUAL_UINT32(in.front().time, history.oldest());
+  for (uint32_t i = 0; i < in.size(); ++i)
+  {
+    TEST_ASSERT_EQUAL_UINT32(in[i].time, out[i].time);
+    TEST_ASSERT_EQUAL_UINT16(in[i].value, out[i].value);
+  }
+}
+
+void test_large_steps(void)
+{
+  HistorySeries history;
+  history.begin(buffer, 4 * HISTORY_BLOCK_SIZE);
+  const Sample in[] = {{0, 0}, {1, 0xFFFF}, {70000, 0}, {70001, 0x8000}, {0x10000000, 0x7FFF}, {0x10000001, 1}};
+  for (const Sample &s : in)
+  {
+    history.append(s.time, s.value);
+  }
+  std::vector<Sample> out;
+  history.query(0, 0x10000001, &collect, &out); // a query spans less than 2^31 ms (millis() wraps)
+  TEST_ASSERT_EQUAL_UINT32(6, out.size());
+  for (uint16_t i = 0; i < 6; ++i)
+  {
+    TEST_ASSERT_EQUAL_UINT32(in[i].time, out[i].time);
+    TEST_ASSERT_EQUAL_UINT16(in[i].value, out[i].value);
+  }
+}
+
+void test_ring_drops_oldest_blocks(void)
+{
+  HistorySeries history;
+  history.begin(buffer, 4 * HISTORY_BLOCK_SIZE);
+  std::vector<Sample> in = temperature(1000, 1000);
+  for (const Sample &s : in)
+  {
+    history.append(s.time, s.value);
+  }
+  std::vector<Sample> out;
+  history.query(0, in.back().time, &collect, &out);
+  TEST_ASSERT_EQUAL_UINT32(history.samples(), out.size());
+  TEST_ASSERT_LESS_THAN(1000, out.size());
+  TEST_ASSERT_EQUAL_UINT32(history.oldest(), out.front().time);
+  TEST_ASSERT_EQUAL_UINT32(in.back().time, out.back().time); // the newest sample is never lost
+  TEST_ASSERT_LESS_OR_EQUAL(history.capacity(), history.bytesUsed());
+}
+
+void test_time_range_and_wrap_around(void)
+{
+  HistorySeries history;
+  history.begin(buffer, sizeof(buffer));
+  std::vector<Sample> in = temperature(1000, 0xFFFFFFFF - 2000000); // millis() wraps in the middle
+  for (const Sample &s : in)
+  {
+    history.append(s.time, s.value);
+  }
+  std::vector<Sample> out;
+  history.query(in[100].time, in[899].time, &collect, &out);
+  TEST_ASSERT_EQUAL_UINT32(800, out.size());
+  TEST_ASSERT_EQUAL_UINT32(in[100].time, out.front().time);
+  TEST_ASSERT_EQUAL_UINT32(in[899].time, out.back().time);
+}
+
+void test_chunked_query_like_history_command(void)
+{
+  HistorySeries history;
+  history.begin(buffer, sizeof(buffer));
+  std::vector<Sample> in = temperature(1000, 1000);
+  for (const Sample &s : in)
+  {
+    history.append(s.time, s.value);
+  }
+  for (uint32_t last : {in[5 * CHUNK - 1].time, in[700].time, in.back().time})
+  {
+    std::vector<Sample> full, chunked;
+    history.query(history.oldest(), last, &collect, &full);
+    chunked = chunkedQuery(history, history.oldest(), last);
+    TEST_ASSERT_EQUAL_UINT32(full.size(), chunked.size());
+    for (uint32_t i = 0; i < full.size(); ++i)
+    {
+      TEST_ASSERT_EQUAL_UINT32(full[i].time, chunked[i].time);
+      TEST_ASSERT_EQUAL_UINT16(full[i].value, chunked[i].value);
+    }
+  }
+}
+
+static bool countSample(void *context, uint32_t, uint16_t value)
+{
+  *(uint32_t *)context += value;
+  return true;
+}
+
+void test_benchmark(void)
+{
+  struct Signal
+  {
+    const char *name;
+    std::vector<Sample> samples;
+  };
+  std::vector<Signal> signals;
+  signals.push_back({"temperature", temperature(10000, 0)});
+  std::vector<Sample> constant, counter, noise;
+  for (uint32_t n = 0; n < 10000; ++n)
+  {
+    constant.push_back({n * 1000, 42});
+    counter.push_back({n * 1000, (uint16_t)(n * 37)});
+    noise.push_back({n * 1000 + random32() % 100, (uint16_t)random32()});
+  }
+  signals.push_back({"constant", constant});
+  signals.push_back({"counter", counter});
+  signals.push_back({"noise", noise});
+
+  char line[128];
+  TEST_MESSAGE("signal,samples,bytes_per_sample,append_ns,query_ns");
+  for (const Signal &signal : signals)
+  {
+    HistorySeries history;
+    history.begin(buffer, sizeof(buffer));
+    auto start = std::chrono::steady_clock::now();
+    for (const Sample &s : signal.samples)
+    {
+      history.append(s.time, s.value);
+    }
+    auto appended = std::chrono::steady_clock::now();
+    uint32_t sum = 0;
+    uint32_t visited = history.query(0, signal.samples.back().time, &countSample, &sum);
+    auto queried = std::chrono::steady_clock::now();
+
+    TEST_ASSERT_EQUAL_UINT32(history.samples(), visited);
+    double bytesPerSample = (double)history.bytesUsed() / history.samples();
+    long appendNs = std::chrono::duration_cast<std::chrono::nanoseconds>(appended - start).count() / signal.samples.size();
+    long queryNs = std::chrono::duration_cast<std::chrono::nanoseconds>(queried - appended).count() / visited;
+    snprintf(line, sizeof(line), "%s,%u,%.2f,%ld,%ld", signal.name, (unsigned)history.samples(), bytesPerSample, appendNs,
+             queryNs);
+    TEST_MESSAGE(line);
+    if (signal.name[0] == 't')
+    {
+      TEST_ASSERT_TRUE(bytesPerSample < 3.5); // raw: 6 bytes (time + value)
+    }
+  }
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_large_steps);
+  RUN_TEST(test_ring_drops_oldest_blocks);
+  RUN_TEST(test_time_range_and_wrap_around);
+  RUN_TEST(test_chunked_query_like_history_command);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,160 @@
+/*
+Tests of the RequestLanes: priority order, full rings and the lane statistics
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include "RequestLanes.h"
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_empty_lanes_leave_the_slot_to_bulk(void)
+{
+  RequestLanes lanes;
+  uint8_t priority = PRIORITY_CONTROL;
+  TEST_ASSERT_TRUE(lanes.peek(priority) == 0);
+  TEST_ASSERT_EQUAL_UINT8(PRIORITY_BULK, priority);
+}
+
+void test_strict_priority_order(void)
+{
+  RequestLanes lanes;
+  uint16_t value = 42;
+  TEST_ASSERT_TRUE(lanes.submitRead(1, 5, 0));
+  TEST_ASSERT_TRUE(lanes.submitRead(2, 6, 1));
+  TEST_ASSERT_TRUE(lanes.submitWrite(3, 0x0100, &value, 1, 2)); // submitted last, sent first
+  TEST_ASSERT_TRUE(lanes.submitWrite(4, 0x0200, &value, 1, 3));
+
+  const uint8_t order[4][2] = {{PRIORITY_CONTROL, 3}, {PRIORITY_CONTROL, 4}, {PRIORITY_ALARM, 1}, {PRIORITY_ALARM, 2}};
+  for (uint8_t n = 0; n < 4; ++n)
+  {
+    uint8_t priority;
+    const LaneRequest *req = lanes.peek(priority);
+    TEST_ASSERT_NOT_NULL(req);
+    TEST_ASSERT_EQUAL_UINT8(order[n][0], priority);
+    TEST_ASSERT_EQUAL_UINT8(order[n][1], req->serverID);
+    if (n == 2)
+    {
+      // a control write arriving meanwhile overtakes the waiting alarm reads
+      TEST_ASSERT_TRUE(lanes.submitWrite(5, 0x0300, &value, 1, 10));
+      req = lanes.peek(priority);
+      TEST_ASSERT_EQUAL_UINT8(PRIORITY_CONTROL, priority);
+      TEST_ASSERT_EQUAL_UINT8(5, req->serverID);
+      lanes.pop(priority);
+      req = lanes.peek(priority);
+      TEST_ASSERT_EQUAL_UINT8(PRIORITY_ALARM, priority);
+      TEST_ASSERT_EQUAL_UINT8(1, req->serverID);
+    }
+    lanes.pop(priority);
+  }
+  uint8_t priority;
+  TEST_ASSERT_TRUE(lanes.peek(priority) == 0);
+}
+
+void test_write_values_are_copied(void)
+{
+  RequestLanes lanes;
+  uint16_t values[3] = {1, 2, 3};
+  TEST_ASSERT_TRUE(lanes.submitWrite(7, 0x0010, values, 3, 0));
+  values[0] = 99;
+  uint8_t priority;
+  const LaneRequest *req = lanes.peek(priority);
+  TEST_ASSERT_EQUAL_UINT16(0x0010, req->address);
+  TEST_ASSERT_EQUAL_UINT16(3, req->count);
+  TEST_ASSERT_EQUAL_UINT16(1, req->values[0]);
+  TEST_ASSERT_EQUAL_UINT16(3, req->values[2]);
+}
+
+void test_full_ring_rejects(void)
+{
+  RequestLanes lanes;
+  for (uint16_t n = 0; n < LANE_QUEUE_SIZE; ++n)
+  {
+    TEST_ASSERT_TRUE(lanes.submitRead(1, n, n));
+  }
+  TEST_ASSERT_FALSE(lanes.submitRead(1, 99, 100));
+  TEST_ASSERT_EQUAL_UINT32(1, lanes.stats(PRIORITY_ALARM).rejected);
+
+  // the other class has its own ring
+  uint16_t value = 0;
+  TEST_ASSERT_TRUE(lanes.submitWrite(1, 0, &value, 1, 100));
+  TEST_ASSERT_EQUAL_UINT32(0, lanes.stats(PRIORITY_CONTROL).rejected);
+
+  // one slot free again, the rejected request is not in the ring
+  uint8_t priority;
+  lanes.pop(PRIORITY_CONTROL);
+  lanes.pop(PRIORITY_ALARM);
+  TEST_ASSERT_TRUE(lanes.submitRead(1, 50, 101));
+  for (uint16_t n = 1; n <= LANE_QUEUE_SIZE; ++n)
+  {
+    const LaneRequest *req = lanes.peek(priority);
+    TEST_ASSERT_EQUAL_UINT16(n < LANE_QUEUE_SIZE ? n : 50, req->request);
+    lanes.pop(priority);
+  }
+  TEST_ASSERT_TRUE(lanes.peek(priority) == 0);
+}
+
+void test_invalid_write_rejected(void)
+{
+  RequestLanes lanes;
+  uint16_t values[LANE_MAX_VALUES + 1] = {};
+  TEST_ASSERT_FALSE(lanes.submitWrite(1, 0, values, 0, 0));
+  TEST_ASSERT_FALSE(lanes.submitWrite(1, 0, values, LANE_MAX_VALUES + 1, 0));
+  TEST_ASSERT_TRUE(lanes.submitWrite(1, 0, values, LANE_MAX_VALUES, 0));
+  TEST_ASSERT_EQUAL_UINT32(2, lanes.stats(PRIORITY_CONTROL).rejected);
+}
+
+void test_drop_counts_as_failed(void)
+{
+  RequestLanes lanes;
+  TEST_ASSERT_TRUE(lanes.submitRead(1, 3, 0));
+  lanes.drop(PRIORITY_ALARM);
+  uint8_t priority;
+  TEST_ASSERT_TRUE(lanes.peek(priority) == 0);
+  TEST_ASSERT_EQUAL_UINT32(0, lanes.stats(PRIORITY_ALARM).requests);
+  TEST_ASSERT_EQUAL_UINT32(1, lanes.stats(PRIORITY_ALARM).failed);
+}
+
+void test_latency_figures(void)
+{
+  RequestLanes lanes;
+  lanes.sent(PRIORITY_CONTROL, 5, 1000);
+  lanes.completed(PRIORITY_CONTROL, true, 1020);
+  lanes.sent(PRIORITY_CONTROL, 15, 2000);
+  lanes.completed(PRIORITY_CONTROL, false, 2100);
+  lanes.sent(PRIORITY_BULK, 2, 3000);
+  lanes.completed(PRIORITY_BULK, true, 3040);
+
+  const LaneStats &control = lanes.stats(PRIORITY_CONTROL);
+  TEST_ASSERT_EQUAL_UINT32(2, control.requests);
+  TEST_ASSERT_EQUAL_UINT32(1, control.completed);
+  TEST_ASSERT_EQUAL_UINT32(1, control.failed);
+  TEST_ASSERT_EQUAL_UINT32(20, control.waitSum);
+  TEST_ASSERT_EQUAL_UINT32(15, control.waitMax);
+  TEST_ASSERT_EQUAL_UINT32(120, control.latencySum);
+  TEST_ASSERT_EQUAL_UINT32(100, control.latencyMax);
+
+  const LaneStats &bulk = lanes.stats(PRIORITY_BULK);
+  TEST_ASSERT_EQUAL_UINT32(1, bulk.requests);
+  TEST_ASSERT_EQUAL_UINT32(40, bulk.latencySum);
+  TEST_ASSERT_EQUAL_UINT32(0, lanes.stats(PRIORITY_ALARM).requests);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_lanes_leave_the_slot_to_bulk);
+  RUN_TEST(test_strict_priority_order);
+  RUN_TEST(test_write_values_are_copied);
+  RUN_TEST(test_full_ring_rejects);
+  RUN_TEST(test_invalid_write_rejected);
+  RUN_TEST(test_drop_counts_as_failed);
+  RUN_TEST(test_latency_figures);
+  return UNITY_END();
+}
@@ -0,0 +1,224 @@
+/*
+Tests of the retained mode LCD view against a fake framebuffer
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <string.h>
+#include "LcdView.h"
+
+// text size 2 of the M5Stack: 12 x 16 pixels per character, 320 x 240 pixels
+#define CHAR_WIDTH 12
+#define COLUMNS (320 / CHAR_WIDTH)
+#define LINES 240
+
+static char screen[LINES][COLUMNS + 1]; // one text line per pixel row a field starts at
+static uint32_t drawCalls;
+static uint32_t drawnChars;
+
+static void fakeDraw(uint16_t x, uint16_t y, const char *text)
+{
+  drawCalls++;
+  for (uint16_t c = x / CHAR_WIDTH; *text != 0 && c < COLUMNS; ++c, ++text)
+  {
+    screen[y][c] = *text;
+    drawnChars++;
+  }
+}
+
+static const char *line(uint16_t y)
+{
+  return screen[y];
+}
+
+void setUp(void)
+{
+  memset(screen, ' ', sizeof(screen));
+  for (uint16_t y = 0; y < LINES; ++y)
+  {
+    screen[y][COLUMNS] = 0;
+  }
+  drawCalls = 0;
+  drawnChars = 0;
+}
+
+void tearDown(void)
+{
+}
+
+void test_first_frame_draws_all_fields(void)
+{
+  LcdView view;
+  int16_t a = view.addField(0, 30, 10);
+  int16_t b = view.addField(0, 60, 10);
+  view.addField(0, 90, 10); // never printed
+  view.print(a, "Temp %d", 21);
+  view.print(b, "Hum %d", 45);
+  TEST_ASSERT_TRUE(view.render(0, &fakeDraw));
+  TEST_ASSERT_EQUAL_UINT32(2, drawCalls); // the empty field matches the empty screen
+  TEST_ASSERT_EQUAL_STRING_LEN("Temp 21 ", line(30), 8);
+  TEST_ASSERT_EQUAL_STRING_LEN("Hum 45 ", line(60), 7);
+}
+
+void test_unchanged_fields_are_not_drawn(void)
+{
+  LcdView view;
+  int16_t a = view.addField(0, 30, 10);
+  int16_t b = view.addField(0, 60, 10);
+  view.print(a, "Temp %d", 21);
+  view.print(b, "Hum %d", 45);
+  view.render(0, &fakeDraw);
+  drawCalls = 0;
+
+  view.print(a, "Temp %d", 21); // same text again
+  view.print(b, "Hum %d", 46);
+  view.render(1, &fakeDraw);
+  TEST_ASSERT_EQUAL_UINT32(1, drawCalls);
+  TEST_ASSERT_EQUAL_STRING_LEN("Hum 46", line(60), 6);
+
+  drawCalls = 0;
+  view.render(2, &fakeDraw);
+  TEST_ASSERT_EQUAL_UINT32(0, drawCalls);
+  TEST_ASSERT_EQUAL_UINT32(3, view.stats().frames);
+  TEST_ASSERT_EQUAL_UINT32(3, view.stats().fieldsDrawn);
+}
+
+void test_shorter_text_blanks_the_rest(void)
+{
+  LcdView view;
+  int16_t a = view.addField(24, 30, 12);
+  view.print(a, "Errors 12345");
+  view.render(0, &fakeDraw);
+  view.print(a, "Errors 7");
+  view.render(1, &fakeDraw);
+  TEST_ASSERT_EQUAL_STRING_LEN("  Errors 7      ", line(30), 16); // column 2 .. 13 and nothing behind it
+  TEST_ASSERT_EQUAL_UINT32(12 + 12, view.stats().charsDrawn); // the padding is counted
+}
+
+void test_text_is_cut_at_the_field_width(void)
+{
+  LcdView view;
+  int16_t a = view.addField(0, 30, 5);
+  int16_t b = view.addField(5 * CHAR_WIDTH, 30, 5);
+  view.print(a, "%s", "0123456789");
+  view.print(b, "%s", "abcde");
+  view.render(0, &fakeDraw);
+  TEST_ASSERT_EQUAL_STRING_LEN("01234abcde", line(30), 10); // no overlap with the next field
+}
+
+void test_frame_time_limits_the_rate(void)
+{
+  LcdView view(100);
+  int16_t a = view.addField(0, 30, 10);
+  view.print(a, "%d", 1);
+  TEST_ASSERT_TRUE(view.render(1000, &fakeDraw)); // the first frame is drawn at once
+  view.print(a, "%d", 2);
+  view.print(a, "%d", 3);
+  TEST_ASSERT_FALSE(view.render(1050, &fakeDraw));
+  TEST_ASSERT_FALSE(view.render(1099, &fakeDraw));
+  TEST_ASSERT_EQUAL_STRING_LEN("1 ", line(30), 2);
+  TEST_ASSERT_TRUE(view.render(1100, &fakeDraw)); // only the last text is drawn
+  TEST_ASSERT_EQUAL_STRING_LEN("3 ", line(30), 2);
+  TEST_ASSERT_EQUAL_UINT32(2, drawCalls);
+  TEST_ASSERT_EQUAL_UINT32(2, view.stats().frames);
+}
+
+void test_frame_time_over_millis_wrap_around(void)
+{
+  LcdView view(100);
+  int16_t a = view.addField(0, 30, 10);
+  view.print(a, "%d", 1);
+  view.render(0xFFFFFFC0, &fakeDraw);
+  view.print(a, "%d", 2);
+  TEST_ASSERT_FALSE(view.render(0x10, &fakeDraw)); // 80 ms later
+  TEST_ASSERT_TRUE(view.render(0x24, &fakeDraw));  // 100 ms later
+  TEST_ASSERT_EQUAL_STRING_LEN("2 ", line(30), 2);
+}
+
+void test_invalidate_redraws_the_cleared_screen(void)
+{
+  LcdView view;
+  int16_t a = view.addField(0, 30, 8);
+  int16_t b = view.addField(0, 60, 8);
+  view.addField(0, 90, 8); // empty
+  view.print(a, "abc");
+  view.print(b, "%s", "        "); // blank text of the full width
+  view.render(0, &fakeDraw);
+
+  memset(screen[30], '#', COLUMNS); // fillScreen() with garbage
+  memset(screen[60], '#', COLUMNS);
+  memset(screen[90], '#', COLUMNS);
+  drawCalls = 0;
+  view.invalidate();
+  view.render(1, &fakeDraw);
+  TEST_ASSERT_EQUAL_UINT32(3, drawCalls); // every field, the text and the area of the field
+  TEST_ASSERT_EQUAL_STRING_LEN("abc     #", line(30), 9);
+  TEST_ASSERT_EQUAL_STRING_LEN("        #", line(60), 9);
+  TEST_ASSERT_EQUAL_STRING_LEN("        #", line(90), 9);
+
+  drawCalls = 0;
+  view.render(2, &fakeDraw);
+  TEST_ASSERT_EQUAL_UINT32(0, drawCalls);
+}
+
+void test_layout_is_limited(void)
+{
+  LcdView view;
+  for (uint16_t i = 0; i < LCD_MAX_FIELDS; ++i)
+  {
+    TEST_ASSERT_EQUAL_INT16(i, view.addField(0, i, 1));
+  }
+  TEST_ASSERT_EQUAL_INT16(LcdView::NO_FIELD, view.addField(0, 0, 1));
+  view.print(LcdView::NO_FIELD, "ignored");
+  view.print(LCD_MAX_FIELDS, "ignored");
+  TEST_ASSERT_EQUAL_INT16(LcdView::NO_FIELD, view.addField(0, 0, 1));
+}
+
+// the screen of updateDisplay(): header and 6 values, polled every few seconds, drawn at 10 Hz
+void test_spi_load_of_the_main_screen(void)
+{
+  LcdView view(100);
+  int16_t header = view.addField(10, 30, 25);
+  int16_t fields[6];
+  for (uint8_t f = 0; f < 6; ++f)
+  {
+    fields[f] = view.addField(1, 60 + f * 30, 25);
+  }
+  uint32_t requests = 0;
+  uint32_t fullRedrawChars = 0;
+  for (uint32_t now = 0; now < 60000; now += 100)
+  {
+    requests += 3; // ~30 requests per second
+    view.print(header, "Requests %lu / Errors %lu", (unsigned long)requests, 0UL);
+    for (uint8_t f = 0; f < 6; ++f)
+    {
+      view.print(fields[f], "%-6s %7.1f", "Temp", (215 + (now / 5000 + f) % 3) / 10.0); // new value every 5 s
+    }
+    view.render(now, &fakeDraw);
+    fullRedrawChars += 7 * 25;
+  }
+  const LcdStats &stats = view.stats();
+  char message[96];
+  snprintf(message, sizeof(message), "frames,fields_drawn,chars_drawn,full_redraw_chars\n%lu,%lu,%lu,%lu",
+           (unsigned long)stats.frames, (unsigned long)stats.fieldsDrawn, (unsigned long)stats.charsDrawn,
+           (unsigned long)fullRedrawChars);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_UINT32(600, stats.frames);
+  TEST_ASSERT_EQUAL_UINT32(drawnChars, stats.charsDrawn);
+  TEST_ASSERT_LESS_THAN(fullRedrawChars / 4, stats.charsDrawn);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_frame_draws_all_fields);
+  RUN_TEST(test_unchanged_fields_are_not_drawn);
+  RUN_TEST(test_shorter_text_blanks_the_rest);
+  RUN_TEST(test_text_is_cut_at_the_field_width);
+  RUN_TEST(test_frame_time_limits_the_rate);
+  RUN_TEST(test_frame_time_over_millis_wrap_around);
+  RUN_TEST(test_invalidate_redraws_the_cleared_screen);
+  RUN_TEST(test_layout_is_limited);
+  RUN_TEST(test_spi_load_of_the_main_screen);
+  return UNITY_END();
+}
@@ -0,0 +1,77 @@
+/*
+Tests of the per bus counters of BusMetrics
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <thread>
+#include "BusMetrics.h"
+
+#define ERROR_TIMEOUT 0xE0
+#define ERROR_CRC 0xE2
+
+static BusMetrics metrics; // too large for the stack
+
+void setUp(void)
+{
+  metrics = BusMetrics();
+}
+
+void tearDown(void)
+{
+}
+
+void test_errors_are_counted_per_bus(void)
+{
+  metrics.error(0, 3, ERROR_TIMEOUT);
+  metrics.error(1, 40, ERROR_TIMEOUT);
+  metrics.error(1, 40, ERROR_CRC);
+  metrics.error(1, -1, 0x02); // no request known
+  metrics.error(MODBUS_MAX_BUSES, -1, ERROR_TIMEOUT); // ignored
+  TEST_ASSERT_EQUAL_UINT32(1, metrics.errorCount(0, ERROR_TIMEOUT));
+  TEST_ASSERT_EQUAL_UINT32(1, metrics.errorCount(1, ERROR_TIMEOUT));
+  TEST_ASSERT_EQUAL_UINT32(2, metrics.errorCount(ERROR_TIMEOUT));
+  TEST_ASSERT_EQUAL_UINT32(1, metrics.errorCount(1, 0x02));
+  TEST_ASSERT_EQUAL_UINT32(1, metrics.device(3).timeouts);
+  TEST_ASSERT_EQUAL_UINT32(1, metrics.device(40).timeouts);
+  TEST_ASSERT_EQUAL_UINT32(1, metrics.device(40).crcErrors);
+}
+
+void test_queue_depth_per_bus(void)
+{
+  metrics.queueDepth(0, 2);
+  metrics.queueDepth(0, 0);
+  metrics.queueDepth(1, 1);
+  TEST_ASSERT_EQUAL_UINT32(0, metrics.queueDepth(0));
+  TEST_ASSERT_EQUAL_UINT32(2, metrics.maxQueueDepth(0));
+  TEST_ASSERT_EQUAL_UINT32(1, metrics.queueDepth(1));
+  TEST_ASSERT_EQUAL_UINT32(1, metrics.maxQueueDepth(1));
+}
+
+// both bus tasks count timeouts at the same time: no increment is lost
+void test_two_bus_tasks(void)
+{
+  const uint32_t COUNT = 1000000;
+  std::thread bus0([]() {
+    for (uint32_t n = 0; n < COUNT; ++n)
+      metrics.error(0, 0, ERROR_TIMEOUT);
+  });
+  std::thread bus1([]() {
+    for (uint32_t n = 0; n < COUNT; ++n)
+      metrics.error(1, 1, ERROR_TIMEOUT);
+  });
+  bus0.join();
+  bus1.join();
+  TEST_ASSERT_EQUAL_UINT32(2 * COUNT, metrics.errorCount(ERROR_TIMEOUT));
+  TEST_ASSERT_EQUAL_UINT32(COUNT, metrics.device(0).timeouts);
+  TEST_ASSERT_EQUAL_UINT32(COUNT, metrics.device(1).timeouts);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_errors_are_counted_per_bus);
+  RUN_TEST(test_queue_depth_per_bus);
+  RUN_TEST(test_two_bus_tasks);
+  return UNITY_END();
+}
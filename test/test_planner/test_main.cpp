@@ -0,0 +1,127 @@
+/*
+Tests of the register range coalescing
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include "RegisterPlanner.h"
+
+#define MAX_TAGS 16
+
+static ModbusDevice requests[MAX_TAGS];
+static TagMapping mapping[MAX_TAGS];
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_adjacent_ranges_are_merged(void)
+{
+  static const ModbusDevice TAGS[] = {
+      {"b", 27, 0x03, 0x0110, 4, 0, 0, 1000, 0, FORMAT_DECIMAL, 0},
+      {"a", 27, 0x03, 0x0100, 16, 0, 0, 1000, 0, FORMAT_DECIMAL, 0}, // directly before "b"
+  };
+  uint16_t n = RegisterPlanner().plan(TAGS, 2, requests, mapping);
+  TEST_ASSERT_EQUAL_UINT16(1, n);
+  TEST_ASSERT_EQUAL_HEX16(0x0100, requests[0].startRegister);
+  TEST_ASSERT_EQUAL_UINT16(20, requests[0].numValues);
+  // every row keeps its place inside the response
+  TEST_ASSERT_EQUAL_UINT16(0, mapping[0].request);
+  TEST_ASSERT_EQUAL_UINT16(16, mapping[0].offset);
+  TEST_ASSERT_EQUAL_UINT16(0, mapping[1].request);
+  TEST_ASSERT_EQUAL_UINT16(0, mapping[1].offset);
+}
+
+void test_gap_limit(void)
+{
+  static const ModbusDevice TAGS[] = {
+      {"a", 27, 0x03, 0, 4, 0, 0, 1000, 0, FORMAT_DECIMAL, 0},
+      {"b", 27, 0x03, 8, 4, 0, 0, 1000, 0, FORMAT_DECIMAL, 0}, // gap of 4 registers
+  };
+  TEST_ASSERT_EQUAL_UINT16(2, RegisterPlanner(3).plan(TAGS, 2, requests, mapping));
+  TEST_ASSERT_EQUAL_UINT16(1, RegisterPlanner(4).plan(TAGS, 2, requests, mapping));
+  TEST_ASSERT_EQUAL_UINT16(12, requests[0].numValues); // the gap is read too
+  TEST_ASSERT_EQUAL_UINT16(8, mapping[1].offset);
+}
+
+void test_frame_limit(void)
+{
+  static const ModbusDevice TAGS[] = {
+      {"a", 27, 0x03, 0, 100, 0, 0, 1000, 0, FORMAT_DECIMAL, 0},
+      {"b", 27, 0x03, 100, 25, 0, 0, 1000, 0, FORMAT_DECIMAL, 0}, // exactly 125 together
+      {"c", 27, 0x03, 125, 1, 0, 0, 1000, 0, FORMAT_DECIMAL, 0},  // one too many
+  };
+  uint16_t n = RegisterPlanner(10).plan(TAGS, 3, requests, mapping);
+  TEST_ASSERT_EQUAL_UINT16(2, n);
+  TEST_ASSERT_EQUAL_UINT16(MODBUS_MAX_READ_REGISTERS, requests[0].numValues);
+  TEST_ASSERT_EQUAL_UINT16(125, requests[1].startRegister);
+  TEST_ASSERT_EQUAL_UINT16(1, mapping[2].request);
+  TEST_ASSERT_EQUAL_UINT16(0, mapping[2].offset);
+  // a smaller limit of the planner
+  TEST_ASSERT_EQUAL_UINT16(2, RegisterPlanner(10, 100).plan(TAGS, 3, requests, mapping));
+  TEST_ASSERT_EQUAL_UINT16(100, requests[0].numValues);
+  TEST_ASSERT_EQUAL_UINT16(100, requests[1].startRegister);
+  TEST_ASSERT_EQUAL_UINT16(26, requests[1].numValues);
+}
+
+void test_server_function_and_bus_are_never_merged(void)
+{
+  static const ModbusDevice TAGS[] = {
+      {"a", 27, 0x03, 0, 4, 0, 0, 1000, 0, FORMAT_DECIMAL, 0},
+      {"server", 28, 0x03, 4, 4, 0, 0, 1000, 0, FORMAT_DECIMAL, 0},
+      {"function", 27, 0x04, 4, 4, 0, 0, 1000, 0, FORMAT_DECIMAL, 0},
+      {"bus", 27, 0x03, 4, 4, 0, 0, 1000, 0, FORMAT_DECIMAL, 1},
+  };
+  uint16_t n = RegisterPlanner(10).plan(TAGS, 4, requests, mapping);
+  TEST_ASSERT_EQUAL_UINT16(4, n);
+  for (uint16_t t = 0; t < 4; ++t)
+  {
+    const ModbusDevice &req = requests[mapping[t].request];
+    TEST_ASSERT_EQUAL_UINT8(TAGS[t].serverID, req.serverID);
+    TEST_ASSERT_EQUAL_UINT8(TAGS[t].functionCode, req.functionCode);
+    TEST_ASSERT_EQUAL_UINT8(TAGS[t].bus, req.bus);
+    TEST_ASSERT_EQUAL_UINT16(0, mapping[t].offset);
+  }
+  TEST_ASSERT_EQUAL_UINT8(1, requests[3].bus); // the requests are sorted by bus
+}
+
+void test_merged_timing_is_the_strictest(void)
+{
+  static const ModbusDevice TAGS[] = {
+      {"a", 1, 0x04, 1, 2, 100, 500, 30000, 0, FORMAT_TENTHS, 0},
+      {"b", 1, 0x04, 3, 2, 300, 200, 10000, 2000, FORMAT_TENTHS, 0},
+  };
+  RegisterPlanner().plan(TAGS, 2, requests, mapping);
+  TEST_ASSERT_EQUAL_UINT32(300, requests[0].guardBefore);
+  TEST_ASSERT_EQUAL_UINT32(500, requests[0].guardAfter);
+  TEST_ASSERT_EQUAL_UINT32(10000, requests[0].pollPeriod);
+  TEST_ASSERT_EQUAL_UINT32(2000, requests[0].deadline);
+}
+
+void test_row_on_missing_bus_is_not_polled(void)
+{
+  static const ModbusDevice TAGS[] = {
+      {"a", 27, 0x03, 0, 4, 0, 0, 1000, 0, FORMAT_DECIMAL, 0},
+      {"nowhere", 27, 0x03, 0, 4, 0, 0, 1000, 0, FORMAT_DECIMAL, MODBUS_MAX_BUSES},
+  };
+  uint16_t n = RegisterPlanner().plan(TAGS, 2, requests, mapping);
+  TEST_ASSERT_EQUAL_UINT16(1, n);
+  TEST_ASSERT_EQUAL_UINT16(0, mapping[0].request);
+  TEST_ASSERT_EQUAL_UINT16(RegisterPlanner::NO_REQUEST, mapping[1].request); // not decoded as request 0
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_adjacent_ranges_are_merged);
+  RUN_TEST(test_gap_limit);
+  RUN_TEST(test_frame_limit);
+  RUN_TEST(test_server_function_and_bus_are_never_merged);
+  RUN_TEST(test_merged_timing_is_the_strictest);
+  RUN_TEST(test_row_on_missing_bus_is_not_polled);
+  return UNITY_END();
+}
@@ -0,0 +1,235 @@
+/*
+Host replay of a recorded trace
+
+A bus with simulated servers (timeouts, CRC errors, a server disturbing the
+bus) is polled like a bus task of main.cpp and captured with TraceRecorder:
+scheduler, dispatcher tokens, the stub client, then validate(), decode and
+the register snapshots in the response callback. The trace is replayed
+through the same path with TraceReplay on the fake clock, which has to give
+the same requests, errors and register values.
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <ModbusClientRTU.h>
+#include <map>
+#include "PollScheduler.h"
+#include "RegisterDecode.h"
+#include "RegisterPlanner.h"
+#include "RegisterSnapshot.h"
+#include "RequestDispatcher.h"
+#include "SimulatedBus.h"
+#include "TraceRecorder.h"
+#include "TraceReplay.h"
+
+#define BAUDRATE 9600
+#define TIMEOUT 500
+#define DURATION 120000 // [ms] of polling
+
+static const SimServer SERVERS[] = {
+    // ID, latency, timeoutRate, crcRate, disturbTime
+    {1, 40, 20, 10, 300}, // XY-MD02: disturbs the bus after its answer
+    {27, 10, 5, 5, 0},
+    {42, 15, 5, 5, 0},
+};
+
+static const ModbusDevice REQUESTS[] = {
+    {"XY-MD02", 1, 0x04, 0x0001, 2, 100, 300, 2000, 0, FORMAT_TENTHS, 0},
+    {"Atom", 27, 0x03, 0x012C, 20, 0, 20, 500, 0, FORMAT_DECIMAL, 0},
+    {"Nano", 42, 0x03, 0x0000, 8, 0, 20, 1000, 0, FORMAT_DECIMAL, 0},
+    {"Atom-2", 27, 0x04, 0x0010, 4, 0, 20, 700, 0, FORMAT_DECIMAL, 0},
+};
+static const uint16_t NUM_REQUESTS = sizeof(REQUESTS) / sizeof(REQUESTS[0]);
+
+// device table rows: one per request, the Atom request also feeds a second row
+static const TagMapping TAGS[] = {{0, 0}, {1, 0}, {2, 0}, {3, 0}, {1, 10}};
+static const uint16_t TAG_VALUES[] = {2, 10, 8, 4, 10};
+static const uint16_t NUM_TAGS = sizeof(TAGS) / sizeof(TAGS[0]);
+
+static uint8_t traceBuffer[256 * 1024];
+
+// one bus of main.cpp: bus task and callbacks, without guard tuner and lanes
+class HostBus
+{
+public:
+  HostBus(SimulatedBus &servers, TraceRecorder *recorder)
+      : client(Serial),
+        scheduler(REQUESTS, NUM_REQUESTS),
+        dispatcher(REQUESTS, NUM_REQUESTS, TAGS, NUM_TAGS),
+        sent(0),
+        responses(0),
+        dropped(0),
+        _recorder(recorder)
+  {
+    client.attach(servers);
+    client.setTimeout(TIMEOUT);
+    client.onDataHandler([this](ModbusMessage response, uint32_t token) { handleData(response, token); });
+    client.onErrorHandler([this](Error error, uint32_t token) { handleError(error, token); });
+  }
+
+  void run(uint32_t duration)
+  {
+    uint32_t end = millis() + duration;
+    scheduler.begin(millis());
+    while ((int32_t)(millis() - end) < 0)
+    {
+      uint32_t waitTime;
+      int16_t index = scheduler.next(millis(), waitTime);
+      if (index == PollScheduler::NO_DEVICE)
+      {
+        FakeClock::advance(waitTime > 0 ? waitTime : 1);
+        continue;
+      }
+      const ModbusDevice &dev = REQUESTS[index];
+      if (_recorder != 0)
+        _recorder->request(micros(), dev.serverID, dev.functionCode, dev.startRegister, dev.numValues);
+      client.addRequest(dispatcher.nextToken(index, false, 2), dev.serverID, dev.functionCode, dev.startRegister, dev.numValues);
+      scheduler.issued(index, millis());
+      sent++;
+      client.process(); // the response callback runs before the next slot
+    }
+  }
+
+  ModbusClientRTU client;
+  PollScheduler scheduler;
+  RequestDispatcher dispatcher;
+  RegisterSnapshot snapshots[NUM_TAGS];
+  std::map<uint8_t, uint32_t> errors; // by eModbus error code
+  uint32_t sent;
+  uint32_t responses;
+  uint32_t dropped;
+
+protected:
+  void handleData(const ModbusMessage &response, uint32_t token)
+  {
+    if (_recorder != 0)
+      _recorder->response(micros(), response.data(), response.size());
+    uint8_t byteCount = response.size() > 2 ? response[2] : 0;
+    int16_t index = dispatcher.validate(0, token, response.getServerID(), response.getFunctionCode(), byteCount, response.size());
+    if (index == RequestDispatcher::NO_REQUEST)
+    {
+      dropped++;
+      return;
+    }
+    responses++;
+    const uint16_t *tags = dispatcher.tags(index);
+    for (uint16_t t = 0; t < dispatcher.numTags(index); ++t)
+    {
+      uint16_t d = tags[t];
+      uint16_t *values = snapshots[d].beginWrite();
+      if (decodeRegisters(response.data() + 3 + 2 * TAGS[d].offset, response.size() - 3 - 2 * TAGS[d].offset, values,
+                          TAG_VALUES[d]))
+      {
+        snapshots[d].commit(millis(), TAG_VALUES[d]);
+      }
+    }
+  }
+
+  void handleError(Error error, uint32_t)
+  {
+    if (_recorder != 0)
+      _recorder->error(micros(), error);
+    errors[error]++;
+  }
+
+  TraceRecorder *_recorder;
+};
+
+static TraceRecorder recorder;
+
+// records DURATION ms of polling the simulated servers, the trace is in traceBuffer
+static void record(HostBus *&bus, SimulatedBus *&servers)
+{
+  FakeClock::set(1000);
+  servers = new SimulatedBus(BAUDRATE, SERVERS, sizeof(SERVERS) / sizeof(SERVERS[0]), 12345);
+  bus = new HostBus(*servers, &recorder);
+  recorder.begin(traceBuffer, sizeof(traceBuffer));
+  recorder.start(0, BAUDRATE, micros());
+  bus->run(DURATION);
+  recorder.stop();
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_replay_reproduces_the_recording(void)
+{
+  HostBus *original;
+  SimulatedBus *servers;
+  record(original, servers);
+  TEST_ASSERT_EQUAL_UINT32(0, recorder.dropped());
+  TEST_ASSERT_GREATER_THAN(0, servers->stats().timeouts);
+  TEST_ASSERT_GREATER_THAN(0, servers->stats().crcErrors);
+
+  FakeClock::set(1000);
+  TraceReplay replay(BAUDRATE);
+  TEST_ASSERT_TRUE(replay.begin(recorder.data(), recorder.length()));
+  HostBus *replayed = new HostBus(replay, 0);
+  replayed->run(DURATION);
+
+  TEST_ASSERT_EQUAL_UINT32(original->sent, replayed->sent);
+  TEST_ASSERT_EQUAL_UINT32(original->sent, replay.replayed());
+  TEST_ASSERT_EQUAL_UINT32(0, replay.missing());
+  TEST_ASSERT_EQUAL_UINT32(original->responses, replayed->responses);
+  TEST_ASSERT_EQUAL_UINT32(0, replayed->dropped);
+  TEST_ASSERT_TRUE(original->errors == replayed->errors); // timeouts and CRC errors at the same requests
+  for (uint16_t d = 0; d < NUM_TAGS; ++d)
+  {
+    SnapshotData a, b;
+    TEST_ASSERT_TRUE(original->snapshots[d].read(a));
+    TEST_ASSERT_TRUE(replayed->snapshots[d].read(b));
+    TEST_ASSERT_EQUAL_UINT32(a.sequence, b.sequence);
+    TEST_ASSERT_EQUAL_UINT32(a.timestamp, b.timestamp); // same turnarounds: same schedule
+    TEST_ASSERT_EQUAL_UINT16(TAG_VALUES[d], b.numValues);
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(a.values, b.values, TAG_VALUES[d]);
+  }
+  delete replayed;
+  delete original;
+  delete servers;
+}
+
+void test_unknown_request_times_out(void)
+{
+  HostBus *original;
+  SimulatedBus *servers;
+  record(original, servers);
+  TraceReplay replay(BAUDRATE);
+  replay.begin(recorder.data(), recorder.length());
+
+  uint8_t frame[3 + 2 * MODBUS_MAX_READ_REGISTERS];
+  uint16_t length;
+  SIM_RESULT result;
+  TEST_ASSERT_EQUAL_UINT32(TIMEOUT, replay.transfer(27, 0x03, 0x0999, 1, 0, 0, TIMEOUT, frame, length, result));
+  TEST_ASSERT_EQUAL(SIM_TIMEOUT, result);
+  TEST_ASSERT_EQUAL_UINT32(1, replay.missing());
+  // a recorded request is found again, the trace is replayed in a loop
+  for (uint32_t n = 0; n < 2 * original->sent; ++n)
+  {
+    replay.transfer(27, 0x03, 0x012C, 20, 0, 0, TIMEOUT, frame, length, result);
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, replay.missing());
+  delete original;
+  delete servers;
+}
+
+void test_damaged_trace_is_rejected(void)
+{
+  TraceReplay replay(BAUDRATE);
+  const uint8_t garbage[] = {'M', 'B', 'T', 'X', TRACE_VERSION, 0, 0x80, 0x25, 0, 0};
+  TEST_ASSERT_FALSE(replay.begin(garbage, sizeof(garbage)));
+  TEST_ASSERT_FALSE(replay.begin(garbage, 4));
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_reproduces_the_recording);
+  RUN_TEST(test_unknown_request_times_out);
+  RUN_TEST(test_damaged_trace_is_rejected);
+  return UNITY_END();
+}
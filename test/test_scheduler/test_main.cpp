@@ -0,0 +1,253 @@
+/*
+Tests of the PollScheduler with a fake clock
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <Arduino.h>
+#include "PollScheduler.h"
+
+// polls the scheduler like a bus task until <end>, every request occupies the bus for <transfer> ms
+static uint32_t run(PollScheduler &scheduler, uint32_t end, uint32_t transfer, uint32_t *requests, uint32_t *sentAt = 0)
+{
+  uint32_t total = 0;
+  while ((int32_t)(millis() - end) < 0)
+  {
+    uint32_t waitTime;
+    int16_t index = scheduler.next(millis(), waitTime);
+    if (index == PollScheduler::NO_DEVICE)
+    {
+      FakeClock::advance(waitTime > 0 ? waitTime : 1);
+      continue;
+    }
+    requests[index]++;
+    if (sentAt != 0)
+    {
+      sentAt[total] = millis();
+    }
+    total++;
+    scheduler.issued(index, millis());
+    FakeClock::advance(transfer);
+  }
+  return total;
+}
+
+void setUp(void)
+{
+  FakeClock::set(1000);
+}
+
+void tearDown(void)
+{
+}
+
+void test_periods_are_kept(void)
+{
+  static const ModbusDevice DEVICES[] = {
+      {"a", 1, 0x03, 0, 2, 0, 0, 100, 0, FORMAT_DECIMAL, 0},
+      {"b", 2, 0x03, 0, 2, 0, 0, 250, 0, FORMAT_DECIMAL, 0},
+      {"c", 3, 0x03, 0, 2, 0, 0, 1000, 0, FORMAT_DECIMAL, 0},
+  };
+  PollScheduler scheduler(DEVICES, 3);
+  scheduler.begin(millis());
+  uint32_t requests[3] = {0, 0, 0};
+  run(scheduler, millis() + 10000, 5, requests);
+  TEST_ASSERT_UINT32_WITHIN(1, 100, requests[0]);
+  TEST_ASSERT_UINT32_WITHIN(1, 40, requests[1]);
+  TEST_ASSERT_UINT32_WITHIN(1, 10, requests[2]);
+  for (uint16_t i = 0; i < 3; ++i)
+  {
+    TEST_ASSERT_EQUAL_UINT32(0, scheduler.missedDeadlines(i));
+  }
+}
+
+void test_earliest_deadline_first(void)
+{
+  static const ModbusDevice DEVICES[] = {
+      {"late", 1, 0x03, 0, 2, 0, 0, 1000, 500, FORMAT_DECIMAL, 0},
+      {"urgent", 2, 0x03, 0, 2, 0, 0, 1000, 50, FORMAT_DECIMAL, 0},
+      {"period", 3, 0x03, 0, 2, 0, 0, 200, 0, FORMAT_DECIMAL, 0},
+  };
+  PollScheduler scheduler(DEVICES, 3);
+  scheduler.begin(millis());
+  uint32_t waitTime;
+  TEST_ASSERT_EQUAL_INT16(1, scheduler.next(millis(), waitTime)); // deadline 50
+  scheduler.issued(1, millis());
+  TEST_ASSERT_EQUAL_INT16(2, scheduler.next(millis(), waitTime)); // deadline 200
+  scheduler.issued(2, millis());
+  TEST_ASSERT_EQUAL_INT16(0, scheduler.next(millis(), waitTime)); // deadline 500
+  scheduler.issued(0, millis());
+  TEST_ASSERT_EQUAL_INT16(PollScheduler::NO_DEVICE, scheduler.next(millis(), waitTime));
+  TEST_ASSERT_EQUAL_UINT32(200, waitTime); // the next period of "period"
+}
+
+void test_guard_times(void)
+{
+  // XY-MD02 like device: 1000 ms silence before and after its request
+  static const ModbusDevice DEVICES[] = {
+      {"slow", 1, 0x04, 1, 2, 1000, 1000, 5000, 0, FORMAT_TENTHS, 0},
+      {"fast", 2, 0x03, 0, 8, 0, 50, 5000, 0, FORMAT_DECIMAL, 0},
+  };
+  PollScheduler scheduler(DEVICES, 2);
+  uint32_t start = millis();
+  scheduler.begin(start);
+  uint32_t requests[2] = {0, 0};
+  uint32_t sentAt[8];
+  int16_t order[8];
+  uint16_t n = 0;
+  while (n < 4)
+  {
+    uint32_t waitTime;
+    int16_t index = scheduler.next(millis(), waitTime);
+    if (index == PollScheduler::NO_DEVICE)
+    {
+      FakeClock::advance(waitTime);
+      continue;
+    }
+    order[n] = index;
+    sentAt[n++] = millis();
+    requests[index]++;
+    scheduler.issued(index, millis());
+  }
+  // the fast device fills the guard time before the slow one, the guardBefore of the slow one
+  // starts after the guardAfter of the fast one
+  TEST_ASSERT_EQUAL_INT16(1, order[0]);
+  TEST_ASSERT_EQUAL_UINT32(start, sentAt[0]);
+  TEST_ASSERT_EQUAL_INT16(0, order[1]);
+  TEST_ASSERT_EQUAL_UINT32(start + 50 + 1000, sentAt[1]);
+  // next period: both due, the slow one is first in the table and its guard time is over
+  TEST_ASSERT_EQUAL_INT16(0, order[2]);
+  TEST_ASSERT_EQUAL_UINT32(start + 5000, sentAt[2]);
+  TEST_ASSERT_EQUAL_INT16(1, order[3]);
+  TEST_ASSERT_EQUAL_UINT32(start + 6000, sentAt[3]); // waits for the guardAfter of the slow one
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.missedDeadlines(0) + scheduler.missedDeadlines(1));
+}
+
+void test_gap_filled_only_within_deadline(void)
+{
+  static const ModbusDevice DEVICES[] = {
+      {"head", 1, 0x03, 0, 2, 500, 0, 10000, 800, FORMAT_DECIMAL, 0},
+      {"filler", 2, 0x03, 0, 2, 0, 200, 10000, 0, FORMAT_DECIMAL, 0},
+      {"long", 3, 0x03, 0, 2, 0, 1000, 10000, 0, FORMAT_DECIMAL, 0},
+  };
+  PollScheduler scheduler(DEVICES, 3);
+  scheduler.begin(millis());
+  scheduler.occupy(millis(), 0);
+  uint32_t waitTime;
+  // head needs 500 ms silence first: the filler (guardAfter 200) fits into the 800 ms deadline,
+  // "long" (guardAfter 1000) would push head behind it
+  TEST_ASSERT_EQUAL_INT16(1, scheduler.next(millis(), waitTime));
+  scheduler.issued(1, millis());
+  TEST_ASSERT_EQUAL_INT16(PollScheduler::NO_DEVICE, scheduler.next(millis(), waitTime));
+  TEST_ASSERT_EQUAL_UINT32(200, waitTime);
+  FakeClock::advance(waitTime);
+  // bus free again, head still waits for its guardBefore: "long" would still break the deadline
+  TEST_ASSERT_EQUAL_INT16(PollScheduler::NO_DEVICE, scheduler.next(millis(), waitTime));
+  TEST_ASSERT_EQUAL_UINT32(500, waitTime);
+  FakeClock::advance(waitTime);
+  TEST_ASSERT_EQUAL_INT16(0, scheduler.next(millis(), waitTime));
+  scheduler.issued(0, millis());
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.missedDeadlines(0));
+  TEST_ASSERT_EQUAL_INT16(2, scheduler.next(millis(), waitTime));
+}
+
+void test_overload_counts_missed_deadlines(void)
+{
+  // 3 devices every 100 ms, but every transfer takes 60 ms
+  static const ModbusDevice DEVICES[] = {
+      {"a", 1, 0x03, 0, 2, 0, 0, 100, 0, FORMAT_DECIMAL, 0},
+      {"b", 2, 0x03, 0, 2, 0, 0, 100, 0, FORMAT_DECIMAL, 0},
+      {"c", 3, 0x03, 0, 2, 0, 0, 100, 0, FORMAT_DECIMAL, 0},
+  };
+  PollScheduler scheduler(DEVICES, 3);
+  scheduler.begin(millis());
+  uint32_t requests[3] = {0, 0, 0};
+  uint32_t total = run(scheduler, millis() + 6000, 60, requests);
+  TEST_ASSERT_UINT32_WITHIN(1, 100, total); // the bus is the limit
+  uint32_t missed = 0;
+  for (uint16_t i = 0; i < 3; ++i)
+  {
+    TEST_ASSERT_UINT32_WITHIN(1, total / 3, requests[i]); // nobody starves
+    missed += scheduler.missedDeadlines(i);
+  }
+  TEST_ASSERT_GREATER_THAN(0, missed);
+}
+
+void test_no_catch_up_after_stall(void)
+{
+  static const ModbusDevice DEVICES[] = {
+      {"a", 1, 0x03, 0, 2, 0, 0, 100, 0, FORMAT_DECIMAL, 0},
+  };
+  PollScheduler scheduler(DEVICES, 1);
+  scheduler.begin(millis());
+  uint32_t waitTime;
+  scheduler.issued(scheduler.next(millis(), waitTime), millis());
+  FakeClock::advance(1050); // e.g. a blocked task: 10 periods missed
+  TEST_ASSERT_EQUAL_INT16(0, scheduler.next(millis(), waitTime));
+  scheduler.issued(0, millis());
+  TEST_ASSERT_EQUAL_UINT32(1, scheduler.missedDeadlines(0));
+  TEST_ASSERT_EQUAL_UINT32(950, scheduler.lateness(0));
+  // the next request one period later, not a burst of the missed ones
+  TEST_ASSERT_EQUAL_INT16(PollScheduler::NO_DEVICE, scheduler.next(millis(), waitTime));
+  TEST_ASSERT_EQUAL_UINT32(100, waitTime);
+}
+
+void test_defer_until(void)
+{
+  static const ModbusDevice DEVICES[] = {
+      {"a", 1, 0x03, 0, 2, 0, 0, 100, 0, FORMAT_DECIMAL, 0},
+      {"b", 2, 0x03, 0, 2, 0, 0, 100, 0, FORMAT_DECIMAL, 0},
+  };
+  PollScheduler scheduler(DEVICES, 2);
+  scheduler.begin(millis());
+  scheduler.deferUntil(0, millis() + 5000); // quarantined
+  uint32_t requests[2] = {0, 0};
+  run(scheduler, millis() + 5000, 5, requests);
+  TEST_ASSERT_EQUAL_UINT32(0, requests[0]);
+  TEST_ASSERT_UINT32_WITHIN(1, 50, requests[1]);
+  run(scheduler, millis() + 1000, 5, requests);
+  TEST_ASSERT_UINT32_WITHIN(1, 10, requests[0]);
+}
+
+void test_millis_wrap_around(void)
+{
+  static const ModbusDevice DEVICES[] = {
+      {"a", 1, 0x03, 0, 2, 0, 20, 100, 0, FORMAT_DECIMAL, 0},
+      {"b", 2, 0x03, 0, 2, 50, 0, 1000, 0, FORMAT_DECIMAL, 0},
+  };
+  FakeClock::set(0xFFFFFFFF - 2000); // millis() wraps after 49.7 days
+  PollScheduler scheduler(DEVICES, 2);
+  scheduler.begin(millis());
+  uint32_t requests[2] = {0, 0};
+  run(scheduler, millis() + 4000, 5, requests);
+  TEST_ASSERT_LESS_THAN(10000, millis()); // wrapped
+  TEST_ASSERT_UINT32_WITHIN(1, 40, requests[0]);
+  TEST_ASSERT_UINT32_WITHIN(1, 4, requests[1]);
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.missedDeadlines(0) + scheduler.missedDeadlines(1));
+}
+
+void test_table_is_truncated(void)
+{
+  static ModbusDevice devices[POLL_MAX_DEVICES + 4];
+  for (uint16_t i = 0; i < POLL_MAX_DEVICES + 4; ++i)
+  {
+    devices[i] = {"d", (uint8_t)(1 + i % 247), 0x03, 0, 2, 0, 0, 1000, 0, FORMAT_DECIMAL, 0};
+  }
+  PollScheduler scheduler(devices, POLL_MAX_DEVICES + 4);
+  TEST_ASSERT_EQUAL_UINT16(POLL_MAX_DEVICES, scheduler.numDevices());
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_periods_are_kept);
+  RUN_TEST(test_earliest_deadline_first);
+  RUN_TEST(test_guard_times);
+  RUN_TEST(test_gap_filled_only_within_deadline);
+  RUN_TEST(test_overload_counts_missed_deadlines);
+  RUN_TEST(test_no_catch_up_after_stall);
+  RUN_TEST(test_defer_until);
+  RUN_TEST(test_millis_wrap_around);
+  RUN_TEST(test_table_is_truncated);
+  return UNITY_END();
+}
@@ -0,0 +1,295 @@
+/*
+Regression tests of the simulated RTU bus and the stub client on top of it
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <ModbusClientRTU.h>
+#include "PollScheduler.h"
+#include "RegisterDecode.h"
+#include "RequestDispatcher.h"
+#include "SimulatedBus.h"
+
+#define BAUDRATE 9600
+
+static const SimServer SERVERS[] = {
+    // ID, latency, timeoutRate, crcRate, disturbTime
+    {1, 20, 0, 0, 0},
+    {2, 10, 0, 0, 0},
+    {3, 10, 0, 0, 100}, // disturbs the bus like the XY-MD02
+};
+static const uint16_t NUM_SERVERS = sizeof(SERVERS) / sizeof(SERVERS[0]);
+
+static uint8_t frame[3 + 2 * MODBUS_MAX_READ_REGISTERS];
+static uint16_t length;
+static SIM_RESULT result;
+
+void setUp(void)
+{
+  FakeClock::set(0);
+}
+
+void tearDown(void)
+{
+}
+
+void test_read_wire_time(void)
+{
+  SimulatedBus bus(BAUDRATE, SERVERS, NUM_SERVERS);
+  // 8 byte request + 25 byte response with gaps = 41.6 ms on the wire, + 20 ms latency
+  uint32_t time = bus.transfer(1, 0x03, 0, 10, 0, 0, 2000, frame, length, result);
+  TEST_ASSERT_EQUAL(SIM_OK, result);
+  TEST_ASSERT_EQUAL_UINT32(62, time);
+  TEST_ASSERT_EQUAL_UINT16(3 + 2 * 10, length);
+  TEST_ASSERT_EQUAL_HEX8(1, frame[0]);
+  TEST_ASSERT_EQUAL_HEX8(0x03, frame[1]);
+  TEST_ASSERT_EQUAL_UINT8(20, frame[2]);
+  TEST_ASSERT_EQUAL_UINT32(62, bus.stats().busTime);
+}
+
+void test_unknown_server_times_out(void)
+{
+  SimulatedBus bus(BAUDRATE, SERVERS, NUM_SERVERS);
+  uint32_t time = bus.transfer(99, 0x03, 0, 1, 0, 0, 500, frame, length, result);
+  TEST_ASSERT_EQUAL(SIM_TIMEOUT, result);
+  TEST_ASSERT_EQUAL_UINT32(500, time);
+  TEST_ASSERT_EQUAL_UINT32(1, bus.stats().timeouts);
+}
+
+void test_illegal_count_is_exception(void)
+{
+  SimulatedBus bus(BAUDRATE, SERVERS, NUM_SERVERS);
+  bus.transfer(1, 0x03, 0, MODBUS_MAX_READ_REGISTERS + 1, 0, 0, 2000, frame, length, result);
+  TEST_ASSERT_EQUAL(SIM_OK, result);
+  TEST_ASSERT_EQUAL_UINT16(3, length);
+  TEST_ASSERT_EQUAL_HEX8(0x83, frame[1]);
+  TEST_ASSERT_EQUAL_HEX8(0x03, frame[2]);
+}
+
+void test_write_then_read(void)
+{
+  SimulatedBus bus(BAUDRATE, SERVERS, NUM_SERVERS);
+  const uint16_t values[] = {1000, 2000, 3000};
+  bus.transfer(2, 0x10, 4, 3, values, 0, 2000, frame, length, result);
+  TEST_ASSERT_EQUAL(SIM_OK, result);
+  TEST_ASSERT_EQUAL_HEX8(0x10, frame[1]);
+  bus.transfer(2, 0x06, 7, 4000, 0, 100, 2000, frame, length, result);
+  TEST_ASSERT_EQUAL(SIM_OK, result);
+
+  bus.transfer(2, 0x03, 4, 4, 0, 200, 2000, frame, length, result);
+  uint16_t read[4];
+  decodeRegisters(frame + 3, frame[2], read, 4);
+  for (uint16_t i = 0; i < 3; ++i)
+  {
+    TEST_ASSERT_INT_WITHIN(1, values[i], read[i]); // random walk of one step
+  }
+  TEST_ASSERT_INT_WITHIN(1, 4000, read[3]);
+}
+
+void test_disturbing_server_breaks_next_request(void)
+{
+  SimulatedBus bus(BAUDRATE, SERVERS, NUM_SERVERS);
+  uint32_t now = 0;
+  now += bus.transfer(3, 0x03, 0, 2, 0, now, 2000, frame, length, result);
+  TEST_ASSERT_EQUAL(SIM_OK, result);
+  // inside the disturb time: every other server gets a CRC error, the disturber itself not
+  now += bus.transfer(1, 0x03, 0, 2, 0, now, 2000, frame, length, result);
+  TEST_ASSERT_EQUAL(SIM_CRC_ERROR, result);
+  now += bus.transfer(3, 0x03, 0, 2, 0, now, 2000, frame, length, result);
+  TEST_ASSERT_EQUAL(SIM_OK, result);
+  // after the disturb time the bus is clean again
+  now += 100;
+  bus.transfer(1, 0x03, 0, 2, 0, now, 2000, frame, length, result);
+  TEST_ASSERT_EQUAL(SIM_OK, result);
+  TEST_ASSERT_EQUAL_UINT32(1, bus.stats().disturbed);
+  TEST_ASSERT_EQUAL_UINT32(1, bus.stats().crcErrors);
+}
+
+void test_same_seed_same_faults(void)
+{
+  static const SimServer FLAKY[] = {{1, 10, 200, 200, 0}};
+  SimulatedBus a(BAUDRATE, FLAKY, 1, 42);
+  SimulatedBus b(BAUDRATE, FLAKY, 1, 42);
+  SIM_RESULT resultB;
+  for (uint16_t n = 0; n < 500; ++n)
+  {
+    a.transfer(1, 0x03, 0, 2, 0, n * 100, 500, frame, length, result);
+    b.transfer(1, 0x03, 0, 2, 0, n * 100, 500, frame, length, resultB);
+    TEST_ASSERT_EQUAL(result, resultB);
+  }
+  TEST_ASSERT_EQUAL_UINT32(a.stats().timeouts, b.stats().timeouts);
+  TEST_ASSERT_UINT32_WITHIN(40, 100, a.stats().timeouts); // 20 % of 500
+  TEST_ASSERT_GREATER_THAN(0, a.stats().crcErrors);
+}
+
+// the polling of main.cpp in small: scheduler, dispatcher and the client stub
+void test_poll_cycle_over_client_stub(void)
+{
+  static const ModbusDevice DEVICES[] = {
+      {"fast", 1, 0x03, 0, 4, 0, 5, 200, 0, FORMAT_DECIMAL, 0},
+      {"slow", 2, 0x04, 10, 2, 10, 10, 1000, 0, FORMAT_DECIMAL, 0},
+  };
+  static const TagMapping MAPPING[] = {{0, 0}, {1, 0}};
+  SimulatedBus bus(BAUDRATE, SERVERS, NUM_SERVERS);
+  HardwareSerial serial;
+  ModbusClientRTU client(serial);
+  client.attach(bus);
+  PollScheduler scheduler(DEVICES, 2);
+  RequestDispatcher dispatcher(DEVICES, 2, MAPPING, 2);
+
+  uint32_t responses[2] = {0, 0};
+  uint16_t values[4];
+  bool valuesOk = true;
+  client.onDataHandler([&](ModbusMessage response, uint32_t token) {
+    int16_t index = dispatcher.validate(0, token, response.getServerID(), response.getFunctionCode(), response[2],
+                                        response.size());
+    TEST_ASSERT_EQUAL_UINT32(1, client.pendingRequests()); // removed after the callback like eModbus
+    if (index >= 0)
+    {
+      responses[index]++;
+      decodeRegisters(response.data() + 3, response[2], values, DEVICES[index].numValues);
+      uint16_t first = DEVICES[index].startRegister;
+      valuesOk = valuesOk && values[0] >= 190 + first * 10 && values[0] <= 210 + first * 10;
+    }
+  });
+  client.onErrorHandler([&](Error, uint32_t) { TEST_ASSERT_TRUE(false); });
+
+  scheduler.begin(millis());
+  while (millis() < 10000)
+  {
+    uint32_t waitTime;
+    int16_t index = scheduler.next(millis(), waitTime);
+    if (index == PollScheduler::NO_DEVICE)
+    {
+      FakeClock::advance(waitTime > 0 ? waitTime : 1);
+      continue;
+    }
+    const ModbusDevice &dev = DEVICES[index];
+    uint32_t token = dispatcher.nextToken(index, false, 2);
+    TEST_ASSERT_EQUAL(SUCCESS, client.addRequest(token, dev.serverID, dev.functionCode, dev.startRegister, dev.numValues));
+    scheduler.issued(index, millis());
+    TEST_ASSERT_TRUE(client.process());
+    TEST_ASSERT_EQUAL_UINT32(0, client.pendingRequests());
+  }
+  TEST_ASSERT_TRUE(valuesOk);
+  TEST_ASSERT_UINT32_WITHIN(1, 50, responses[0]); // every 200 ms
+  TEST_ASSERT_UINT32_WITHIN(1, 10, responses[1]); // every second
+  TEST_ASSERT_EQUAL_UINT32(responses[0] + responses[1], dispatcher.stats().dispatched);
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.missedDeadlines(0) + scheduler.missedDeadlines(1));
+}
+
+// one RS485 bus of main.cpp: its own line, client and scheduler, the dispatcher is shared
+struct BusUnderTest
+{
+  BusUnderTest(uint8_t number, const ModbusDevice *devices, uint16_t first, uint16_t count, RequestDispatcher &dispatcher)
+      : line(BAUDRATE, SERVERS, 2), // not the disturbing server
+        client(serial),
+        scheduler(devices + first, count),
+        number(number),
+        first(first),
+        time(0),
+        responses(0)
+  {
+    client.attach(line);
+    client.onDataHandler([this, &dispatcher](ModbusMessage response, uint32_t token) {
+      if (dispatcher.validate(this->number, token, response.getServerID(), response.getFunctionCode(), response[2],
+                              response.size()) >= 0)
+      {
+        responses++;
+      }
+    });
+    scheduler.begin(0);
+  }
+
+  SimulatedBus line;
+  HardwareSerial serial;
+  ModbusClientRTU client;
+  PollScheduler scheduler;
+  uint8_t number;
+  uint16_t first;
+  uint32_t time; // [ms] own time line of the bus task
+  uint32_t responses;
+};
+
+// runs the bus tasks side by side until <end>: the bus behind in time is always served next,
+// so every bus sees its own monotonic clock like a task on its own UART
+static void runBuses(BusUnderTest **buses, uint8_t numBuses, RequestDispatcher &dispatcher, uint32_t end)
+{
+  while (true)
+  {
+    BusUnderTest *bus = buses[0];
+    for (uint8_t b = 1; b < numBuses; ++b)
+    {
+      if (buses[b]->time < bus->time)
+        bus = buses[b];
+    }
+    if (bus->time >= end)
+    {
+      return;
+    }
+    FakeClock::set(bus->time);
+    uint32_t waitTime;
+    int16_t index = bus->scheduler.next(millis(), waitTime);
+    if (index == PollScheduler::NO_DEVICE)
+    {
+      bus->time += waitTime > 0 ? waitTime : 1;
+      continue;
+    }
+    const ModbusDevice &dev = bus->scheduler.device(index);
+    uint32_t token = dispatcher.nextToken(bus->first + index, false, 2);
+    TEST_ASSERT_EQUAL(SUCCESS, bus->client.addRequest(token, dev.serverID, dev.functionCode, dev.startRegister, dev.numValues));
+    bus->scheduler.issued(index, millis());
+    TEST_ASSERT_TRUE(bus->client.process());
+    bus->time = millis();
+  }
+}
+
+// the devices split across two buses answer twice as often as on one bus
+void test_two_buses_double_throughput(void)
+{
+  // more requests than one bus can carry: ~60 ms per request, 4 requests every 100 ms
+  static const ModbusDevice DEVICES[] = {
+      {"a", 1, 0x03, 0, 10, 0, 0, 100, 0, FORMAT_DECIMAL, 0},
+      {"b", 2, 0x03, 0, 10, 0, 0, 100, 0, FORMAT_DECIMAL, 0},
+      {"c", 1, 0x03, 20, 10, 0, 0, 100, 0, FORMAT_DECIMAL, 1},
+      {"d", 2, 0x03, 20, 10, 0, 0, 100, 0, FORMAT_DECIMAL, 1},
+  };
+  static const TagMapping MAPPING[] = {{0, 0}, {1, 0}, {2, 0}, {3, 0}};
+  const uint32_t SECONDS = 20;
+
+  RequestDispatcher single(DEVICES, 4, MAPPING, 4);
+  BusUnderTest all(0, DEVICES, 0, 4, single);
+  BusUnderTest *one[] = {&all};
+  runBuses(one, 1, single, SECONDS * 1000);
+  uint32_t perSecond = all.responses / SECONDS;
+
+  RequestDispatcher dispatcher(DEVICES, 4, MAPPING, 4);
+  BusUnderTest bus0(0, DEVICES, 0, 2, dispatcher);
+  BusUnderTest bus1(1, DEVICES, 2, 2, dispatcher);
+  BusUnderTest *two[] = {&bus0, &bus1};
+  runBuses(two, 2, dispatcher, SECONDS * 1000);
+  uint32_t perSecondTwo = (bus0.responses + bus1.responses) / SECONDS;
+
+  TEST_ASSERT_GREATER_THAN(10, perSecond);
+  TEST_ASSERT_UINT32_WITHIN(perSecond / 10, 2 * perSecond, perSecondTwo);
+  TEST_ASSERT_UINT32_WITHIN(bus0.responses / 20, bus0.responses, bus1.responses); // same load on both buses
+
+  // the dispatch counters are kept per bus
+  TEST_ASSERT_EQUAL_UINT32(bus0.responses, dispatcher.stats(0).dispatched);
+  TEST_ASSERT_EQUAL_UINT32(bus1.responses, dispatcher.stats(1).dispatched);
+  TEST_ASSERT_EQUAL_UINT32(bus0.responses + bus1.responses, dispatcher.stats().dispatched);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_read_wire_time);
+  RUN_TEST(test_unknown_server_times_out);
+  RUN_TEST(test_illegal_count_is_exception);
+  RUN_TEST(test_write_then_read);
+  RUN_TEST(test_disturbing_server_breaks_next_request);
+  RUN_TEST(test_same_seed_same_faults);
+  RUN_TEST(test_poll_cycle_over_client_stub);
+  RUN_TEST(test_two_buses_double_throughput);
+  return UNITY_END();
+}
@@ -0,0 +1,165 @@
+/*
+Stress test of the RegisterSnapshot seqlock: one writer thread (the eModbus
+task), several reader threads (loop(), web server), every copy must be a
+complete snapshot and the sequence must never go back
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "RegisterSnapshot.h"
+
+#define READERS 4
+#define SNAPSHOTS 200000
+
+static RegisterSnapshot *snapshot;
+static std::atomic<bool> writing;
+
+// snapshot n: n values, all of them and the timestamp are n
+static uint16_t sizeOf(uint32_t n) { return 1 + n % MODBUS_MAX_READ_REGISTERS; }
+
+static void writer()
+{
+  for (uint32_t n = 1; n <= SNAPSHOTS; ++n)
+  {
+    uint16_t *values = snapshot->beginWrite();
+    for (uint16_t i = 0; i < sizeOf(n); ++i)
+    {
+      values[i] = (uint16_t)n;
+    }
+    snapshot->commit(n, sizeOf(n));
+    if (n % 64 == 0)
+    {
+      std::this_thread::yield(); // like a poll period, gives the readers a chance
+    }
+  }
+  writing = false;
+}
+
+struct ReaderResult
+{
+  uint32_t reads;
+  uint32_t retriesExceeded;
+  uint32_t torn;
+  uint32_t backwards;
+};
+
+static void reader(ReaderResult *result, bool partial)
+{
+  SnapshotData copy;
+  uint32_t last = 0;
+  while (writing)
+  {
+    bool ok;
+    uint32_t n;
+    bool consistent = true;
+    if (partial)
+    {
+      uint16_t values[2];
+      uint32_t timestamp;
+      ok = snapshot->read(0, 1, values, &timestamp);
+      n = timestamp;
+      consistent = values[0] == (uint16_t)n;
+    }
+    else
+    {
+      ok = snapshot->read(copy);
+      n = copy.timestamp;
+      if (ok)
+      {
+        consistent = copy.sequence == n && copy.numValues == sizeOf(n);
+        for (uint16_t i = 0; consistent && i < copy.numValues; ++i)
+        {
+          consistent = copy.values[i] == (uint16_t)n;
+        }
+      }
+    }
+    if (!ok)
+    {
+      result->retriesExceeded++;
+      continue;
+    }
+    result->reads++;
+    result->torn += consistent ? 0 : 1;
+    result->backwards += n < last ? 1 : 0;
+    last = n;
+    std::this_thread::yield(); // the writer must get the CPU on a single core host too
+  }
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_empty_snapshot(void)
+{
+  RegisterSnapshot empty;
+  SnapshotData data;
+  uint16_t value;
+  TEST_ASSERT_FALSE(empty.read(data));
+  TEST_ASSERT_FALSE(empty.read(0, 1, &value, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, empty.sequence());
+}
+
+void test_single_thread(void)
+{
+  RegisterSnapshot s;
+  uint16_t *values = s.beginWrite();
+  values[0] = 11;
+  values[1] = 22;
+  TEST_ASSERT_EQUAL_UINT32(0, s.sequence()); // not yet published
+  s.commit(1234, 2);
+  SnapshotData data;
+  TEST_ASSERT_TRUE(s.read(data));
+  TEST_ASSERT_EQUAL_UINT32(1, data.sequence);
+  TEST_ASSERT_EQUAL_UINT32(1234, data.timestamp);
+  TEST_ASSERT_EQUAL_UINT16(2, data.numValues);
+  TEST_ASSERT_EQUAL_UINT16(22, data.values[1]);
+  uint16_t value;
+  TEST_ASSERT_FALSE(s.read(1, 2, &value, 0)); // behind the received registers
+}
+
+void test_concurrent_readers(void)
+{
+  for (uint8_t partial = 0; partial < 2; ++partial)
+  {
+    snapshot = new RegisterSnapshot();
+    ReaderResult results[READERS] = {};
+    writing = true;
+    std::thread readers[READERS];
+    for (uint8_t r = 0; r < READERS; ++r)
+    {
+      readers[r] = std::thread(reader, &results[r], partial != 0);
+    }
+    std::thread w(writer);
+    w.join();
+    for (uint8_t r = 0; r < READERS; ++r)
+    {
+      readers[r].join();
+    }
+    uint32_t reads = 0;
+    for (uint8_t r = 0; r < READERS; ++r)
+    {
+      TEST_ASSERT_EQUAL_UINT32(0, results[r].torn);
+      TEST_ASSERT_EQUAL_UINT32(0, results[r].backwards);
+      reads += results[r].reads;
+    }
+    TEST_ASSERT_GREATER_THAN(0, reads);
+    TEST_ASSERT_EQUAL_UINT32(SNAPSHOTS, snapshot->sequence());
+    delete snapshot;
+  }
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_snapshot);
+  RUN_TEST(test_single_thread);
+  RUN_TEST(test_concurrent_readers);
+  return UNITY_END();
+}
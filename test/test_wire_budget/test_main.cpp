@@ -0,0 +1,98 @@
+/*
+Tests of the wire-time budget
+
+customized by Armin Pressler 2022
+*/
+#include <unity.h>
+#include "WireBudget.h"
+
+#define BAUDRATE 9600
+
+static const ModbusDevice REQUESTS[] = {
+    {"a", 1, 0x03, 0, 10, 0, 0, 1000, 0, FORMAT_DECIMAL, 0},
+    {"b", 2, 0x03, 0, 2, 0, 0, 1000, 0, FORMAT_DECIMAL, 1},
+};
+
+static WireBudget *budget;
+
+void setUp(void)
+{
+  budget = new WireBudget(REQUESTS, 2, BAUDRATE);
+}
+
+void tearDown(void)
+{
+  delete budget;
+}
+
+void test_wire_time(void)
+{
+  // 8 byte request + 25 byte response at 9600 baud, 1041 us per character + 3643 us gap each
+  TEST_ASSERT_EQUAL_UINT32(33 * 1041 + 2 * 3643, budget->wireTime(0));
+  TEST_ASSERT_EQUAL_UINT32(0, budget->wireTime(2));
+}
+
+void test_guard_after_counts_from_the_request(void)
+{
+  budget->requestSent(0, 0);
+  budget->completed(0, 60000, 10, 50); // guardAfter 50 ms ends before the response
+  budget->requestSent(0, 100000);
+  budget->completed(0, 160000, 10, 100); // 40 ms of guardAfter left after the response
+  budget->endCycle(1000);
+
+  const BudgetStats &a = budget->request(0);
+  TEST_ASSERT_EQUAL_UINT32(2, a.transfers);
+  TEST_ASSERT_EQUAL_UINT32(120000, a.busyTime);
+  TEST_ASSERT_EQUAL_UINT32(10000 + 10000 + 40000, a.guardTime);
+  TEST_ASSERT_EQUAL_UINT32(60000, budget->bus(0).guardTime);
+  TEST_ASSERT_EQUAL_UINT32(0, budget->bus(1).transfers);
+  TEST_ASSERT_EQUAL_UINT16(180, budget->utilization(0)); // 180 of 1000 ms
+  TEST_ASSERT_EQUAL_UINT32(820, budget->idleTime(0));
+}
+
+void test_control_writes_count_for_their_bus(void)
+{
+  budget->writeSent(1, 0x06, 1, 5, 100, 0);
+  budget->writeCompleted(1, 30000);
+  budget->writeSent(1, 0x10, 4, 0, 20, 50000);
+  budget->writeCompleted(1, 90000);
+  budget->endCycle(1000);
+
+  const BudgetStats &bus = budget->bus(1);
+  TEST_ASSERT_EQUAL_UINT32(2, bus.transfers);
+  TEST_ASSERT_EQUAL_UINT32(2 * (8 * 1041 + 3643) + (17 * 1041 + 3643) + (8 * 1041 + 3643), bus.wireTime);
+  TEST_ASSERT_EQUAL_UINT32(70000, bus.busyTime);
+  TEST_ASSERT_EQUAL_UINT32(5000 + 70000, bus.guardTime);
+  TEST_ASSERT_EQUAL_UINT32(0, budget->bus(0).transfers);
+  TEST_ASSERT_EQUAL_UINT32(0, budget->request(1).transfers); // not a read request
+}
+
+void test_end_cycle_keeps_the_finished_bank(void)
+{
+  budget->requestSent(1, 0);
+  budget->completed(1, 20000, 0, 0);
+  TEST_ASSERT_EQUAL_UINT32(1000, budget->endCycle(1000));
+  const BudgetStats &read = budget->bus(1); // a reader (e.g. /metrics) holds the finished cycle
+
+  budget->requestSent(1, 1000000);
+  budget->completed(1, 1030000, 0, 0);
+  TEST_ASSERT_EQUAL_UINT32(2000, budget->endCycle(3000));
+  TEST_ASSERT_EQUAL_UINT32(1, read.transfers); // not cleared under the reader
+  TEST_ASSERT_EQUAL_UINT32(20000, read.busyTime);
+  TEST_ASSERT_EQUAL_UINT32(30000, budget->bus(1).busyTime);
+  TEST_ASSERT_EQUAL_UINT32(2000, budget->cycleTime());
+
+  TEST_ASSERT_EQUAL_UINT32(1000, budget->endCycle(4000)); // empty cycle
+  TEST_ASSERT_EQUAL_UINT32(0, budget->bus(1).transfers);
+  TEST_ASSERT_EQUAL_UINT32(1000, budget->idleTime(1));
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_wire_time);
+  RUN_TEST(test_guard_after_counts_from_the_request);
+  RUN_TEST(test_control_writes_count_for_their_bus);
+  RUN_TEST(test_end_cycle_keeps_the_finished_bank);
+  return UNITY_END();
+}